@@ -7,17 +7,28 @@
  * Reads from gpsd via socket, provides averaged positions via JSON socket
  */
 
+#define _GNU_SOURCE // accept4
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <math.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <syslog.h>
 #include <time.h>
@@ -40,20 +51,82 @@
 #define GPS_SOURCE_NAME "nmea"
 #endif
 
+#include "gpsd_averaged_journal.h"
+#include "gpsd_averaged_shm.h"
+
 // ------------------------------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------------------------------
 
-#define WINDOW_SIZE 300           // Keep last 5 minutes at 1Hz
-#define KALMAN_PROCESS_NOISE 0.1  // Process noise for Kalman filter
-#define KALMAN_MEASURE_NOISE 25.0 // Measurement noise in meters
+#define WINDOW_RATE_MAX 10        // Fix rate (Hz) a duration window's raw tier is sized for
+#define WINDOW_RAW_MAX 65536      // Largest raw tier, in samples
+#define WINDOW_BUCKETS_MAX 7200   // Longest window (seconds) kept in per-second buckets, per-minute beyond
+#define WINDOW_DURATION_MAX (WINDOW_BUCKETS_MAX * 60)
+#define WINDOW_RESYNC 4096        // Additions between exact recomputes of the running window sums
+#define WINDOW_REBASE_DEG 1e-3    // Drift of the samples from the window origin that moves it, in degrees
+#define WINDOW_REBASE_ALT 100.0   // and in metres
+#define MEDIAN_BINS 65536         // Bins of the median's order statistics, per axis
+#define MEDIAN_RESOLUTION_M 0.005 // Width of each, metres
+#define MEDIAN_RECENTRE 16384     // Distance of the median from the centre bin at which the bins are moved to it
+#define MEDIAN_MAD_SIGMA 1.4826   // Standard deviations per MAD, for normally distributed samples
+#define KALMAN_UERE_M 2.0         // Horizontal error of a fix per unit of HDOP, one standard deviation per axis, metres
+#define KALMAN_HDOP_MIN 0.5       // Below which an HDOP is taken as this
+#define KALMAN_VERTICAL_RATIO 1.7 // Vertical error as a multiple of the horizontal
+#define KALMAN_SATELLITES_REF 8   // Satellites used below which the error is inflated in proportion
+#define KALMAN_CORRELATION_S 30.0 // Correlation time of the errors of successive fixes, seconds
+#define KALMAN_ERROR_MIN_M 0.1    // Floor on a receiver's error estimate, metres, against one that claims too much
+#define KALMAN_WANDER_M2S 0.01    // Random walk of the position when not anchored, square metres per second
+#define CUMULATIVE_BATCHES 32     // Batch means kept for the cumulative mean's standard error
+#define STABILITY_TAUS 18         // Octave taus of the Allan deviation, 1s to 2^17s (a day and a half)
+#define STABILITY_OVERLAP_BITS 3
+#define STABILITY_OVERLAP (1u << STABILITY_OVERLAP_BITS) // Blocks a tau is computed from, each of tau / this seconds
+#define STABILITY_LEVELS (STABILITY_TAUS - STABILITY_OVERLAP_BITS)
+#define STABILITY_GAP_MAX 10      // Seconds without a fix taken as the last; a longer gap is closed up
+#define STABILITY_TERMS_MIN 10    // Terms a tau needs to be reported as the status line's minimum
+#define CHECKPOINT_INTERVAL 60    // Seconds between checkpoints
+#define CHECKPOINT_AGREE 30       // Fixes agreeing with a restored state that confirm it
+#define CHECKPOINT_DISAGREE 10    // Consecutive fixes disagreeing with a restored state that discard it
+#define CHANGE_DRIFT 1.0          // Residual, as a fraction of the outlier gate, below which a fix counts against a move
+#define CHANGE_RESIDUAL_MAX 6.0   // Most one fix counts towards a move, so that a single wild one is not taken for it
+#define CHANGE_THRESHOLD 10.0     // Evidence of a move, in gates, at which it is declared
+#define CHANGE_AGREEMENT 2.0      // Multiple of their spread the mean offset of the fixes since must be, for a move
+#define CHANGE_PERSIST_MIN 10     // Seconds the fixes must stay away before a move is declared, when as tight as before
+#define CHANGE_PERSIST 120        // and when as much as CHANGE_SPREAD more scattered, to outlast multipath
+#define CHANGE_SPREAD 2.0         // Multiple of the spread before they left their spread may be at most, for a move
 
-typedef enum { AVERAGE_FILTER_SIMPLE, AVERAGE_FILTER_WINDOW, AVERAGE_FILTER_KALMAN } average_filter_t;
-static const char *average_filter_str[3] = { "simple", "window", "kalman" };
+typedef enum { AVERAGE_FILTER_SIMPLE, AVERAGE_FILTER_WINDOW, AVERAGE_FILTER_KALMAN, AVERAGE_FILTER_MEDIAN, AVERAGE_FILTERS } average_filter_t;
+#define AVERAGE_FILTER_BIT(filter) (1U << (filter))
+#define AVERAGE_FILTER_ALL (AVERAGE_FILTER_BIT(AVERAGE_FILTERS) - 1)
+static const char *average_filter_str[AVERAGE_FILTERS] = { "simple", "window", "kalman", "median" };
 static const char *get_filter_name(const average_filter_t filter) {
-    return (filter >= AVERAGE_FILTER_SIMPLE && filter <= AVERAGE_FILTER_KALMAN) ? average_filter_str[filter] : "unspecified";
+    return (filter >= AVERAGE_FILTER_SIMPLE && filter < AVERAGE_FILTERS) ? average_filter_str[filter] : "unspecified";
+}
+static bool get_filter_by_name(const char *const name, const size_t length, average_filter_t *const filter) {
+    for (unsigned int i = 0; i < AVERAGE_FILTERS; i++)
+        if (strlen(average_filter_str[i]) == length && strncmp(name, average_filter_str[i], length) == 0) {
+            *filter = (average_filter_t)i;
+            return true;
+        }
+    return false;
 }
 
 #define BUFFER_MAX 1024
+#define GPS_DRAIN_MAX 16          // Epochs processed per wakeup before the snapshot is published
+#define PROCESS_STALL_NS 1000000L // Publication time beyond which the serial path counts itself delayed
+#define DEVICES_MAX 4             // Receivers averaged at once, each with a thread of its own
+
+#define CLIENT_MAX 512                   // Concurrent connections
+#define CLIENT_BACKLOG 128               // Pending connections
+#define CLIENT_LISTEN_MAX 8              // Listening sockets, including any passed by systemd
+#define CLIENT_EVENTS_MAX 64             // Events taken per wakeup
+#define CLIENT_REQUEST_MAX 512           // Longest request line
+#define CLIENT_QUEUE_MAX 4096            // Output a client may have waiting before it is treated as slow
+#define CLIENT_DROPS_MAX 8               // Consecutive updates a slow watcher may lose before it is disconnected
+#define CLIENT_GREETING_MS 250           // Silence after connecting that is answered with a TPV and a close
+#define CLIENT_IDLE_TIMEOUT 60           // Seconds a client that is not watching may hold an idle connection
+#define CLIENT_EXPIRE_MS 100             // Interval between checks of the above
+#define CLIENT_HISTORY_PERIOD 3600       // Seconds ?HISTORY covers when not given a start
+#define CLIENT_HISTORY_BUCKETS_MAX 86400 // Buckets in one ?HISTORY reply
+#define CLIENT_HISTORY_TURN 32           // Buckets of a reply sent before the other clients are served
 
 static bool verbose = false;
 
@@ -74,10 +147,19 @@ static bool verbose = false;
 #endif
 #define DEFAULT_PORT (2947 + 1)
 #define DEFAULT_LISTENANY false
+#define DEFAULT_SOCKET_PATH NULL
+#define DEFAULT_METRICS_PORT 0
+#define DEFAULT_SHM_NAME NULL
 #define DEFAULT_FILTER AVERAGE_FILTER_SIMPLE
+#define DEFAULT_WINDOW_SAMPLES 300 // 5 minutes at 1Hz
+#define DEFAULT_WINDOW_DURATION 0
 #define DEFAULT_HDOP_MAX 20.0
+#define DEFAULT_CNO_MIN 0.0 // dB-Hz, none
 #define DEFAULT_SATELLITES_MIN 4
 #define DEFAULT_ANCHORED false
+#define DEFAULT_CHECKPOINT_PATH NULL
+#define DEFAULT_JOURNAL_PATH NULL
+#define DEFAULT_REPLAY_PATH NULL
 #define DEFAULT_INTERVAL_STATUS (30 * 60)
 #define DEFAULT_VERBOSE false
 #define DEFAULT_DAEMON false
@@ -97,22 +179,345 @@ static bool interval_passed(time_t *const last, const time_t interval) {
 // ------------------------------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------------------------------
 
+// Neumaier compensated sum: the running totals see one add and (once full) one evict per fix, indefinitely,
+// so plain summation would accumulate rounding without bound.
+typedef struct {
+    double sum, carry;
+} window_sum_t;
+
+static inline void window_sum_add(window_sum_t *const s, const double value) {
+    const double total = s->sum + value;
+    s->carry += (fabs(s->sum) >= fabs(value)) ? (s->sum - total) + value : (value - total) + s->sum;
+    s->sum = total;
+}
+
+static inline double window_sum_value(const window_sum_t *const s) { return s->sum + s->carry; }
+
+// Sum and sum of squares of a contiguous run of float offsets. A float widens to double exactly and its square
+// fits a double's mantissa exactly, so where double lanes exist (SSE2, AArch64) the only rounding is in the
+// accumulation. 32-bit NEON has no double lanes: it accumulates in float over short blocks, each then widened
+// into the double totals, which at window offsets of metres loses nothing at the resolution of a fix.
+#if defined(__SSE2__)
+#include <emmintrin.h>
+static void window_reduce(const float *const values, const size_t n, double *const sum, double *const sum_sq) {
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd(), q0 = _mm_setzero_pd(), q1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 v = _mm_loadu_ps(values + i);
+        const __m128d lo = _mm_cvtps_pd(v), hi = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+        s0 = _mm_add_pd(s0, lo);
+        s1 = _mm_add_pd(s1, hi);
+        q0 = _mm_add_pd(q0, _mm_mul_pd(lo, lo));
+        q1 = _mm_add_pd(q1, _mm_mul_pd(hi, hi));
+    }
+    double lanes_s[2], lanes_q[2];
+    _mm_storeu_pd(lanes_s, _mm_add_pd(s0, s1));
+    _mm_storeu_pd(lanes_q, _mm_add_pd(q0, q1));
+    double total_s = lanes_s[0] + lanes_s[1], total_q = lanes_q[0] + lanes_q[1];
+    for (; i < n; i++) {
+        const double v = (double)values[i];
+        total_s += v;
+        total_q += v * v;
+    }
+    *sum    = total_s;
+    *sum_sq = total_q;
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+static void window_reduce(const float *const values, const size_t n, double *const sum, double *const sum_sq) {
+    float64x2_t s0 = vdupq_n_f64(0.0), s1 = vdupq_n_f64(0.0), q0 = vdupq_n_f64(0.0), q1 = vdupq_n_f64(0.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t v = vld1q_f32(values + i);
+        const float64x2_t lo = vcvt_f64_f32(vget_low_f32(v)), hi = vcvt_high_f64_f32(v);
+        s0 = vaddq_f64(s0, lo);
+        s1 = vaddq_f64(s1, hi);
+        q0 = vfmaq_f64(q0, lo, lo);
+        q1 = vfmaq_f64(q1, hi, hi);
+    }
+    double total_s = vaddvq_f64(vaddq_f64(s0, s1)), total_q = vaddvq_f64(vaddq_f64(q0, q1));
+    for (; i < n; i++) {
+        const double v = (double)values[i];
+        total_s += v;
+        total_q += v * v;
+    }
+    *sum    = total_s;
+    *sum_sq = total_q;
+}
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define WINDOW_REDUCE_BLOCK 64 // floats per float-precision partial sum
+static void window_reduce(const float *const values, const size_t n, double *const sum, double *const sum_sq) {
+    double total_s = 0, total_q = 0;
+    size_t i = 0;
+    while (i + 4 <= n) {
+        float32x4_t s = vdupq_n_f32(0.0f), q = vdupq_n_f32(0.0f);
+        const size_t block_end = (n - i > WINDOW_REDUCE_BLOCK) ? i + WINDOW_REDUCE_BLOCK : n;
+        for (; i + 4 <= block_end; i += 4) {
+            const float32x4_t v = vld1q_f32(values + i);
+            s = vaddq_f32(s, v);
+            q = vmlaq_f32(q, v, v);
+        }
+        float lanes_s[4], lanes_q[4];
+        vst1q_f32(lanes_s, s);
+        vst1q_f32(lanes_q, q);
+        total_s += ((double)lanes_s[0] + (double)lanes_s[1]) + ((double)lanes_s[2] + (double)lanes_s[3]);
+        total_q += ((double)lanes_q[0] + (double)lanes_q[1]) + ((double)lanes_q[2] + (double)lanes_q[3]);
+    }
+    for (; i < n; i++) {
+        const double v = (double)values[i];
+        total_s += v;
+        total_q += v * v;
+    }
+    *sum    = total_s;
+    *sum_sq = total_q;
+}
+#else
+static void window_reduce(const float *const values, const size_t n, double *const sum, double *const sum_sq) {
+    double total_s = 0, total_q = 0;
+    for (size_t i = 0; i < n; i++) {
+        const double v = (double)values[i];
+        total_s += v;
+        total_q += v * v;
+    }
+    *sum    = total_s;
+    *sum_sq = total_q;
+}
+#endif
+
+// The window holds the most recent samples individually in a raw tier, allocated once at startup. A count
+// window is the raw tier alone. A duration window evicts by sample age, and so must hold however many samples
+// the receiver's rate puts into that span: samples displaced from a full raw tier while still inside the window
+// are folded into an aggregate tier of per-second (or, for long windows, per-minute) buckets. Either way the
+// memory is fixed at startup and the per-fix cost does not depend on the window length, so an anchored site can
+// average over hours at 10Hz. Duration eviction is exact in the raw tier and to the bucket width beyond it.
+//
+// The raw tier is a structure of arrays, holding each axis as float offsets from a double origin near the
+// samples: a reduction over one axis then reads only that axis, contiguously, at half the width of a double,
+// and vectorises. Float offsets resolve ~1e-10 degree within the 1e-3 degree that the origin is allowed to
+// trail the samples by before it is moved.
+//
+// Mean and variance are kept as running sums so that each fix costs O(1) rather than a pass over the window.
+// The sums are of the offsets rather than of raw degrees: at 1e-8 degree resolution the raw squares would
+// cancel away all significance in sum_sq/n - mean^2. Drift is bounded by an exact recompute every
+// WINDOW_RESYNC additions, which is also when the origin is moved, if the samples have wandered from it.
+typedef struct {
+    time_t start;
+    unsigned long count;
+    double sum_lat, sum_lon, sum_alt;
+    double sum_sq_lat, sum_sq_lon, sum_sq_alt;
+} window_bucket_t;
+
+// Order statistics of the raw tier, kept only for the median filter: per axis, a Fenwick tree of counts over
+// MEDIAN_BINS bins of MEDIAN_RESOLUTION_M about a centre near the samples, in east/north/up metres. The k-th
+// smallest sample is then one descent of the tree, and the samples within a span two prefix sums, each O(log N),
+// so the median and the MAD cost the same at any window size. Each raw sample's bin is kept beside it, so that
+// it leaves the tree exactly as it entered whatever the window's origin has done since. A sample beyond the bins
+// is counted in the end one, which leaves the median and MAD as they were while fewer than half are that far out;
+// a median that strays MEDIAN_RECENTRE bins from the centre moves the centre to it, rebuilding the trees.
 typedef struct {
-    double lat, lon, alt;
-    time_t timestamp;
-} sample_t;
+    uint32_t *tree[3]; // east, north, up; 1-based, MEDIAN_BINS + 1 nodes
+    uint16_t *bin[3];  // each raw sample's, indexed as the raw tier
+    double centre_lat, centre_lon, centre_alt;
+    double metres_lon;
+} window_order_t;
+
 typedef struct {
-    sample_t samples[WINDOW_SIZE];
-    int head, size;
+    time_t duration; // 0 for a count window
+    float *lat, *lon, *alt;
+    time_t *timestamp;
+    size_t raw_capacity, raw_tail, raw_size;
+    window_bucket_t *buckets;
+    size_t bucket_capacity, bucket_tail, bucket_size;
+    time_t bucket_width;
+    size_t size; // samples in the window, over both tiers
+    double origin_lat, origin_lon, origin_alt;
+    window_sum_t sum_lat, sum_lon, sum_alt;
+    window_sum_t sum_sq_lat, sum_sq_lon, sum_sq_alt;
+    unsigned int resync; // unsigned, so the bound check carries no signed-overflow assumption for the optimiser
+    window_order_t order; // NULL trees unless kept
 } sliding_window_t;
 
-static void window_add(sliding_window_t *const w, const double lat, const double lon, const double alt) {
-    w->samples[w->head].lat       = lat;
-    w->samples[w->head].lon       = lon;
-    w->samples[w->head].alt       = alt;
-    w->samples[w->head].timestamp = time(NULL);
-    w->head                       = (w->head + 1) % WINDOW_SIZE;
-    w->size                       = w->size + (w->size < WINDOW_SIZE ? 1 : 0);
+static bool window_begin(sliding_window_t *const w, const size_t samples, const time_t duration, const bool ordered) {
+    *w          = (sliding_window_t){ 0 };
+    w->duration = duration;
+    if (duration > 0) {
+        const size_t expected = (size_t)duration * WINDOW_RATE_MAX;
+        w->raw_capacity       = (expected < WINDOW_RAW_MAX) ? expected : WINDOW_RAW_MAX;
+        w->bucket_width       = (duration <= WINDOW_BUCKETS_MAX) ? 1 : 60;
+        w->bucket_capacity    = (size_t)(duration / w->bucket_width) + 2; // partial buckets at either end
+    } else
+        w->raw_capacity = (samples < WINDOW_RAW_MAX) ? samples : WINDOW_RAW_MAX;
+    if (w->raw_capacity == 0)
+        w->raw_capacity = 1;
+    w->lat       = calloc(w->raw_capacity, sizeof(float));
+    w->lon       = calloc(w->raw_capacity, sizeof(float));
+    w->alt       = calloc(w->raw_capacity, sizeof(float));
+    w->timestamp = calloc(w->raw_capacity, sizeof(time_t));
+    w->buckets   = (w->bucket_capacity > 0) ? calloc(w->bucket_capacity, sizeof(window_bucket_t)) : NULL;
+    for (unsigned int axis = 0; ordered && axis < 3; axis++)
+        if ((w->order.tree[axis] = calloc(MEDIAN_BINS + 1, sizeof(uint32_t))) == NULL || (w->order.bin[axis] = calloc(w->raw_capacity, sizeof(uint16_t))) == NULL)
+            return false;
+    return w->lat != NULL && w->lon != NULL && w->alt != NULL && w->timestamp != NULL && (w->bucket_capacity == 0 || w->buckets != NULL);
+}
+
+static void window_end(sliding_window_t *const w) {
+    free(w->lat);
+    free(w->lon);
+    free(w->alt);
+    free(w->timestamp);
+    free(w->buckets);
+    w->lat = w->lon = w->alt = NULL;
+    w->timestamp             = NULL;
+    w->buckets               = NULL;
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        free(w->order.tree[axis]);
+        free(w->order.bin[axis]);
+        w->order.tree[axis] = NULL;
+        w->order.bin[axis]  = NULL;
+    }
+}
+
+static void window_order_add(uint32_t *const tree, const unsigned int bin, const uint32_t delta) {
+    for (unsigned int i = bin + 1; i <= MEDIAN_BINS; i += i & -i)
+        tree[i] += delta; // a removal adds (uint32_t)-1, wrapping
+}
+
+// Samples in bins 0..bin.
+static uint32_t window_order_prefix(const uint32_t *const tree, const unsigned int bin) {
+    uint32_t count = 0;
+    for (unsigned int i = bin + 1; i > 0; i -= i & -i)
+        count += tree[i];
+    return count;
+}
+
+// The bin of the k-th smallest sample, k from 1.
+static unsigned int window_order_select(const uint32_t *const tree, uint32_t k) {
+    unsigned int position = 0;
+    for (unsigned int step = MEDIAN_BINS; step > 0; step >>= 1)
+        if (position + step <= MEDIAN_BINS && tree[position + step] < k) {
+            position += step;
+            k -= tree[position];
+        }
+    return position;
+}
+
+static double window_order_value(const unsigned int bin) { return ((double)bin - MEDIAN_BINS / 2 + 0.5) * MEDIAN_RESOLUTION_M; }
+
+static void window_order_insert(window_order_t *const o, const size_t index, const double lat, const double lon, const double alt) {
+    const double offset[3] = { (lon - o->centre_lon) * o->metres_lon, (lat - o->centre_lat) * 111320.0, alt - o->centre_alt };
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        const double bin    = floor(offset[axis] / MEDIAN_RESOLUTION_M) + MEDIAN_BINS / 2;
+        o->bin[axis][index] = (uint16_t)((bin < 0) ? 0 : (bin > MEDIAN_BINS - 1) ? MEDIAN_BINS - 1 : bin);
+        window_order_add(o->tree[axis], o->bin[axis][index], 1);
+    }
+}
+
+static void window_order_remove(window_order_t *const o, const size_t index) {
+    for (unsigned int axis = 0; axis < 3; axis++)
+        window_order_add(o->tree[axis], o->bin[axis][index], (uint32_t)-1);
+}
+
+// Median of one axis (the mean of the middle two for an even count), in metres from the centre, and its MAD: the
+// half-width about the median that holds half the samples, found by bisection on the count within it.
+static void window_order_axis(const uint32_t *const tree, const size_t n, double *const median, double *const mad) {
+    const uint32_t lower = (uint32_t)((n + 1) / 2), upper = (uint32_t)(n / 2 + 1);
+    const unsigned int low_bin = window_order_select(tree, lower), high_bin = window_order_select(tree, upper);
+    *median = (window_order_value(low_bin) + window_order_value(high_bin)) / 2.0;
+    unsigned int low = 0, high = MEDIAN_BINS;
+    while (low < high) {
+        const unsigned int width = (low + high) / 2, top = (high_bin + width < MEDIAN_BINS) ? high_bin + width : MEDIAN_BINS - 1;
+        const uint32_t within = window_order_prefix(tree, top) - ((low_bin > width) ? window_order_prefix(tree, low_bin - width - 1) : 0);
+        if (within >= lower)
+            high = width;
+        else
+            low = width + 1;
+    }
+    *mad = (double)low * MEDIAN_RESOLUTION_M;
+}
+
+static bool window_ordered(const sliding_window_t *const w) { return w->order.tree[0] != NULL; }
+
+// The median of the raw tier per axis, and the MADs in metres, east/north/up.
+static void window_calculate_median(const sliding_window_t *const w, double *const lat, double *const lon, double *const alt, double mad[3]) {
+    double median[3];
+    for (unsigned int axis = 0; axis < 3; axis++)
+        window_order_axis(w->order.tree[axis], w->raw_size, &median[axis], &mad[axis]);
+    *lat = w->order.centre_lat + median[1] / 111320.0;
+    *lon = w->order.centre_lon + median[0] / w->order.metres_lon;
+    *alt = w->order.centre_alt + median[2];
+}
+
+// Centres the bins on the given position and recounts the raw tier into them.
+static void window_order_rebuild(sliding_window_t *const w, const double lat, const double lon, const double alt) {
+    window_order_t *const o = &w->order;
+    o->centre_lat           = lat;
+    o->centre_lon           = lon;
+    o->centre_alt           = alt;
+    o->metres_lon           = 111320.0 * cos(lat * M_PI / 180.0);
+    for (unsigned int axis = 0; axis < 3; axis++)
+        memset(o->tree[axis], 0, (MEDIAN_BINS + 1) * sizeof(uint32_t));
+    for (size_t i = 0, index = w->raw_tail; i < w->raw_size; i++, index = (index + 1) % w->raw_capacity)
+        window_order_insert(o, index, w->origin_lat + (double)w->lat[index], w->origin_lon + (double)w->lon[index], w->origin_alt + (double)w->alt[index]);
+}
+
+static void window_order_recentre(sliding_window_t *const w) {
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        const unsigned int bin = window_order_select(w->order.tree[axis], (uint32_t)((w->raw_size + 1) / 2));
+        if (bin + MEDIAN_RECENTRE < MEDIAN_BINS / 2 || bin > MEDIAN_BINS / 2 + MEDIAN_RECENTRE) {
+            double lat, lon, alt, mad[3];
+            window_calculate_median(w, &lat, &lon, &alt, mad);
+            window_order_rebuild(w, lat, lon, alt);
+            return;
+        }
+    }
+}
+
+// Empties the window, keeping its storage.
+static void window_clear(sliding_window_t *const w) {
+    w->raw_tail = w->raw_size = w->bucket_tail = w->bucket_size = w->size = 0;
+    w->sum_lat = w->sum_lon = w->sum_alt = w->sum_sq_lat = w->sum_sq_lon = w->sum_sq_alt = (window_sum_t){ 0 };
+    w->resync                                                                           = 0;
+    for (unsigned int axis = 0; window_ordered(w) && axis < 3; axis++)
+        memset(w->order.tree[axis], 0, (MEDIAN_BINS + 1) * sizeof(uint32_t));
+}
+
+// Moves the times of the samples held, as when the clock they were taken by turns out to be off by delta.
+static void window_rebase(sliding_window_t *const w, const time_t delta) {
+    for (size_t i = 0; i < w->raw_size; i++)
+        w->timestamp[(w->raw_tail + i) % w->raw_capacity] += delta;
+    for (size_t i = 0; i < w->bucket_size; i++)
+        w->buckets[(w->bucket_tail + i) % w->bucket_capacity].start += delta;
+}
+
+static void window_accumulate(sliding_window_t *const w, const size_t index, const double sign) {
+    const double dlat = (double)w->lat[index], dlon = (double)w->lon[index], dalt = (double)w->alt[index];
+    window_sum_add(&w->sum_lat, sign * dlat);
+    window_sum_add(&w->sum_lon, sign * dlon);
+    window_sum_add(&w->sum_alt, sign * dalt);
+    window_sum_add(&w->sum_sq_lat, sign * dlat * dlat);
+    window_sum_add(&w->sum_sq_lon, sign * dlon * dlon);
+    window_sum_add(&w->sum_sq_alt, sign * dalt * dalt);
+}
+
+static void window_accumulate_bucket(sliding_window_t *const w, const window_bucket_t *const b, const double sign) {
+    window_sum_add(&w->sum_lat, sign * b->sum_lat);
+    window_sum_add(&w->sum_lon, sign * b->sum_lon);
+    window_sum_add(&w->sum_alt, sign * b->sum_alt);
+    window_sum_add(&w->sum_sq_lat, sign * b->sum_sq_lat);
+    window_sum_add(&w->sum_sq_lon, sign * b->sum_sq_lon);
+    window_sum_add(&w->sum_sq_alt, sign * b->sum_sq_alt);
+}
+
+// Re-expresses a bucket's sums about an origin moved by the given delta, exactly, without its samples.
+static void window_bucket_rebase(window_bucket_t *const b, const double dlat, const double dlon, const double dalt) {
+    const double n = (double)b->count;
+    b->sum_sq_lat += n * dlat * dlat - 2.0 * dlat * b->sum_lat;
+    b->sum_sq_lon += n * dlon * dlon - 2.0 * dlon * b->sum_lon;
+    b->sum_sq_alt += n * dalt * dalt - 2.0 * dalt * b->sum_alt;
+    b->sum_lat -= n * dlat;
+    b->sum_lon -= n * dlon;
+    b->sum_alt -= n * dalt;
 }
 
 static void window_calculate_mean(const sliding_window_t *const w, double *avg_lat, double *avg_lon, double *avg_alt) {
@@ -120,38 +525,150 @@ static void window_calculate_mean(const sliding_window_t *const w, double *avg_l
         *avg_lat = *avg_lon = *avg_alt = 0;
         return;
     }
-    double sum_lat = 0, sum_lon = 0, sum_alt = 0;
-    for (int i = 0; i < w->size; i++) {
-        const int idx = (((w->size < WINDOW_SIZE) ? 0 : w->head) + i) % WINDOW_SIZE;
-        sum_lat += w->samples[idx].lat;
-        sum_lon += w->samples[idx].lon;
-        sum_alt += w->samples[idx].alt;
+    *avg_lat = w->origin_lat + window_sum_value(&w->sum_lat) / (double)w->size;
+    *avg_lon = w->origin_lon + window_sum_value(&w->sum_lon) / (double)w->size;
+    *avg_alt = w->origin_alt + window_sum_value(&w->sum_alt) / (double)w->size;
+}
+
+static void window_rebase_axis(float *const values, const size_t n, const float delta) {
+    for (size_t i = 0; i < n; i++)
+        values[i] -= delta;
+}
+
+// Reduces one axis of the raw tier, walked as its two contiguous spans rather than by a ring index per sample.
+static void window_reduce_axis(const sliding_window_t *const w, const float *const values, window_sum_t *const sum, window_sum_t *const sum_sq) {
+    const size_t first = (w->raw_size < w->raw_capacity - w->raw_tail) ? w->raw_size : w->raw_capacity - w->raw_tail;
+    double s, q;
+    window_reduce(values + w->raw_tail, first, &s, &q);
+    window_sum_add(sum, s);
+    window_sum_add(sum_sq, q);
+    window_reduce(values, w->raw_size - first, &s, &q);
+    window_sum_add(sum, s);
+    window_sum_add(sum_sq, q);
+}
+
+static void window_recompute(sliding_window_t *const w) {
+    double avg_lat, avg_lon, avg_alt;
+    window_calculate_mean(w, &avg_lat, &avg_lon, &avg_alt);
+    if (fabs(avg_lat - w->origin_lat) > WINDOW_REBASE_DEG || fabs(avg_lon - w->origin_lon) > WINDOW_REBASE_DEG || fabs(avg_alt - w->origin_alt) > WINDOW_REBASE_ALT) {
+        // The delta is applied as the float the samples will see, so that buckets and raw tier move together.
+        const float dlat = (float)(avg_lat - w->origin_lat), dlon = (float)(avg_lon - w->origin_lon), dalt = (float)(avg_alt - w->origin_alt);
+        w->origin_lat += (double)dlat;
+        w->origin_lon += (double)dlon;
+        w->origin_alt += (double)dalt;
+        window_rebase_axis(w->lat, w->raw_capacity, dlat);
+        window_rebase_axis(w->lon, w->raw_capacity, dlon);
+        window_rebase_axis(w->alt, w->raw_capacity, dalt);
+        for (size_t i = 0; i < w->bucket_size; i++)
+            window_bucket_rebase(&w->buckets[(w->bucket_tail + i) % w->bucket_capacity], (double)dlat, (double)dlon, (double)dalt);
+    }
+    w->sum_lat = w->sum_lon = w->sum_alt = w->sum_sq_lat = w->sum_sq_lon = w->sum_sq_alt = (window_sum_t){ 0 };
+    for (size_t i = 0; i < w->bucket_size; i++)
+        window_accumulate_bucket(w, &w->buckets[(w->bucket_tail + i) % w->bucket_capacity], 1.0);
+    window_reduce_axis(w, w->lat, &w->sum_lat, &w->sum_sq_lat);
+    window_reduce_axis(w, w->lon, &w->sum_lon, &w->sum_sq_lon);
+    window_reduce_axis(w, w->alt, &w->sum_alt, &w->sum_sq_alt);
+    w->resync = 0;
+}
+
+static void window_pop_bucket(sliding_window_t *const w) {
+    const window_bucket_t *const b = &w->buckets[w->bucket_tail];
+    window_accumulate_bucket(w, b, -1.0);
+    w->size -= b->count;
+    w->bucket_tail = (w->bucket_tail + 1) % w->bucket_capacity;
+    w->bucket_size--;
+}
+
+// Moves a sample displaced from the raw tier into the aggregate tier: it stays in the window, so the running
+// sums are unchanged. Samples leave the raw tier oldest first, so buckets are only ever appended in order.
+static void window_fold(sliding_window_t *const w, const size_t index) {
+    const time_t start = w->timestamp[index] - (w->timestamp[index] % w->bucket_width);
+    window_bucket_t *b = (w->bucket_size > 0) ? &w->buckets[(w->bucket_tail + w->bucket_size - 1) % w->bucket_capacity] : NULL;
+    if (b == NULL || b->start != start) {
+        if (w->bucket_size == w->bucket_capacity)
+            window_pop_bucket(w);
+        b  = &w->buckets[(w->bucket_tail + w->bucket_size++) % w->bucket_capacity];
+        *b = (window_bucket_t){ .start = start };
+    }
+    const double dlat = (double)w->lat[index], dlon = (double)w->lon[index], dalt = (double)w->alt[index];
+    b->count++;
+    b->sum_lat += dlat;
+    b->sum_lon += dlon;
+    b->sum_alt += dalt;
+    b->sum_sq_lat += dlat * dlat;
+    b->sum_sq_lon += dlon * dlon;
+    b->sum_sq_alt += dalt * dalt;
+}
+
+// A bucket leaves once the whole of its span has aged out, a raw sample as soon as it has.
+static void window_expire(sliding_window_t *const w, const time_t now) {
+    if (w->duration == 0)
+        return;
+    const time_t cutoff = now - w->duration;
+    while (w->bucket_size > 0 && w->buckets[w->bucket_tail].start + w->bucket_width <= cutoff)
+        window_pop_bucket(w);
+    while (w->raw_size > 0 && w->timestamp[w->raw_tail] <= cutoff) {
+        window_accumulate(w, w->raw_tail, -1.0);
+        if (window_ordered(w))
+            window_order_remove(&w->order, w->raw_tail);
+        w->raw_tail = (w->raw_tail + 1) % w->raw_capacity;
+        w->raw_size--;
+        w->size--;
+    }
+}
+
+static void window_add(sliding_window_t *const w, const double lat, const double lon, const double alt, const time_t timestamp) {
+    window_expire(w, timestamp);
+    if (w->size == 0) {
+        w->origin_lat = lat;
+        w->origin_lon = lon;
+        w->origin_alt = alt;
+        w->sum_lat = w->sum_lon = w->sum_alt = w->sum_sq_lat = w->sum_sq_lon = w->sum_sq_alt = (window_sum_t){ 0 };
+        if (window_ordered(w))
+            window_order_rebuild(w, lat, lon, alt); // empty, so this only centres it
+    }
+    if (w->raw_size == w->raw_capacity) {
+        if (window_ordered(w))
+            window_order_remove(&w->order, w->raw_tail);
+        if (w->bucket_capacity > 0)
+            window_fold(w, w->raw_tail);
+        else {
+            window_accumulate(w, w->raw_tail, -1.0);
+            w->size--;
+        }
+        w->raw_tail = (w->raw_tail + 1) % w->raw_capacity;
+        w->raw_size--;
+    }
+    const size_t index  = (w->raw_tail + w->raw_size) % w->raw_capacity;
+    w->lat[index]       = (float)(lat - w->origin_lat);
+    w->lon[index]       = (float)(lon - w->origin_lon);
+    w->alt[index]       = (float)(alt - w->origin_alt);
+    w->timestamp[index] = timestamp;
+    window_accumulate(w, index, 1.0);
+    w->raw_size++;
+    w->size++;
+    if (window_ordered(w)) {
+        window_order_insert(&w->order, index, lat, lon, alt);
+        window_order_recentre(w);
     }
-    *avg_lat = sum_lat / w->size;
-    *avg_lon = sum_lon / w->size;
-    *avg_alt = sum_alt / w->size;
+    if (++w->resync >= WINDOW_RESYNC)
+        window_recompute(w);
 }
 
-static void window_calculate_variance(const sliding_window_t *const w, double avg_lat, double avg_lon, double avg_alt, double *var_lat, double *var_lon, double *var_alt) {
+static void window_calculate_variance(const sliding_window_t *const w, double *var_lat, double *var_lon, double *var_alt) {
     if (w->size == 0) {
         *var_lat = *var_lon = *var_alt = 0;
         return;
     }
-    double sum_sq_lat = 0, sum_sq_lon = 0, sum_sq_alt = 0;
-    for (int i = 0; i < w->size; i++) {
-        const int idx     = (((w->size < WINDOW_SIZE) ? 0 : w->head) + i) % WINDOW_SIZE;
-        const double dlat = w->samples[idx].lat - avg_lat, dlon = w->samples[idx].lon - avg_lon, dalt = w->samples[idx].alt - avg_alt;
-        sum_sq_lat += dlat * dlat;
-        sum_sq_lon += dlon * dlon;
-        sum_sq_alt += dalt * dalt;
-    }
-    *var_lat = sum_sq_lat / w->size;
+    const double n = (double)w->size;
+    const double mean_lat = window_sum_value(&w->sum_lat) / n, mean_lon = window_sum_value(&w->sum_lon) / n, mean_alt = window_sum_value(&w->sum_alt) / n;
+    *var_lat = window_sum_value(&w->sum_sq_lat) / n - mean_lat * mean_lat;
     if (*var_lat < 0)
         *var_lat = 0;
-    *var_lon = sum_sq_lon / w->size;
+    *var_lon = window_sum_value(&w->sum_sq_lon) / n - mean_lon * mean_lon;
     if (*var_lon < 0)
         *var_lon = 0;
-    *var_alt = sum_sq_alt / w->size;
+    *var_alt = window_sum_value(&w->sum_sq_alt) / n - mean_alt * mean_alt;
     if (*var_alt < 0)
         *var_alt = 0;
 }
@@ -160,7 +677,7 @@ static void window_get_stats(const sliding_window_t *const w, double *const avg_
                              double *const stddev_lon, double *const stddev_alt) {
     double var_lat, var_lon, var_alt;
     window_calculate_mean(w, avg_lat, avg_lon, avg_alt);
-    window_calculate_variance(w, *avg_lat, *avg_lon, *avg_alt, &var_lat, &var_lon, &var_alt);
+    window_calculate_variance(w, &var_lat, &var_lon, &var_alt);
     *stddev_lat = sqrt(var_lat);
     *stddev_lon = sqrt(var_lon);
     *stddev_alt = sqrt(var_alt);
@@ -168,101 +685,597 @@ static void window_get_stats(const sliding_window_t *const w, double *const avg_
 
 // ------------------------------------------------------------------------------------------------------------------------
 
+// The "kalman" filter: one filter on the position as east/north/up offsets in metres from its first fix, with the
+// full 3x3 covariance, so that the axes share units and any correlation between them is carried. The measurement
+// is the fix itself, with a noise built per fix: the receiver's own errors for it when it sends GST, or else
+// KALMAN_UERE_M per unit of HDOP horizontally, KALMAN_VERTICAL_RATIO times that vertically, and inflated when
+// fewer than KALMAN_SATELLITES_REF satellites were used. Anchored, the
+// position is constant; otherwise it is a random walk of KALMAN_WANDER_M2S.
+//
+// The errors of successive fixes are correlated over KALMAN_CORRELATION_S, so a filter taking each as independent
+// would shrink its covariance with the count of fixes rather than of independent ones, and claim centimetres
+// within minutes. The measurement noise is therefore scaled by the fixes per correlation time (2 tau / interval,
+// as for the mean of a first-order Gauss-Markov error), which leaves the estimate as it was, a mean weighted by
+// each fix's noise, and makes the covariance fall as the error of that mean does.
+//
+// The matrices are fixed at 3x3 and the loops over them have constant bounds, for the compiler to unroll.
+
+typedef struct {
+    double m[3][3];
+} kalman_matrix_t;
+
 typedef struct {
-    double estimate;
-    double error_covariance;
-    double process_noise;
-    double measure_noise;
+    double origin_lat, origin_lon, origin_alt;
+    double metres_lon; // per degree of longitude at the origin
+    double x[3];       // east, north, up from the origin, metres
+    kalman_matrix_t p; // covariance of x, square metres
+    uint64_t updates;  // zero until started by a first fix
 } kalman_state_t;
 
-static void kalman_init(kalman_state_t *const k, const double initial_estimate, const double initial_error) {
-    k->estimate         = initial_estimate;
-    k->error_covariance = initial_error * initial_error; // Convert to variance
-    k->process_noise    = KALMAN_PROCESS_NOISE;
-    k->measure_noise    = KALMAN_MEASURE_NOISE;
+// The measurement noise of a fix: the receiver's own error estimates when it gives them (GST), which weights each
+// fix by the inverse of its variance as the receiver sees it, or else the model from HDOP and satellites.
+static void kalman_noise(kalman_matrix_t *const r, const double hdop, const int satellites, const double *const error_m, const double scale) {
+    if (error_m != NULL) {
+        *r = (kalman_matrix_t){ 0 };
+        for (unsigned int axis = 0; axis < 3; axis++)
+            r->m[axis][axis] = fmax(error_m[axis], KALMAN_ERROR_MIN_M) * fmax(error_m[axis], KALMAN_ERROR_MIN_M) * scale;
+        return;
+    }
+    const double satellites_factor = (satellites > 0 && satellites < KALMAN_SATELLITES_REF) ? (double)KALMAN_SATELLITES_REF / (double)satellites : 1.0;
+    const double horizontal_m      = KALMAN_UERE_M * fmax(hdop, KALMAN_HDOP_MIN);
+    *r                      = (kalman_matrix_t){ 0 };
+    r->m[0][0] = r->m[1][1] = horizontal_m * horizontal_m * satellites_factor * scale;
+    r->m[2][2]              = r->m[0][0] * KALMAN_VERTICAL_RATIO * KALMAN_VERTICAL_RATIO;
+}
+
+static void kalman_offset(const kalman_state_t *const k, const double lat, const double lon, const double alt, double z[3]) {
+    z[0] = (lon - k->origin_lon) * k->metres_lon;
+    z[1] = (lat - k->origin_lat) * 111320.0;
+    z[2] = alt - k->origin_alt;
+}
+
+static void kalman_init(kalman_state_t *const k, const double lat, const double lon, const double alt, const kalman_matrix_t *const r) {
+    *k   = (kalman_state_t){ .origin_lat = lat, .origin_lon = lon, .origin_alt = alt, .metres_lon = 111320.0 * cos(lat * M_PI / 180.0), .updates = 1 };
+    k->p = *r;
+}
+
+// Inverse of a symmetric 3x3 matrix by its cofactors, or false if it is not positive definite.
+static bool kalman_invert(const kalman_matrix_t *const matrix, kalman_matrix_t *const inverse) {
+    const double(*const m)[3] = matrix->m;
+    const double c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1], c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2], c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    const double det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+    if (!(det > 0))
+        return false;
+    const double scale                  = 1.0 / det;
+    inverse->m[0][0]                    = c00 * scale;
+    inverse->m[0][1] = inverse->m[1][0] = c01 * scale;
+    inverse->m[0][2] = inverse->m[2][0] = c02 * scale;
+    inverse->m[1][1]                    = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * scale;
+    inverse->m[1][2] = inverse->m[2][1] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * scale;
+    inverse->m[2][2]                    = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * scale;
+    return true;
+}
+
+// Predicts with process noise q (horizontal, vertical) and updates with a fix of noise r.
+static bool kalman_update(kalman_state_t *const k, const double lat, const double lon, const double alt, const kalman_matrix_t *const r, const double q_horizontal,
+                          const double q_vertical) {
+    k->p.m[0][0] += q_horizontal;
+    k->p.m[1][1] += q_horizontal;
+    k->p.m[2][2] += q_vertical;
+
+    kalman_matrix_t s, s_inverse, gain;
+    for (unsigned int i = 0; i < 3; i++)
+        for (unsigned int j = 0; j < 3; j++)
+            s.m[i][j] = k->p.m[i][j] + r->m[i][j];
+    if (!kalman_invert(&s, &s_inverse))
+        return false;
+    for (unsigned int i = 0; i < 3; i++)
+        for (unsigned int j = 0; j < 3; j++)
+            gain.m[i][j] = k->p.m[i][0] * s_inverse.m[0][j] + k->p.m[i][1] * s_inverse.m[1][j] + k->p.m[i][2] * s_inverse.m[2][j];
+
+    double z[3];
+    kalman_offset(k, lat, lon, alt, z);
+    const double y[3] = { z[0] - k->x[0], z[1] - k->x[1], z[2] - k->x[2] };
+    for (unsigned int i = 0; i < 3; i++)
+        k->x[i] += gain.m[i][0] * y[0] + gain.m[i][1] * y[1] + gain.m[i][2] * y[2];
+
+    double p[3][3]; // (I - K) P, kept symmetric
+    for (unsigned int i = 0; i < 3; i++)
+        for (unsigned int j = 0; j < 3; j++)
+            p[i][j] = k->p.m[i][j] - (gain.m[i][0] * k->p.m[0][j] + gain.m[i][1] * k->p.m[1][j] + gain.m[i][2] * k->p.m[2][j]);
+    for (unsigned int i = 0; i < 3; i++)
+        for (unsigned int j = 0; j < 3; j++)
+            k->p.m[i][j] = (p[i][j] + p[j][i]) / 2.0;
+    k->updates++;
+    return true;
+}
+
+static void kalman_position(const kalman_state_t *const k, double *const lat, double *const lon, double *const alt) {
+    *lat = k->origin_lat + k->x[1] / 111320.0;
+    *lon = k->origin_lon + k->x[0] / k->metres_lon;
+    *alt = k->origin_alt + k->x[2];
+}
+
+// Horizontal radius at two standard deviations, metres.
+static double kalman_confidence(const kalman_state_t *const k) { return 2.0 * sqrt(k->p.m[0][0] + k->p.m[1][1]); }
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+// The "simple" filter: the mean of every accepted fix since the start, in constant memory and work per fix, for an
+// installation that does not move. The fixes are summed as east/north/up offsets in metres from the first, with
+// the same local scale as calculate_position_change_meters(), so that the sums stay small and the mean maps back
+// exactly; the sums are compensated, so millions of fixes lose no more precision than a handful.
+//
+// The fixes are strongly correlated over seconds to minutes, so the spread of the fixes over the square root of
+// their count would overstate the precision of the mean by a large factor. Its standard error is taken instead
+// from batch means: the fixes are grouped into consecutive batches, the spread of the batch means gives the error,
+// and when CUMULATIVE_BATCHES are full adjacent pairs are merged and the batch size doubles. The batches thus
+// lengthen with the run and soon span the correlation time, and the error shrinks as the mean's actually does.
+
+typedef struct {
+    double origin_lat, origin_lon, origin_alt; // the first fix
+    double metres_lon;                         // per degree of longitude at the origin
+    window_sum_t east, north, up;
+    uint64_t count;
+    double batches[CUMULATIVE_BATCHES][3]; // sums of each full batch, east/north/up
+    double partial[3];                     // and of the one being filled
+    uint64_t batch_size, partial_size;
+    uint32_t batch_count;
+} cumulative_t;
+
+static void cumulative_add(cumulative_t *const c, const double lat, const double lon, const double alt) {
+    if (c->count++ == 0) {
+        c->origin_lat = lat;
+        c->origin_lon = lon;
+        c->origin_alt = alt;
+        c->metres_lon = 111320.0 * cos(lat * M_PI / 180.0);
+        c->batch_size = 1;
+    }
+    const double offset[3] = { (lon - c->origin_lon) * c->metres_lon, (lat - c->origin_lat) * 111320.0, alt - c->origin_alt };
+    window_sum_add(&c->east, offset[0]);
+    window_sum_add(&c->north, offset[1]);
+    window_sum_add(&c->up, offset[2]);
+    for (unsigned int axis = 0; axis < 3; axis++)
+        c->partial[axis] += offset[axis];
+    if (++c->partial_size < c->batch_size)
+        return;
+    memcpy(c->batches[c->batch_count++], c->partial, sizeof(c->partial));
+    memset(c->partial, 0, sizeof(c->partial));
+    c->partial_size = 0;
+    if (c->batch_count == CUMULATIVE_BATCHES) {
+        for (unsigned int i = 0; i < CUMULATIVE_BATCHES / 2; i++)
+            for (unsigned int axis = 0; axis < 3; axis++)
+                c->batches[i][axis] = c->batches[2 * i][axis] + c->batches[2 * i + 1][axis];
+        c->batch_count = CUMULATIVE_BATCHES / 2;
+        c->batch_size *= 2;
+    }
+}
+
+static void cumulative_mean(const cumulative_t *const c, double *const lat, double *const lon, double *const alt) {
+    const double n = (double)c->count;
+    *lat           = c->origin_lat + window_sum_value(&c->north) / n / 111320.0;
+    *lon           = c->origin_lon + window_sum_value(&c->east) / n / c->metres_lon;
+    *alt           = c->origin_alt + window_sum_value(&c->up) / n;
 }
 
-static double kalman_update(kalman_state_t *const k, const double measurement) {
-    const double predicted_error = k->error_covariance + k->process_noise;                 // predict
-    const double kalman_gain     = predicted_error / (predicted_error + k->measure_noise); // update
-    k->estimate += kalman_gain * (measurement - k->estimate);
-    k->error_covariance = (1.0 - kalman_gain) * predicted_error;
-    return k->estimate;
+// Standard error of the mean in metres, east/north/up, or false until there are two batches to compare.
+static bool cumulative_error(const cumulative_t *const c, double error[3]) {
+    if (c->batch_count < 2)
+        return false;
+    const double k = (double)c->batch_count, size = (double)c->batch_size;
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        double mean = 0, sum_sq = 0;
+        for (unsigned int i = 0; i < c->batch_count; i++)
+            mean += c->batches[i][axis] / size;
+        mean /= k;
+        for (unsigned int i = 0; i < c->batch_count; i++)
+            sum_sq += (c->batches[i][axis] / size - mean) * (c->batches[i][axis] / size - mean);
+        error[axis] = sqrt(sum_sq / (k * (k - 1.0)));
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+// How long averaging goes on helping: the overlapping Allan deviation (ADEV) and modified Allan deviation (MDEV)
+// of the accepted fixes, east/north/up, at octave taus from 1s to 2^(STABILITY_TAUS-1)s. Treating the position as
+// the quantity averaged, the ADEV at tau is the spread between successive tau-long means: it falls as averaging
+// beats the noise down and turns up where drift (multipath, the antenna, the datum) dominates, so its minimum is
+// the most averaging worth doing. MDEV averages again over tau and so tells white noise from flicker.
+//
+// The fixes are reduced to per-second means, a second without one being taken as the last (up to
+// STABILITY_GAP_MAX of them, beyond which the gap is closed up), and fed to a cascade of decimating accumulators:
+// level 0 holds seconds, and each level above sums pairs of the blocks of the one below. A tau is computed from
+// STABILITY_OVERLAP blocks of the level at which that many make it, keeping the last 3 * STABILITY_OVERLAP in a
+// ring, and takes a term at every new block: fully overlapping up to STABILITY_OVERLAP seconds, and overlapping by
+// STABILITY_OVERLAP blocks beyond. The cost is a few multiplies per tau per second, and the memory fixed; MDEV
+// at the longer taus is that of the block means, a close approximation to the exact one.
+
+typedef struct {
+    unsigned long adev_terms[STABILITY_TAUS], mdev_terms[STABILITY_TAUS];
+    double adev_sum[STABILITY_TAUS][3], mdev_sum[STABILITY_TAUS][3]; // of the squared terms, east/north/up
+} stability_sums_t;
+
+typedef struct {
+    double blocks[3 * STABILITY_OVERLAP][3]; // sums of the last of its level's blocks, a ring
+    unsigned long count;
+} stability_tau_t;
+
+typedef struct {
+    double origin_lat, origin_lon, origin_alt; // the first fix
+    double metres_lon;                         // per degree of longitude at the origin
+    time_t second;                             // being summed
+    double second_sum[3], last[3];             // its fixes' offsets, and the mean of the one before
+    unsigned long fixes;
+    unsigned int second_count;
+    double level_sum[STABILITY_LEVELS][3]; // half of the next block of each level above 0
+    bool level_half[STABILITY_LEVELS];     // when it holds one
+    stability_tau_t taus[STABILITY_TAUS];
+    stability_sums_t sums;
+} stability_t;
+
+static unsigned int stability_blocks(const unsigned int tau) { return (tau < STABILITY_OVERLAP_BITS) ? 1u << tau : STABILITY_OVERLAP; }
+
+// Adds a block, the sum of tau / stability_blocks(tau) seconds' means, and takes the terms it completes: the
+// difference of the means over the last two taus, and that of the means of the tau-long means over the last two
+// taus, the blocks of the latter being weighted in a triangle (see the MDEV's definition on phase, of which these
+// are the second and third differences).
+static void stability_tau_add(stability_t *const s, const unsigned int tau, const double block[3]) {
+    stability_tau_t *const t = &s->taus[tau];
+    const unsigned int w = stability_blocks(tau), ring = 3 * w;
+    memcpy(t->blocks[t->count % ring], block, sizeof(t->blocks[0]));
+    const unsigned long count = ++t->count;
+    const double m = (double)(1ul << tau), size = m / w;
+#define STABILITY_BLOCK(age, axis) (t->blocks[(count - 1 - (age)) % ring][axis])
+    if (count >= 2 * w) {
+        for (unsigned int axis = 0; axis < 3; axis++) {
+            double difference = 0;
+            for (unsigned int age = 0; age < w; age++)
+                difference += STABILITY_BLOCK(age, axis) - STABILITY_BLOCK(age + w, axis);
+            s->sums.adev_sum[tau][axis] += (difference / m) * (difference / m);
+        }
+        s->sums.adev_terms[tau]++;
+    }
+    if (count >= 3 * w - 1) {
+        for (unsigned int axis = 0; axis < 3; axis++) {
+            double difference = 0;
+            for (unsigned int age = 0; age < 2 * w - 1; age++) {
+                const double weight = (age < w) ? age + 1 : 2 * w - 1 - age;
+                difference += weight * (STABILITY_BLOCK(age, axis) - STABILITY_BLOCK(age + w, axis));
+            }
+            difference *= size / (m * m);
+            s->sums.mdev_sum[tau][axis] += difference * difference;
+        }
+        s->sums.mdev_terms[tau]++;
+    }
+#undef STABILITY_BLOCK
+}
+
+// A second's mean into level 0 and up the cascade, as far as it completes blocks.
+static void stability_second(stability_t *const s, const double mean[3]) {
+    for (unsigned int tau = 0; tau <= STABILITY_OVERLAP_BITS && tau < STABILITY_TAUS; tau++)
+        stability_tau_add(s, tau, mean);
+    double block[3] = { mean[0], mean[1], mean[2] };
+    for (unsigned int level = 1; level < STABILITY_LEVELS; level++) {
+        if (!s->level_half[level]) {
+            memcpy(s->level_sum[level], block, sizeof(block));
+            s->level_half[level] = true;
+            return;
+        }
+        for (unsigned int axis = 0; axis < 3; axis++)
+            block[axis] += s->level_sum[level][axis];
+        s->level_half[level] = false;
+        stability_tau_add(s, level + STABILITY_OVERLAP_BITS, block);
+    }
+}
+
+// An accepted fix at the averaging's time. A second is complete when a fix for another arrives; a jump back in
+// time, as when the receiver first gives its date, is closed up as a long gap is.
+static void stability_add(stability_t *const s, const time_t now, const double lat, const double lon, const double alt) {
+    if (s->fixes++ == 0) {
+        s->origin_lat = lat;
+        s->origin_lon = lon;
+        s->origin_alt = alt;
+        s->metres_lon = 111320.0 * cos(lat * M_PI / 180.0);
+        s->second     = now;
+    } else if (now != s->second) {
+        for (unsigned int axis = 0; axis < 3; axis++)
+            s->last[axis] = s->second_sum[axis] / s->second_count;
+        stability_second(s, s->last);
+        for (time_t gap = now - s->second - 1; gap > 0 && gap <= STABILITY_GAP_MAX; gap--)
+            stability_second(s, s->last);
+        s->second       = now;
+        s->second_count = 0;
+        memset(s->second_sum, 0, sizeof(s->second_sum));
+    }
+    const double offset[3] = { (lon - s->origin_lon) * s->metres_lon, (lat - s->origin_lat) * 111320.0, alt - s->origin_alt };
+    for (unsigned int axis = 0; axis < 3; axis++)
+        s->second_sum[axis] += offset[axis];
+    s->second_count++;
+}
+
+static double stability_tau(const unsigned int tau) { return (double)(1ul << tau); }
+
+// ADEV or MDEV of an axis at a tau, metres, or 0 before it has a term; an axis of 3 is the horizontal, of east and north.
+static double stability_deviation(const stability_sums_t *const sums, const unsigned int tau, const unsigned int axis, const bool modified) {
+    const unsigned long terms = modified ? sums->mdev_terms[tau] : sums->adev_terms[tau];
+    const double *const sum   = modified ? sums->mdev_sum[tau] : sums->adev_sum[tau];
+    if (terms == 0)
+        return 0.0;
+    return sqrt(((axis < 3) ? sum[axis] : sum[0] + sum[1]) / (2.0 * (double)terms));
+}
+
+// The tau at which the ADEV of an axis (3 the horizontal) is least, of those with STABILITY_TERMS_MIN terms; false if none has.
+static bool stability_minimum(const stability_sums_t *const sums, const unsigned int axis, unsigned int *const tau, double *const deviation) {
+    bool found = false;
+    for (unsigned int t = 0; t < STABILITY_TAUS && sums->adev_terms[t] >= STABILITY_TERMS_MIN; t++) {
+        const double d = stability_deviation(sums, t, axis, false);
+        if (!found || d < *deviation) {
+            *tau       = t;
+            *deviation = d;
+            found      = true;
+        }
+    }
+    return found;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+// Whether the fixes at the outlier gate have moved for good, as when an anchored antenna is knocked or taken to a
+// new site: a one-sided CUSUM of each fix's residual, as a fraction of the gate, less CHANGE_DRIFT. The fixes of
+// a settled average sit well inside the gate and hold it at zero; those of a moved antenna fall outside, each
+// rejected, and it climbs to CHANGE_THRESHOLD within a few. The fixes since it left zero must also agree on
+// where they are, their mean offset CHANGE_AGREEMENT times their spread about it, so that a burst of multipath
+// scattered about the average is not taken for a move however long it lasts; be no more scattered than the fixes
+// were before, within CHANGE_SPREAD, as a moved antenna's are and a reflection's seldom; and have stayed away for
+// CHANGE_PERSIST_MIN when as tight as before, rising to CHANGE_PERSIST as their spread nears that bound, where they
+// are the likelier a reflection. A multipath episode that shifts every fix alike without scattering them is taken
+// for a move once it outlasts CHANGE_PERSIST_MIN: the price of declaring a real one within seconds.
+typedef struct {
+    double statistic;
+    time_t began;                  // when it left zero
+    double spread_before_m;        // the spread of the fixes then, 3D metres
+    unsigned int fixes;            // since it left zero
+    double sum[3], sum_squares[3]; // of their offsets from the gate's centre, east/north/up metres
+} change_t;
+
+// Adds a fix, returning true when a move is declared, with the distance of the fixes since from the gate's centre.
+// spread_m is the 3D spread of the fixes at the gate.
+static bool change_update(change_t *const change, const time_t now, const double residual, const double offset[3], const double spread_m, double *const moved_m) {
+    change->statistic = fmax(0.0, change->statistic + fmin(residual, CHANGE_RESIDUAL_MAX) - CHANGE_DRIFT);
+    if (change->statistic <= 0.0) {
+        *change = (change_t){ 0 };
+        return false;
+    }
+    if (change->fixes++ == 0) {
+        change->began           = now;
+        change->spread_before_m = spread_m;
+    }
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        change->sum[axis] += offset[axis];
+        change->sum_squares[axis] += offset[axis] * offset[axis];
+    }
+    if (change->statistic < CHANGE_THRESHOLD)
+        return false;
+    double mean_squared = 0.0, spread_squared = 0.0;
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        const double mean = change->sum[axis] / change->fixes;
+        mean_squared += mean * mean;
+        spread_squared += fmax(0.0, change->sum_squares[axis] / change->fixes - mean * mean);
+    }
+    *moved_m = sqrt(mean_squared);
+    if (mean_squared <= CHANGE_AGREEMENT * CHANGE_AGREEMENT * spread_squared ||
+        spread_squared > CHANGE_SPREAD * CHANGE_SPREAD * change->spread_before_m * change->spread_before_m)
+        return false;
+    const double scattered = fmin(1.0, fmax(0.0, (sqrt(spread_squared) / change->spread_before_m - 1.0) / (CHANGE_SPREAD - 1.0)));
+    return (double)(now - change->began) >= CHANGE_PERSIST_MIN + (CHANGE_PERSIST - CHANGE_PERSIST_MIN) * scattered;
+}
+
+// The 3D spread in metres of fixes with these standard deviations in degrees (latitude, longitude) and metres.
+static double change_spread_m(const double lat, const double stddev_lat, const double stddev_lon, const double stddev_alt) {
+    const double lat_m = stddev_lat * 111320.0, lon_m = stddev_lon * 111320.0 * cos(lat * M_PI / 180.0);
+    return sqrt(lat_m * lat_m + lon_m * lon_m + stddev_alt * stddev_alt);
 }
 
 // ------------------------------------------------------------------------------------------------------------------------
 
 typedef struct {
-    double lat_sum, lon_sum, alt_sum;
-    double lat_sum_sq, lon_sum_sq, alt_sum_sq;
     unsigned long count;
     time_t first_fix, last_fix;
+    time_t aging_from; // what the anchored time to converge counts from: the first fix, or the first after a restore until it is confirmed
     double latitude, longitude, altitude;
     double latitude_var, longitude_var, altitude_var;
     unsigned long received_fixes, rejected_fixes;
     unsigned long outliers_rejected;
-    average_filter_t filter;
+    unsigned long relocations; // moves declared by the change detector, each a restart from the new site
+    time_t relocated;          // when the last was
+    double relocated_m;        // and how far
+    time_t clock_offset;       // the receiver's UTC less the system clock, as at its last dated fix
+    bool clock_dated;          // whether the times are the receiver's: it has given a date, or they were restored as saved
+    average_filter_t filter;   // the one reported by default
+    unsigned int filters;      // those kept up to date, AVERAGE_FILTER_BIT()s, the default's always among them
     bool anchored;
     sliding_window_t window;
-    kalman_state_t kalman_lat, kalman_lon, kalman_alt;
+    kalman_state_t kalman;
+    cumulative_t cumulative;
+    stability_t stability;
+    change_t change;
     // Convergence tracking
     double last_lat, last_lon, last_alt;
     double pos_change_m, alt_change_m;
-    bool is_converged;
+    bool is_converged[AVERAGE_FILTERS];
+    // Warm start: a restored state is on probation until enough fixes agree with it
+    bool restored;
+    unsigned int restored_agree, restored_disagree;
 } average_state_t;
 
-static const char *get_convergence_str(const average_state_t *state, const double confidence_radius_m) {
-    if (state->is_converged)
-        return "CONVERGED";
+// The averaging's idea of now: the system clock, or in replay the time of the fix being replayed, so that its
+// time-based parts (a duration window, the minimum ages for convergence) run at the pace of the log.
+// Samples are timed by the receiver's UTC when it gives a full one (TIME_SET): fixes are then timed as measured
+// whatever the system clock does, which on a GPS appliance may be unset until NTP or stepped later. Between
+// fixes the clock runs on with the system's, from the offset found at the last one. Each receiver has an offset
+// of its own, kept with its average and carried by its snapshots, as only its own fixes time its own samples.
+static time_t average_clock_receiver(const time_t offset) { return time(NULL) + offset; }
+static time_t (*average_clock)(time_t offset) = average_clock_receiver;
+
+static gpsd_averaged_convergence_t get_convergence(const average_state_t *state, const average_filter_t filter, const double confidence_radius_m) {
+    if (state->is_converged[filter])
+        return GPSD_AVERAGED_CONVERGED;
     if (state->count < 30)
-        return "GATHERING";
+        return GPSD_AVERAGED_GATHERING;
     if (confidence_radius_m > 2.0)
-        return "STABILISING";
+        return GPSD_AVERAGED_STABILISING;
     if (state->pos_change_m >= 0.2)
-        return "MOVING";
+        return GPSD_AVERAGED_MOVING;
     if (state->anchored) {
         if (state->count < 100)
-            return "SAMPLING"; // Need 100 samples
+            return GPSD_AVERAGED_SAMPLING; // Need 100 samples
         if (confidence_radius_m > 0.5)
-            return "REFINING"; // Need < 0.5m
-        if ((time(NULL) - state->first_fix) < 300)
-            return "AGING"; // Need 5 minutes
+            return GPSD_AVERAGED_REFINING; // Need < 0.5m
+        if ((average_clock(state->clock_offset) - state->aging_from) < 300)
+            return GPSD_AVERAGED_AGING; // Need 5 minutes
     }
-    return "CONVERGING";
+    return GPSD_AVERAGED_CONVERGING;
 }
 
+static const char *convergence_str[] = GPSD_AVERAGED_CONVERGENCE_NAMES;
+static const char *get_convergence_str(const gpsd_averaged_convergence_t convergence) { return convergence_str[convergence]; }
+
 static double calculate_position_change_meters(const double lat1, const double lon1, const double lat2, const double lon2) {
     const double dlat = (lat2 - lat1) * 111320.0, dlon = (lon2 - lon1) * 111320.0 * cos(lat1 * M_PI / 180.0);
     return sqrt(dlat * dlat + dlon * dlon);
 }
 
-static void average_begin(average_state_t *const state, const average_filter_t filter, const bool anchored) {
+static bool average_begin(average_state_t *const state, const average_filter_t filter, const unsigned int filters, const bool anchored, const size_t window_samples,
+                          const time_t window_duration) {
     *state                             = (average_state_t){ 0 };
     state->filter                      = filter;
+    state->filters                     = filters | AVERAGE_FILTER_BIT(filter);
     state->anchored                    = anchored;
-    state->kalman_lat.error_covariance = 100.0; // Large initial uncertainty
-    state->kalman_lon.error_covariance = 100.0;
-    state->kalman_alt.error_covariance = 100.0;
+    if (!window_begin(&state->window, window_samples, window_duration, state->filters & AVERAGE_FILTER_BIT(AVERAGE_FILTER_MEDIAN))) {
+        fprintf(stderr, "Failed to allocate averaging window\n");
+        window_end(&state->window);
+        return false;
+    }
+    return true;
+}
+
+static void average_end(average_state_t *const state) { window_end(&state->window); }
+
+// Back to a cold start, as average_begin() leaves it, keeping the window's storage and the fix counters.
+static void average_reset(average_state_t *const state) {
+    const average_state_t previous = *state;
+    *state                         = (average_state_t){ .filter            = previous.filter,
+                                                        .filters           = previous.filters,
+                                                        .anchored          = previous.anchored,
+                                                        .window            = previous.window,
+                                                        .received_fixes    = previous.received_fixes,
+                                                        .rejected_fixes    = previous.rejected_fixes,
+                                                        .outliers_rejected = previous.outliers_rejected,
+                                                        .relocations       = previous.relocations,
+                                                        .relocated         = previous.relocated,
+                                                        .relocated_m       = previous.relocated_m,
+                                                        .clock_offset      = previous.clock_offset,
+                                                        .clock_dated       = previous.clock_dated };
+    window_clear(&state->window);
+}
+
+// Moves every time the average holds by delta, onto the clock the fixes that follow are timed by.
+static void average_rebase(average_state_t *const state, const time_t delta) {
+    state->first_fix += delta;
+    state->last_fix += delta;
+    if (state->aging_from != 0)
+        state->aging_from += delta;
+    if (state->relocated != 0)
+        state->relocated += delta;
+    if (state->change.fixes > 0)
+        state->change.began += delta;
+    if (state->stability.fixes > 0)
+        state->stability.second += delta;
+    window_rebase(&state->window, delta);
+}
+
+// A restored state is checked against the fixes that follow it, by the same test the anchored gate applies. A fix
+// that disagrees is rejected, as the gate would; CHECKPOINT_DISAGREE of them in a row mean the installation has
+// moved (or the checkpoint is not this one's), and the state is dropped for a cold start from this fix. After
+// CHECKPOINT_AGREE that agree, the state is trusted and the check ends, and it has aged from its own first fix.
+static bool average_verify(average_state_t *const state, const double lat, const double lon, const double alt) {
+    const double distance_m  = calculate_position_change_meters(state->latitude, state->longitude, lat, lon);
+    const double lat_error_m = sqrt(state->latitude_var) * 111320.0, lon_error_m = sqrt(state->longitude_var) * 111320.0 * cos(state->latitude * M_PI / 180.0);
+    const double distance_threshold = fmax(10.0, sqrt(lat_error_m * lat_error_m + lon_error_m * lon_error_m) * 3.0),
+                 alt_threshold      = fmax(10.0, sqrt(state->altitude_var) * 4.0);
+    if (distance_m <= distance_threshold && fabs(alt - state->altitude) <= alt_threshold) {
+        state->restored_disagree = 0;
+        if (++state->restored_agree >= CHECKPOINT_AGREE) {
+            state->restored   = false;
+            state->aging_from = state->first_fix;
+            fprintf(stderr, "checkpoint: confirmed by %u fixes\n", state->restored_agree);
+        }
+        return true;
+    }
+    if (++state->restored_disagree >= CHECKPOINT_DISAGREE) {
+        fprintf(stderr, "checkpoint: discarded, %u fixes in a row disagree (last %.1fm away)\n", state->restored_disagree, distance_m);
+        average_reset(state);
+        return true;
+    }
+    state->outliers_rejected++;
+    return false;
+}
+
+// The Kalman filter's step: the interval between fixes, averaged over the run, gives both the scaling of the
+// measurement noise for their correlation and the random walk since the last fix.
+static void average_kalman_update(average_state_t *const state, const double lat, const double lon, const double alt, const double hdop, const int satellites,
+                                  const double *const error_m, const time_t now) {
+    const double elapsed = (state->count > 0) ? (double)(now - state->first_fix) : 0.0, interval = fmax(1.0, elapsed) / (double)(state->count + 1);
+    kalman_matrix_t r;
+    kalman_noise(&r, hdop, satellites, error_m, fmax(1.0, 2.0 * KALMAN_CORRELATION_S / interval));
+    if (state->kalman.updates == 0)
+        kalman_init(&state->kalman, lat, lon, alt, &r);
+    else {
+        const double q = state->anchored ? 0.0 : KALMAN_WANDER_M2S * interval;
+        kalman_update(&state->kalman, lat, lon, alt, &r, q, q);
+    }
 }
 
-static void average_update(average_state_t *const state, const double lat, const double lon, const double alt) {
+// The centre and spread the outlier gate measures a fix against: the window's mean and standard deviation, or
+// with the median among the filters, the median and MEDIAN_MAD_SIGMA times the MAD of the raw tier, which a run
+// of multipath fixes cannot drag towards itself as it does the mean and, more so, the standard deviation.
+static void average_gate_stats(const average_state_t *const state, double *const avg_lat, double *const avg_lon, double *const avg_alt, double *const stddev_lat,
+                               double *const stddev_lon, double *const stddev_alt) {
+    if (!window_ordered(&state->window)) {
+        window_get_stats(&state->window, avg_lat, avg_lon, avg_alt, stddev_lat, stddev_lon, stddev_alt);
+        return;
+    }
+    double mad[3];
+    window_calculate_median(&state->window, avg_lat, avg_lon, avg_alt, mad);
+    *stddev_lat = MEDIAN_MAD_SIGMA * mad[1] / 111320.0;
+    *stddev_lon = MEDIAN_MAD_SIGMA * mad[0] / state->window.order.metres_lon;
+    *stddev_alt = MEDIAN_MAD_SIGMA * mad[2];
+}
+
+// Every live filter is updated from the one window and the one outlier gate, so running all of them costs only
+// their own updates on top of a single pipeline; the window is kept whichever filters run, as the gate needs it.
+// error_m is the receiver's own error estimate for the fix, east/north/up, or NULL without one.
+static bool average_update(average_state_t *const state, const double lat, const double lon, const double alt, const double hdop, const int satellites,
+                           const double *const error_m) {
+    const time_t now = average_clock(state->clock_offset);
+
+    if (state->restored && !average_verify(state, lat, lon, alt))
+        return false;
 
     if (state->window.size >= 10) {
-        double avg_lat, avg_lon, avg_alt, stddev_lat, stddev_lon, stddev_alt;
-        window_get_stats(&state->window, &avg_lat, &avg_lon, &avg_alt, &stddev_lat, &stddev_lon, &stddev_alt);
+        double avg_lat, avg_lon, avg_alt, stddev_lat, stddev_lon, stddev_alt, residual, moved_m;
+        average_gate_stats(state, &avg_lat, &avg_lon, &avg_alt, &stddev_lat, &stddev_lon, &stddev_alt);
         const double lat_diff = fabs(lat - avg_lat), lon_diff = fabs(lon - avg_lon), alt_diff = fabs(alt - avg_alt);
         if (state->anchored && state->count > 100) { // After 100 samples
             const double distance_m  = calculate_position_change_meters(avg_lat, avg_lon, lat, lon);
-            const double lat_error_m = sqrt(state->latitude_var) * 111320.0, lon_error_m = sqrt(state->longitude_var) * 111320.0 * cos(avg_lat * M_PI / 180.0);
+            const double lat_error_m = stddev_lat * 111320.0, lon_error_m = stddev_lon * 111320.0 * cos(avg_lat * M_PI / 180.0);
             const double current_confidence_m = sqrt(lat_error_m * lat_error_m + lon_error_m * lon_error_m);
-            const double distance_threshold = fmax(10.0, current_confidence_m * 3.0), alt_threshold = fmax(10.0, sqrt(state->altitude_var) * 4.0);
-            if (distance_m > distance_threshold || alt_diff > alt_threshold) {
-                state->outliers_rejected++;
-                if (verbose)
-                    printf("Reject anchored: distance=%.2fm (threshold=%.2fm), alt_diff=%.2fm (threshold=%.2fm), conf=%.2fm\n", distance_m, distance_threshold, alt_diff,
-                           alt_threshold, current_confidence_m);
-                return;
-            }
+            const double distance_threshold = fmax(10.0, current_confidence_m * 3.0), alt_threshold = fmax(10.0, stddev_alt * 4.0);
+            residual                        = fmax(distance_m / distance_threshold, alt_diff / alt_threshold);
+            if (residual > 1.0 && verbose)
+                printf("Reject anchored: distance=%.2fm (threshold=%.2fm), alt_diff=%.2fm (threshold=%.2fm), conf=%.2fm\n", distance_m, distance_threshold, alt_diff,
+                       alt_threshold, current_confidence_m);
         } else {
             const double MIN_STDDEV_POS = 0.00001, MIN_STDDEV_ALT = 0.5;
             if (stddev_lat < MIN_STDDEV_POS)
@@ -271,42 +1284,41 @@ static void average_update(average_state_t *const state, const double lat, const
                 stddev_lon = MIN_STDDEV_POS;
             if (stddev_alt < MIN_STDDEV_ALT)
                 stddev_alt = MIN_STDDEV_ALT;
-            if (lat_diff > (state->anchored ? 5.0 : 3.0) * stddev_lat || lon_diff > (state->anchored ? 5.0 : 3.0) * stddev_lon ||
-                alt_diff > (state->anchored ? 5.0 : 3.0) * stddev_alt) {
-                state->outliers_rejected++;
-                if (verbose)
-                    printf("Reject outlier: %.8f,%.8f,%.1f (%.1f/%.1f/%.1f stddevs)\n", lat, lon, alt, lat_diff / stddev_lat, lon_diff / stddev_lon, alt_diff / stddev_alt);
-                return;
-            }
+            residual = fmax(fmax(lat_diff / stddev_lat, lon_diff / stddev_lon), alt_diff / stddev_alt) / (state->anchored ? 5.0 : 3.0);
+            if (residual > 1.0 && verbose)
+                printf("Reject outlier: %.8f,%.8f,%.1f (%.1f/%.1f/%.1f stddevs)\n", lat, lon, alt, lat_diff / stddev_lat, lon_diff / stddev_lon, alt_diff / stddev_alt);
+        }
+        const double offset[3] = { (lon - avg_lon) * 111320.0 * cos(avg_lat * M_PI / 180.0), (lat - avg_lat) * 111320.0, alt - avg_alt };
+        if (change_update(&state->change, now, residual, offset, change_spread_m(avg_lat, stddev_lat, stddev_lon, stddev_alt), &moved_m)) {
+            fprintf(stderr, "relocated: %u fixes agree on a position %.1fm from the average, restarting from it\n", state->change.fixes, moved_m);
+            average_reset(state);
+            state->relocations++;
+            state->relocated   = now;
+            state->relocated_m = moved_m;
+        } else if (residual > 1.0) {
+            state->outliers_rejected++;
+            return false;
         }
     }
 
-    window_add(&state->window, lat, lon, alt);
+    window_add(&state->window, lat, lon, alt, now);
+    if (state->filters & AVERAGE_FILTER_BIT(AVERAGE_FILTER_SIMPLE))
+        cumulative_add(&state->cumulative, lat, lon, alt);
+    stability_add(&state->stability, now, lat, lon, alt);
 
-    if (state->count == 0) {
-        kalman_init(&state->kalman_lat, lat, 0.0001);
-        kalman_init(&state->kalman_lon, lon, 0.0001);
-        kalman_init(&state->kalman_alt, alt, 10.0);
-        state->kalman_lat.measure_noise = 0.00008 * 0.00008;
-        state->kalman_lon.measure_noise = 0.00008 * 0.00008;
-        state->kalman_alt.measure_noise = 100.0;
-        state->kalman_lat.process_noise = state->anchored ? 1e-12 : 0.000000001;
-        state->kalman_lon.process_noise = state->anchored ? 1e-12 : 0.000000001;
-        state->kalman_alt.process_noise = state->anchored ? 0.0001 : 0.01;
-    } else {
-        kalman_update(&state->kalman_lat, lat);
-        kalman_update(&state->kalman_lon, lon);
-        kalman_update(&state->kalman_alt, alt);
-    }
+    if (state->filters & AVERAGE_FILTER_BIT(AVERAGE_FILTER_KALMAN))
+        average_kalman_update(state, lat, lon, alt, hdop, satellites, error_m, now);
 
     state->count++;
 
     window_calculate_mean(&state->window, &state->latitude, &state->longitude, &state->altitude);
-    window_calculate_variance(&state->window, state->latitude, state->longitude, state->altitude, &state->latitude_var, &state->longitude_var, &state->altitude_var);
+    window_calculate_variance(&state->window, &state->latitude_var, &state->longitude_var, &state->altitude_var);
 
-    state->last_fix = time(NULL);
+    state->last_fix = now;
     if (state->first_fix == 0)
         state->first_fix = state->last_fix;
+    if (state->aging_from == 0)
+        state->aging_from = state->last_fix;
 
     if (state->count > 1) {
         state->pos_change_m = calculate_position_change_meters(state->last_lat, state->last_lon, state->latitude, state->longitude);
@@ -318,62 +1330,1096 @@ static void average_update(average_state_t *const state, const double lat, const
 
     if (state->count > 100) {
         const double lat_error_m = 2.0 * sqrt(state->latitude_var) * 111320.0, lon_error_m = 2.0 * sqrt(state->longitude_var) * 111320.0 * cos(state->latitude * M_PI / 180.0);
-        double confidence_radius_m = sqrt(lat_error_m * lat_error_m + lon_error_m * lon_error_m);
-        if (state->filter == AVERAGE_FILTER_KALMAN) {
-            const double kalman_error_m = sqrt(pow(sqrt(state->kalman_lat.error_covariance) * 111320.0, 2) +
-                                               pow(sqrt(state->kalman_lon.error_covariance) * 111320.0 * cos(state->latitude * M_PI / 180.0), 2));
-            confidence_radius_m         = fmin(confidence_radius_m, kalman_error_m);
-        }
-        const bool variance_converged = (confidence_radius_m < (state->anchored ? 0.5 : 1.0)), position_stable = (state->pos_change_m < (state->anchored ? 0.02 : 0.05)),
-                   time_elapsed = (time(NULL) - state->first_fix) > (state->anchored ? 300 : 120);
-        state->is_converged     = variance_converged && position_stable && time_elapsed;
+        const double confidence_radius_m = sqrt(lat_error_m * lat_error_m + lon_error_m * lon_error_m);
+        const bool position_stable = (state->pos_change_m < (state->anchored ? 0.02 : 0.05)), time_elapsed = (now - state->aging_from) > (state->anchored ? 300 : 120);
+        for (unsigned int filter = 0; filter < AVERAGE_FILTERS; filter++) {
+            if (!(state->filters & AVERAGE_FILTER_BIT(filter)))
+                continue;
+            double filter_confidence_m = confidence_radius_m;
+            if (filter == AVERAGE_FILTER_KALMAN)
+                filter_confidence_m = fmin(filter_confidence_m, kalman_confidence(&state->kalman));
+            state->is_converged[filter] = (filter_confidence_m < (state->anchored ? 0.5 : 1.0)) && position_stable && time_elapsed;
+        }
     } else
-        state->is_converged = false;
+        memset(state->is_converged, 0, sizeof(state->is_converged));
+    return true;
 }
 
-// ------------------------------------------------------------------------------------------------------------------------
-// ------------------------------------------------------------------------------------------------------------------------
-
-int gps_satellites_min = DEFAULT_SATELLITES_MIN;
-double gps_hdop_max    = DEFAULT_HDOP_MAX;
-
-static bool gps_process_fix_is_quality_acceptable(const struct gps_data_t *const gps_handle) {
-    return (gps_handle->satellites_used >= gps_satellites_min && gps_handle->dop.hdop <= gps_hdop_max);
+// The position as reported to clients: the filter's own estimate for simple (the cumulative mean), Kalman and the
+// median, or until the filter has had a fix, as after restoring a checkpoint that did not keep it, the window mean.
+static void average_get_position(const average_state_t *const state, const average_filter_t filter, double *const lat, double *const lon, double *const alt) {
+    if (filter == AVERAGE_FILTER_SIMPLE && state->cumulative.count > 0)
+        cumulative_mean(&state->cumulative, lat, lon, alt);
+    else if (filter == AVERAGE_FILTER_KALMAN && state->kalman.updates > 0)
+        kalman_position(&state->kalman, lat, lon, alt);
+    else if (filter == AVERAGE_FILTER_MEDIAN && window_ordered(&state->window) && state->window.raw_size > 0) {
+        double mad[3];
+        window_calculate_median(&state->window, lat, lon, alt, mad);
+    } else {
+        *lat = state->latitude;
+        *lon = state->longitude;
+        *alt = state->altitude;
+    }
 }
 
-// gpsd 3.20 (API v9) deprecated fix.altitude and split it into altMSL (above mean sea level, geoid) and
-// altHAE (above ellipsoid). Newer gpsd (required for the u-blox Gen9) leaves the legacy fix.altitude as
-// NaN, which then poisons the averaged altitude and is emitted as the invalid JSON token "nan".
-static double gps_fix_altitude(const struct gps_data_t *const gps_handle) {
-#if GPSD_API_MAJOR_VERSION >= 9
-    if (!isnan(gps_handle->fix.altMSL))
-        return gps_handle->fix.altMSL;
-    return gps_handle->fix.altHAE; // fall back to ellipsoid height if no geoid separation
-#else
-    return gps_handle->fix.altitude;
-#endif
-}
+// What the readers of the average need of it, copied out so that they never touch the state the serial path is
+// updating: the position as reported, its errors and convergence, the counters, and the serial path's own stats.
+// The position and convergence at the top are the default filter's; every live filter's are in outputs, with
+// the errors of its position: the window's spread, for the cumulative mean its standard error, and for the median
+// the spread as MEDIAN_MAD_SIGMA times the MAD.
+typedef struct {
+    double latitude, longitude, altitude;
+    double lat_error_m, lon_error_m, alt_error_m;
+    gpsd_averaged_convergence_t convergence;
+} average_output_t;
 
-static void gps_process_fix(const struct gps_data_t *const gps_handle, average_state_t *const state) {
-    state->received_fixes++;
-    const double latitude = gps_handle->fix.latitude, longitude = gps_handle->fix.longitude, altitude = gps_fix_altitude(gps_handle);
-    // A single non-finite altitude (e.g. a brief 2D fix right after startup, where altMSL/altHAE are
-    // NaN) would permanently poison the Kalman altitude estimate, so require all three components to be
-    // finite before averaging - otherwise treat the fix as rejected.
-    if (gps_process_fix_is_quality_acceptable(gps_handle) && isfinite(latitude) && isfinite(longitude) && isfinite(altitude)) {
-        average_update(state, latitude, longitude, altitude);
-        if (verbose)
-            printf("Fix %lu: %.8f,%.8f,%.1f sats=%d hdop=%.1f\n", state->count, latitude, longitude, altitude, gps_handle->satellites_used, gps_handle->dop.hdop);
-    } else {
-        state->rejected_fixes++;
-        if (verbose)
-            printf("Fix rejected: sats=%d hdop=%.1f alt=%.1f\n", gps_handle->satellites_used, gps_handle->dop.hdop, altitude);
+typedef struct {
+    unsigned long version; // advances with every snapshot published
+    long long read_ns;     // when the serial data it follows from was found, for timing its delivery
+    const char *device;    // the receiver's, or NULL for the average of them all, or of the only one
+    double latitude, longitude, altitude;
+    double latitude_var, longitude_var, altitude_var;
+    double lat_error_m, lon_error_m, confidence_m;
+    double kalman_east_var, kalman_north_var, kalman_up_var; // square metres
+    double pos_change_m, alt_change_m;
+    unsigned long count, received_fixes, rejected_fixes, outliers_rejected;
+    unsigned long relocations;
+    time_t relocated;
+    double relocated_m;
+    size_t window;
+    time_t first_fix, last_fix;
+    time_t clock_offset;
+    average_filter_t filter;
+    unsigned int filters;
+    bool anchored;
+    gpsd_averaged_convergence_t convergence;
+    average_output_t outputs[AVERAGE_FILTERS];
+    stability_sums_t stability;
+} average_snapshot_t;
+
+static void average_snapshot(const average_state_t *const state, average_snapshot_t *const snapshot) {
+    average_get_position(state, state->filter, &snapshot->latitude, &snapshot->longitude, &snapshot->altitude);
+    snapshot->latitude_var      = state->latitude_var;
+    snapshot->longitude_var     = state->longitude_var;
+    snapshot->altitude_var      = state->altitude_var;
+    snapshot->lat_error_m       = sqrt(state->latitude_var) * 111320.0;
+    snapshot->lon_error_m       = sqrt(state->longitude_var) * 111320.0 * cos(snapshot->latitude * M_PI / 180.0);
+    snapshot->confidence_m      = 2.0 * sqrt(snapshot->lat_error_m * snapshot->lat_error_m + snapshot->lon_error_m * snapshot->lon_error_m);
+    snapshot->kalman_east_var   = state->kalman.p.m[0][0];
+    snapshot->kalman_north_var  = state->kalman.p.m[1][1];
+    snapshot->kalman_up_var     = state->kalman.p.m[2][2];
+    snapshot->pos_change_m      = state->pos_change_m;
+    snapshot->alt_change_m      = state->alt_change_m;
+    snapshot->count             = state->count;
+    snapshot->received_fixes    = state->received_fixes;
+    snapshot->rejected_fixes    = state->rejected_fixes;
+    snapshot->outliers_rejected = state->outliers_rejected;
+    snapshot->relocations       = state->relocations;
+    snapshot->relocated         = state->relocated;
+    snapshot->relocated_m       = state->relocated_m;
+    snapshot->window            = state->window.size;
+    snapshot->first_fix         = state->first_fix;
+    snapshot->last_fix          = state->last_fix;
+    snapshot->clock_offset      = state->clock_offset;
+    snapshot->filter            = state->filter;
+    snapshot->filters           = state->filters;
+    snapshot->anchored          = state->anchored;
+    snapshot->convergence       = get_convergence(state, state->filter, snapshot->confidence_m);
+    snapshot->stability         = state->stability.sums;
+    for (unsigned int filter = 0; filter < AVERAGE_FILTERS; filter++)
+        if (state->filters & AVERAGE_FILTER_BIT(filter)) {
+            average_output_t *const output = &snapshot->outputs[filter];
+            average_get_position(state, (average_filter_t)filter, &output->latitude, &output->longitude, &output->altitude);
+            output->lat_error_m = snapshot->lat_error_m;
+            output->lon_error_m = snapshot->lon_error_m;
+            output->alt_error_m = sqrt(state->altitude_var);
+            output->convergence = get_convergence(state, (average_filter_t)filter, snapshot->confidence_m);
+        }
+    double error[3];
+    if ((state->filters & AVERAGE_FILTER_BIT(AVERAGE_FILTER_SIMPLE)) && cumulative_error(&state->cumulative, error)) {
+        average_output_t *const output = &snapshot->outputs[AVERAGE_FILTER_SIMPLE];
+        output->lon_error_m            = error[0];
+        output->lat_error_m            = error[1];
+        output->alt_error_m            = error[2];
+    }
+    if ((state->filters & AVERAGE_FILTER_BIT(AVERAGE_FILTER_MEDIAN)) && window_ordered(&state->window) && state->window.raw_size > 0) {
+        average_output_t *const output = &snapshot->outputs[AVERAGE_FILTER_MEDIAN];
+        window_calculate_median(&state->window, &output->latitude, &output->longitude, &output->altitude, error);
+        output->lon_error_m = MEDIAN_MAD_SIGMA * error[0];
+        output->lat_error_m = MEDIAN_MAD_SIGMA * error[1];
+        output->alt_error_m = MEDIAN_MAD_SIGMA * error[2];
     }
 }
 
-static bool gps_connect(struct gps_data_t *const gps_handle, const char *const gpsd_host, const char *const gpsd_port, const int satellites_min, const double hdop_max) {
+// The fused average of several receivers, from each one's snapshot: every filter's position weighted per axis by
+// the inverse of the variance of each receiver's; the counters are summed, and the convergence is the least any
+// receiver contributing to it has reached, in the order the states are tested, so that one receiver converged does
+// not vouch for a position the others are still pulling about. Each receiver has already been through its own
+// outlier gate. The fused error, and the window's spread and the Kalman variances, are those of the best receiver
+// on each axis and not of the weighted mean: receivers sharing a mast share its atmosphere and multipath, so their
+// errors are far from independent, and the weighted mean's would claim an improvement of up to the square root of
+// their number from no new information.
+#define FUSE_ERROR_MIN_M 0.01 // Floor on an error, so that a receiver claiming none cannot take all the weight
+
+static double fuse_weight(const double error_m) { return 1.0 / (fmax(error_m, FUSE_ERROR_MIN_M) * fmax(error_m, FUSE_ERROR_MIN_M)); }
+
+static double fuse_variance(const double best_inverse) { return (best_inverse > 0) ? 1.0 / best_inverse : 0.0; }
+
+static void average_fuse(const average_snapshot_t *const devices, const unsigned int count, average_snapshot_t *const fused) {
+    const unsigned long version = fused->version;
+    *fused                      = (average_snapshot_t){ .version = version, .filter = devices[0].filter, .filters = devices[0].filters, .anchored = devices[0].anchored };
+    double sum[AVERAGE_FILTERS][3][3] = { { { 0 } } }, spread[3] = { 0 }, kalman[3] = { 0 }; // sums of weighted positions and weights, and the largest weights
+    for (unsigned int i = 0; i < count; i++) {
+        const average_snapshot_t *const device = &devices[i];
+        fused->received_fixes += device->received_fixes;
+        fused->rejected_fixes += device->rejected_fixes;
+        fused->relocations += device->relocations;
+        if (device->relocated > fused->relocated) {
+            fused->relocated   = device->relocated;
+            fused->relocated_m = device->relocated_m;
+        }
+        if (device->count == 0)
+            continue;
+        const bool first = (fused->count == 0);
+        fused->count += device->count;
+        fused->outliers_rejected += device->outliers_rejected;
+        fused->window += device->window;
+        fused->first_fix    = (fused->first_fix == 0 || device->first_fix < fused->first_fix) ? device->first_fix : fused->first_fix;
+        fused->read_ns      = (device->read_ns > fused->read_ns) ? device->read_ns : fused->read_ns;
+        fused->pos_change_m = fmax(fused->pos_change_m, device->pos_change_m);
+        fused->alt_change_m = fmax(fused->alt_change_m, device->alt_change_m);
+        fused->convergence  = (first || device->convergence < fused->convergence) ? device->convergence : fused->convergence;
+        if (device->last_fix > fused->last_fix) { // and its age is by that receiver's clock
+            fused->last_fix     = device->last_fix;
+            fused->clock_offset = device->clock_offset;
+        }
+        for (unsigned int filter = 0; filter < AVERAGE_FILTERS; filter++)
+            if (fused->filters & AVERAGE_FILTER_BIT(filter)) {
+                const average_output_t *const output = &device->outputs[filter];
+                const double position[3] = { output->latitude, output->longitude, output->altitude },
+                             weight[3]   = { fuse_weight(output->lat_error_m), fuse_weight(output->lon_error_m), fuse_weight(output->alt_error_m) };
+                for (unsigned int axis = 0; axis < 3; axis++) {
+                    sum[filter][axis][0] += weight[axis] * position[axis];
+                    sum[filter][axis][1] += weight[axis];
+                    sum[filter][axis][2]  = fmax(sum[filter][axis][2], weight[axis]);
+                }
+                if (first || output->convergence < fused->outputs[filter].convergence)
+                    fused->outputs[filter].convergence = output->convergence;
+            }
+        const double metres_lon = 111320.0 * cos(device->latitude * M_PI / 180.0);
+        spread[0] = fmax(spread[0], fuse_weight(sqrt(device->latitude_var) * 111320.0));
+        spread[1] = fmax(spread[1], fuse_weight(sqrt(device->longitude_var) * metres_lon));
+        spread[2] = fmax(spread[2], fuse_weight(sqrt(device->altitude_var)));
+        kalman[0] = fmax(kalman[0], fuse_weight(sqrt(device->kalman_east_var)));
+        kalman[1] = fmax(kalman[1], fuse_weight(sqrt(device->kalman_north_var)));
+        kalman[2] = fmax(kalman[2], fuse_weight(sqrt(device->kalman_up_var)));
+    }
+    if (fused->count == 0)
+        return;
+    for (unsigned int filter = 0; filter < AVERAGE_FILTERS; filter++)
+        if (fused->filters & AVERAGE_FILTER_BIT(filter)) {
+            average_output_t *const output = &fused->outputs[filter];
+            output->latitude               = sum[filter][0][0] / sum[filter][0][1];
+            output->longitude              = sum[filter][1][0] / sum[filter][1][1];
+            output->altitude               = sum[filter][2][0] / sum[filter][2][1];
+            output->lat_error_m            = sqrt(fuse_variance(sum[filter][0][2]));
+            output->lon_error_m            = sqrt(fuse_variance(sum[filter][1][2]));
+            output->alt_error_m            = sqrt(fuse_variance(sum[filter][2][2]));
+        }
+    const average_output_t *const output = &fused->outputs[fused->filter];
+    const double metres_lon              = 111320.0 * cos(output->latitude * M_PI / 180.0);
+    fused->latitude                      = output->latitude;
+    fused->longitude                     = output->longitude;
+    fused->altitude                      = output->altitude;
+    fused->lat_error_m                   = sqrt(fuse_variance(spread[0]));
+    fused->lon_error_m                   = sqrt(fuse_variance(spread[1]));
+    fused->latitude_var                  = fused->lat_error_m * fused->lat_error_m / (111320.0 * 111320.0);
+    fused->longitude_var                 = fused->lon_error_m * fused->lon_error_m / (metres_lon * metres_lon);
+    fused->altitude_var                  = fuse_variance(spread[2]);
+    fused->confidence_m                  = 2.0 * sqrt(fused->lat_error_m * fused->lat_error_m + fused->lon_error_m * fused->lon_error_m);
+    fused->kalman_east_var               = fuse_variance(kalman[0]);
+    fused->kalman_north_var              = fuse_variance(kalman[1]);
+    fused->kalman_up_var                 = fuse_variance(kalman[2]);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+// --checkpoint PATH carries the averaged state of an anchored installation across restarts, which would otherwise
+// start over in GATHERING each time. The file is a header (magic, version, payload length, CRC-32 of the payload)
+// and a payload of the state followed by the window's buckets and raw samples, oldest first. It is in host byte
+// order, as only the machine that wrote it reads it back, and is replaced atomically: written aside, synced, and
+// renamed over the old one. A checkpoint for a different window configuration is not restored.
+//
+// The serial thread only copies the state into a buffer allocated at startup, every CHECKPOINT_INTERVAL, and then
+// only if the previous copy has been written; the status thread does the checksum and the file I/O. The last is
+// taken at exit, once the threads have stopped.
+
+#define CHECKPOINT_MAGIC 0x4b435047 // "GPCK", little-endian
+#define CHECKPOINT_VERSION 3
+
+typedef struct {
+    uint32_t magic, version, length, checksum;
+} checkpoint_header_t;
+
+typedef struct {
+    int64_t saved, first_fix, last_fix;
+    uint64_t count, received_fixes, rejected_fixes, outliers_rejected;
+    double latitude, longitude, altitude;
+    double latitude_var, longitude_var, altitude_var;
+    kalman_state_t kalman;
+    cumulative_t cumulative;
+    double last_lat, last_lon, last_alt, pos_change_m, alt_change_m;
+    int64_t duration;
+    uint64_t raw_capacity, raw_size, bucket_capacity, bucket_size;
+    double origin_lat, origin_lon, origin_alt;
+} checkpoint_state_t;
+
+#define CHECKPOINT_RAW_SZ (3 * sizeof(float) + sizeof(time_t))
+
+typedef struct {
+    const char *path;
+    unsigned char *buffer;
+    size_t capacity, length;
+    time_t last;
+    int pending; // set by the serial thread once the buffer holds a checkpoint, cleared by the status thread once written
+} checkpoint_t;
+
+static uint32_t checkpoint_crc32(const unsigned char *const data, const size_t length) {
+    static uint32_t table[256];
+    if (table[1] == 0)
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    uint32_t crc = 0xFFFFFFFFU;
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFU;
+}
+
+static bool checkpoint_begin(checkpoint_t *const cp, const char *const path, const sliding_window_t *const w) {
+    *cp = (checkpoint_t){ .path = path, .last = time(NULL) };
+    if (path == NULL)
+        return true;
+    cp->capacity = sizeof(checkpoint_state_t) + w->bucket_capacity * sizeof(window_bucket_t) + w->raw_capacity * CHECKPOINT_RAW_SZ;
+    if ((cp->buffer = malloc(cp->capacity)) == NULL) {
+        perror("malloc");
+        return false;
+    }
+    (void)checkpoint_crc32(NULL, 0); // builds the table here, rather than in the first writer
+    return true;
+}
+
+static void checkpoint_end(checkpoint_t *const cp) {
+    free(cp->buffer);
+    cp->buffer = NULL;
+}
+
+static void checkpoint_put(checkpoint_t *const cp, const void *const data, const size_t length) {
+    memcpy(cp->buffer + cp->length, data, length);
+    cp->length += length;
+}
+
+// A ring's contents, oldest first, as its two contiguous spans.
+static void checkpoint_put_ring(checkpoint_t *const cp, const void *const ring, const size_t element, const size_t capacity, const size_t tail, const size_t size) {
+    const size_t first = (size < capacity - tail) ? size : capacity - tail;
+    checkpoint_put(cp, (const unsigned char *)ring + tail * element, first * element);
+    checkpoint_put(cp, ring, (size - first) * element);
+}
+
+static bool checkpoint_save(checkpoint_t *const cp, const average_state_t *const state) {
+    if (state->count == 0 || state->restored)
+        return false; // nothing yet, or a restored state that is not yet confirmed, and that the last checkpoint already holds
+    const sliding_window_t *const w = &state->window;
+    const checkpoint_state_t saved  = {
+         .saved             = (int64_t)time(NULL),
+         .first_fix         = (int64_t)state->first_fix,
+         .last_fix          = (int64_t)state->last_fix,
+         .count             = state->count,
+         .received_fixes    = state->received_fixes,
+         .rejected_fixes    = state->rejected_fixes,
+         .outliers_rejected = state->outliers_rejected,
+         .latitude          = state->latitude,
+         .longitude         = state->longitude,
+         .altitude          = state->altitude,
+         .latitude_var      = state->latitude_var,
+         .longitude_var     = state->longitude_var,
+         .altitude_var      = state->altitude_var,
+         .kalman            = state->kalman,
+         .cumulative        = state->cumulative,
+         .last_lat          = state->last_lat,
+         .last_lon          = state->last_lon,
+         .last_alt          = state->last_alt,
+         .pos_change_m      = state->pos_change_m,
+         .alt_change_m      = state->alt_change_m,
+         .duration          = (int64_t)w->duration,
+         .raw_capacity      = w->raw_capacity,
+         .raw_size          = w->raw_size,
+         .bucket_capacity   = w->bucket_capacity,
+         .bucket_size       = w->bucket_size,
+         .origin_lat        = w->origin_lat,
+         .origin_lon        = w->origin_lon,
+         .origin_alt        = w->origin_alt,
+    };
+    cp->length = 0;
+    checkpoint_put(cp, &saved, sizeof(saved));
+    if (w->bucket_size > 0)
+        checkpoint_put_ring(cp, w->buckets, sizeof(window_bucket_t), w->bucket_capacity, w->bucket_tail, w->bucket_size);
+    checkpoint_put_ring(cp, w->lat, sizeof(float), w->raw_capacity, w->raw_tail, w->raw_size);
+    checkpoint_put_ring(cp, w->lon, sizeof(float), w->raw_capacity, w->raw_tail, w->raw_size);
+    checkpoint_put_ring(cp, w->alt, sizeof(float), w->raw_capacity, w->raw_tail, w->raw_size);
+    checkpoint_put_ring(cp, w->timestamp, sizeof(time_t), w->raw_capacity, w->raw_tail, w->raw_size);
+    return true;
+}
+
+// A rename is only durable once the directory holding it is synced, without which a crash can leave the old file.
+static bool checkpoint_sync_directory(const char *const path) {
+    char directory[PATH_MAX];
+    const char *const slash = strrchr(path, '/');
+    if (slash == NULL)
+        snprintf(directory, sizeof(directory), ".");
+    else
+        snprintf(directory, sizeof(directory), "%.*s", (slash == path) ? 1 : (int)(slash - path), path);
+    const int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("checkpoint: open directory");
+        return false;
+    }
+    const bool synced = fsync(fd) == 0;
+    if (!synced)
+        perror("checkpoint: fsync directory");
+    close(fd);
+    return synced;
+}
+
+static bool checkpoint_write(const checkpoint_t *const cp) {
+    const checkpoint_header_t header = {
+        .magic = CHECKPOINT_MAGIC, .version = CHECKPOINT_VERSION, .length = (uint32_t)cp->length, .checksum = checkpoint_crc32(cp->buffer, cp->length)
+    };
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s.tmp", cp->path) >= (int)sizeof(path)) {
+        fprintf(stderr, "checkpoint: path too long: %s\n", cp->path);
+        return false;
+    }
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("checkpoint: open");
+        return false;
+    }
+    const struct iovec iov[2] = { { .iov_base = (void *)(uintptr_t)&header, .iov_len = sizeof(header) }, { .iov_base = cp->buffer, .iov_len = cp->length } };
+    const bool written        = writev(fd, iov, 2) == (ssize_t)(sizeof(header) + cp->length) && fsync(fd) == 0;
+    if (!written)
+        perror("checkpoint: write");
+    close(fd);
+    if (!written || rename(path, cp->path) < 0) {
+        if (written)
+            perror("checkpoint: rename");
+        unlink(path);
+        return false;
+    }
+    return checkpoint_sync_directory(cp->path);
+}
+
+static bool checkpoint_read(const char *const path, checkpoint_header_t *const header, unsigned char **const payload, const size_t limit) {
+    FILE *const file = fopen(path, "rb");
+    if (file == NULL) {
+        if (errno != ENOENT)
+            perror("checkpoint: open");
+        return false;
+    }
+    bool read = false;
+    if (fread(header, sizeof(*header), 1, file) != 1 || header->magic != CHECKPOINT_MAGIC)
+        fprintf(stderr, "checkpoint: %s is not a checkpoint, ignored\n", path);
+    else if (header->version != CHECKPOINT_VERSION)
+        fprintf(stderr, "checkpoint: %s is version %u, not %u, ignored\n", path, header->version, CHECKPOINT_VERSION);
+    else if (header->length < sizeof(checkpoint_state_t) || header->length > limit)
+        fprintf(stderr, "checkpoint: %s has an unexpected length, ignored\n", path);
+    else if ((*payload = malloc(header->length)) == NULL)
+        perror("malloc");
+    else if (fread(*payload, header->length, 1, file) != 1 || checkpoint_crc32(*payload, header->length) != header->checksum)
+        fprintf(stderr, "checkpoint: %s is truncated or corrupt, ignored\n", path);
+    else
+        read = true;
+    fclose(file);
+    return read;
+}
+
+// The restored state is on probation (see average_verify) until the fixes that follow confirm it.
+static bool checkpoint_load(const checkpoint_t *const cp, average_state_t *const state) {
+    checkpoint_header_t header;
+    unsigned char *payload = NULL;
+    if (cp->path == NULL || !checkpoint_read(cp->path, &header, &payload, cp->capacity)) {
+        free(payload);
+        return false;
+    }
+    checkpoint_state_t saved;
+    memcpy(&saved, payload, sizeof(saved));
+    sliding_window_t *const w = &state->window;
+    if (saved.duration != (int64_t)w->duration || saved.raw_capacity != w->raw_capacity || saved.bucket_capacity != w->bucket_capacity ||
+        saved.raw_size > saved.raw_capacity || saved.bucket_size > saved.bucket_capacity || saved.count == 0 ||
+        header.length != sizeof(saved) + saved.bucket_size * sizeof(window_bucket_t) + saved.raw_size * CHECKPOINT_RAW_SZ) {
+        fprintf(stderr, "checkpoint: %s is for a different window, ignored\n", cp->path);
+        free(payload);
+        return false;
+    }
+
+    const unsigned char *data = payload + sizeof(saved);
+    window_clear(w);
+    w->origin_lat  = saved.origin_lat;
+    w->origin_lon  = saved.origin_lon;
+    w->origin_alt  = saved.origin_alt;
+    w->bucket_size = saved.bucket_size;
+    w->raw_size    = saved.raw_size;
+    if (w->bucket_size > 0) {
+        memcpy(w->buckets, data, w->bucket_size * sizeof(window_bucket_t));
+        data += w->bucket_size * sizeof(window_bucket_t);
+    }
+    memcpy(w->lat, data, w->raw_size * sizeof(float));
+    data += w->raw_size * sizeof(float);
+    memcpy(w->lon, data, w->raw_size * sizeof(float));
+    data += w->raw_size * sizeof(float);
+    memcpy(w->alt, data, w->raw_size * sizeof(float));
+    data += w->raw_size * sizeof(float);
+    memcpy(w->timestamp, data, w->raw_size * sizeof(time_t));
+    w->size = w->raw_size;
+    for (size_t i = 0; i < w->bucket_size; i++)
+        w->size += w->buckets[i].count;
+    window_recompute(w);
+    if (window_ordered(w))
+        window_order_rebuild(w, saved.latitude, saved.longitude, saved.altitude); // not saved, as they follow from the raw tier
+    free(payload);
+
+    state->first_fix         = (time_t)saved.first_fix;
+    state->last_fix          = (time_t)saved.last_fix;
+    state->count             = saved.count;
+    state->received_fixes    = saved.received_fixes;
+    state->rejected_fixes    = saved.rejected_fixes;
+    state->outliers_rejected = saved.outliers_rejected;
+    state->latitude          = saved.latitude;
+    state->longitude         = saved.longitude;
+    state->altitude          = saved.altitude;
+    state->latitude_var      = saved.latitude_var;
+    state->longitude_var     = saved.longitude_var;
+    state->altitude_var      = saved.altitude_var;
+    state->kalman            = saved.kalman;
+    state->cumulative        = saved.cumulative;
+    state->last_lat          = saved.last_lat;
+    state->last_lon          = saved.last_lon;
+    state->last_alt          = saved.last_alt;
+    state->pos_change_m      = saved.pos_change_m;
+    state->alt_change_m      = saved.alt_change_m;
+    state->restored          = true;
+    state->clock_dated       = true;
+    fprintf(stderr, "checkpoint: restored %lu samples (window %zu) from %lds ago, at %.8f,%.8f,%.1f\n", state->count, w->size, (long)(time(NULL) - (time_t)saved.saved),
+            state->latitude, state->longitude, state->altitude);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+// --journal DIR appends every fix accepted into the average, and with --journal-rejected every one rejected, to
+// segment files of fixed-size records (gpsd_averaged_journal.h), for audits and re-surveys of what the window
+// has long since let go. The serial thread only ever stores into a segment already mapped, with no syscall: each
+// segment is created, preallocated and mapped ahead of need by the status thread, which also retires the full
+// ones and syncs what has been written, in a batch every JOURNAL_SYNC_INTERVAL. The hand-offs between the two are
+// a flag each way, so neither waits for the other; a record that finds no segment ready to take it, as only if the
+// status thread has fallen a whole segment behind, is counted as dropped.
+
+#define JOURNAL_SYNC_INTERVAL 10      // Seconds between syncs of the records written to disk
+#define JOURNAL_OFFSET_MAX_M 10000.0  // Offset from a segment's origin within which a float keeps a millimetre
+
+typedef struct {
+    gpsd_averaged_journal_t *header; // NULL when there is none
+    gpsd_averaged_journal_record_t *records;
+    int fd;
+    char path[PATH_MAX];
+} journal_segment_t;
+
+typedef struct {
+    const char *directory; // NULL when not journalling
+    bool rejected;
+    unsigned int device;
+    const char *device_path;
+    journal_segment_t current, next, retired;
+    int next_ready, retired_pending; // next is made ready by the status thread and taken by the serial thread, retired the reverse
+    gpsd_averaged_journal_t *syncing; // the current segment, for the status thread to sync
+    time_t last_sync;
+    int64_t last_time; // of the last record, milliseconds
+    unsigned long written, dropped;
+} journal_t;
+
+// Named by the time it was made, which sorts the segments in order; a name already taken is moved on a millisecond.
+static bool journal_segment_create(const journal_t *const journal, journal_segment_t *const segment) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    const long long created = (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    segment->fd             = -1;
+    for (int attempt = 0; attempt < 1000 && segment->fd < 0; attempt++) {
+        snprintf(segment->path, sizeof(segment->path), "%s/gpsd_averaged-%u-%013lld.journal", journal->directory, journal->device, created + attempt);
+        if ((segment->fd = open(segment->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0 && errno != EEXIST) {
+            perror("journal: open");
+            return false;
+        }
+    }
+    if (segment->fd < 0) {
+        fprintf(stderr, "journal: no free segment name in %s\n", journal->directory);
+        return false;
+    }
+    // Preallocated, so that a full disk fails here rather than as a SIGBUS on a store into the mapping.
+    void *map       = MAP_FAILED;
+    const int error = posix_fallocate(segment->fd, 0, (off_t)GPSD_AVERAGED_JOURNAL_SIZE);
+    if (error != 0)
+        fprintf(stderr, "journal: posix_fallocate: %s\n", strerror(error));
+    else if ((map = mmap(NULL, GPSD_AVERAGED_JOURNAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, segment->fd, 0)) == MAP_FAILED)
+        perror("journal: mmap");
+    if (map == MAP_FAILED) {
+        close(segment->fd);
+        unlink(segment->path);
+        return false;
+    }
+    gpsd_averaged_journal_t *const header = (gpsd_averaged_journal_t *)map;
+    memset(header, 0, sizeof(*header));
+    header->version     = GPSD_AVERAGED_JOURNAL_VERSION;
+    header->header_size = GPSD_AVERAGED_JOURNAL_HEADER_SIZE;
+    header->record_size = sizeof(gpsd_averaged_journal_record_t);
+    header->capacity    = GPSD_AVERAGED_JOURNAL_CAPACITY;
+    header->device      = journal->device;
+    snprintf(header->device_path, sizeof(header->device_path), "%s", journal->device_path);
+    __atomic_store_n(&header->magic, GPSD_AVERAGED_JOURNAL_MAGIC, __ATOMIC_RELEASE);
+    segment->header  = header;
+    segment->records = (gpsd_averaged_journal_record_t *)(void *)((char *)map + GPSD_AVERAGED_JOURNAL_HEADER_SIZE);
+    return true;
+}
+
+// Synced, and cut down to its records; one with none is removed.
+static void journal_segment_close(journal_segment_t *const segment) {
+    if (segment->header == NULL)
+        return;
+    const uint32_t count = __atomic_load_n(&segment->header->count, __ATOMIC_ACQUIRE);
+    if (msync(segment->header, GPSD_AVERAGED_JOURNAL_SIZE, MS_SYNC) < 0)
+        perror("journal: msync");
+    munmap(segment->header, GPSD_AVERAGED_JOURNAL_SIZE);
+    segment->header = NULL;
+    if (count == 0)
+        unlink(segment->path);
+    else if (ftruncate(segment->fd, (off_t)(GPSD_AVERAGED_JOURNAL_HEADER_SIZE + (size_t)count * sizeof(gpsd_averaged_journal_record_t))) < 0)
+        perror("journal: ftruncate");
+    close(segment->fd);
+}
+
+static bool journal_begin(journal_t *const journal, const char *const directory, const bool rejected, const unsigned int device, const char *const device_path) {
+    *journal = (journal_t){ .directory = directory, .rejected = rejected, .device = device, .device_path = device_path, .last_sync = time(NULL) };
+    if (directory == NULL)
+        return true;
+    if (!journal_segment_create(journal, &journal->current))
+        return false;
+    if (!journal_segment_create(journal, &journal->next)) {
+        journal_segment_close(&journal->current);
+        return false;
+    }
+    journal->next_ready = 1;
+    journal->syncing    = journal->current.header;
+    return true;
+}
+
+static void journal_end(journal_t *const journal) {
+    journal_segment_close(&journal->current);
+    journal_segment_close(&journal->next);
+    journal_segment_close(&journal->retired);
+}
+
+// The serial thread's side of the hand-off: the current segment for the status thread to retire, and the next
+// in its place; false if either hand-off is still waiting on the status thread. The segment to sync moves on
+// before the old one is handed back, so that the status thread, which loads it only after retiring what it has
+// been handed, can never sync a segment it has already unmapped.
+static bool journal_rotate(journal_t *const journal) {
+    if (!__atomic_load_n(&journal->next_ready, __ATOMIC_ACQUIRE) || __atomic_load_n(&journal->retired_pending, __ATOMIC_ACQUIRE))
+        return false;
+    journal->retired = journal->current;
+    journal->current = journal->next;
+    __atomic_store_n(&journal->syncing, journal->current.header, __ATOMIC_RELEASE);
+    __atomic_store_n(&journal->next_ready, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&journal->retired_pending, 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// A new segment is begun when this one is full, when the time goes backwards, as it must not within one, or
+// would overflow a record's, or when the position is too far from the origin for a float to hold to a millimetre.
+static void journal_append(journal_t *const journal, const int64_t time_ms, const double lat, const double lon, const double alt, const double hdop, const int satellites,
+                           const uint8_t flags) {
+    gpsd_averaged_journal_t *header = journal->current.header;
+    if (header == NULL) {
+        journal->dropped++;
+        return;
+    }
+    uint32_t count = header->count;
+    double east = 0.0, north = 0.0, up = 0.0;
+    if (count > 0) {
+        east  = (lon - header->origin_lon) * 111320.0 * cos(header->origin_lat * M_PI / 180.0);
+        north = (lat - header->origin_lat) * 111320.0;
+        up    = alt - header->origin_alt;
+        if (count == header->capacity || time_ms < journal->last_time || time_ms - header->start > UINT32_MAX || fabs(east) > JOURNAL_OFFSET_MAX_M ||
+            fabs(north) > JOURNAL_OFFSET_MAX_M || fabs(up) > JOURNAL_OFFSET_MAX_M) {
+            if (!journal_rotate(journal)) {
+                journal->dropped++;
+                return;
+            }
+            header = journal->current.header;
+            count  = 0;
+            east = north = up = 0.0;
+        }
+    }
+    if (count == 0) {
+        header->start      = time_ms;
+        header->origin_lat = lat;
+        header->origin_lon = lon;
+        header->origin_alt = alt;
+    }
+    const uint32_t time                          = (uint32_t)(time_ms - header->start);
+    gpsd_averaged_journal_record_t *const record = &journal->current.records[count];
+    record->time                                 = time;
+    record->east                                 = (float)east;
+    record->north                                = (float)north;
+    record->up                                   = (float)up;
+    record->hdop                                 = (uint16_t)fmin(fmax(hdop * 100.0, 0.0), UINT16_MAX);
+    record->satellites                           = (uint8_t)((satellites < 0) ? 0 : (satellites > UINT8_MAX) ? UINT8_MAX : satellites);
+    record->flags                                = flags;
+    if (count % GPSD_AVERAGED_JOURNAL_STRIDE == 0)
+        header->index[count / GPSD_AVERAGED_JOURNAL_STRIDE] = time;
+    __atomic_store_n(&header->count, count + 1, __ATOMIC_RELEASE);
+    journal->last_time = time_ms;
+    journal->written++;
+}
+
+// The status thread's side: retires the segment handed back, readies the next, and syncs the current one.
+static void journal_service(journal_t *const journal) {
+    if (journal->directory == NULL)
+        return;
+    if (__atomic_load_n(&journal->retired_pending, __ATOMIC_ACQUIRE)) {
+        journal_segment_close(&journal->retired);
+        __atomic_store_n(&journal->retired_pending, 0, __ATOMIC_RELEASE);
+    }
+    if (!__atomic_load_n(&journal->next_ready, __ATOMIC_ACQUIRE) && journal_segment_create(journal, &journal->next))
+        __atomic_store_n(&journal->next_ready, 1, __ATOMIC_RELEASE);
+    gpsd_averaged_journal_t *const syncing = __atomic_load_n(&journal->syncing, __ATOMIC_ACQUIRE);
+    if (interval_passed(&journal->last_sync, JOURNAL_SYNC_INTERVAL) && syncing != NULL &&
+        msync(syncing, GPSD_AVERAGED_JOURNAL_HEADER_SIZE + (size_t)__atomic_load_n(&syncing->count, __ATOMIC_ACQUIRE) * sizeof(gpsd_averaged_journal_record_t),
+              MS_SYNC) < 0)
+        perror("journal: msync");
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+// ?HISTORY answers for past periods from summaries of the fixes accepted into the average: for every second,
+// minute and hour, their count and, per axis, the sum, sum of squares, minimum and maximum of their offsets in
+// metres from the first fix, from which the mean and spread of any period follow by merging the blocks that
+// cover it. The serial thread adds each fix to the blocks for its second, minute and hour, in three rings that
+// hold the last HISTORY_SECONDS, HISTORY_MINUTES and HISTORY_HOURS of them, so a day is answered from 24 hourly
+// blocks and a couple of hundred finer ones at its ends rather than from its samples. Each block has a seqlock of
+// its own, as the snapshots do, so the server reads them while the serial thread writes and neither waits. A time
+// older than a ring holds is answered from the next coarser, whose block may take in fixes from beyond the period.
+
+#define HISTORY_TIERS 3
+#define HISTORY_SECONDS 7200 // Per-second blocks held, two hours
+#define HISTORY_MINUTES 2880 // Per-minute, two days
+#define HISTORY_HOURS 8784   // Per-hour, a year
+
+typedef struct {
+    double sum, sum_squares, min, max;
+} history_axis_t;
+
+typedef struct {
+    uint32_t sequence; // seqlock, odd while the block is being written
+    uint32_t count;
+    int64_t time;           // start, seconds since the epoch; the slot holds no other time's fixes
+    history_axis_t axes[3]; // east, north, up
+} history_block_t;
+
+typedef struct {
+    unsigned long count;
+    history_axis_t axes[3];
+    double origin_lat, origin_lon, origin_alt, metres_lon;
+} history_summary_t;
+
+typedef struct {
+    history_block_t *blocks[HISTORY_TIERS]; // NULL when not kept, as in replay
+    int64_t head[HISTORY_TIERS];            // start of the newest block written in each
+    double origin_lat, origin_lon, origin_alt, metres_lon;
+    int ready; // once the origin is set, by the first fix
+} history_t;
+
+static const int64_t history_span[HISTORY_TIERS] = { 1, 60, 3600 };
+static const size_t history_size[HISTORY_TIERS]  = { HISTORY_SECONDS, HISTORY_MINUTES, HISTORY_HOURS };
+
+static void history_end(history_t *const history) {
+    for (unsigned int tier = 0; tier < HISTORY_TIERS; tier++) {
+        free(history->blocks[tier]);
+        history->blocks[tier] = NULL;
+    }
+}
+
+static bool history_begin(history_t *const history) {
+    *history = (history_t){ 0 };
+    for (unsigned int tier = 0; tier < HISTORY_TIERS; tier++)
+        if ((history->blocks[tier] = calloc(history_size[tier], sizeof(history_block_t))) == NULL) {
+            perror("calloc");
+            history_end(history);
+            return false;
+        }
+    return true;
+}
+
+static void history_axis_clear(history_axis_t *const axis) { *axis = (history_axis_t){ .min = INFINITY, .max = -INFINITY }; }
+
+static history_block_t *history_block(const history_t *const history, const unsigned int tier, const int64_t start) {
+    return &history->blocks[tier][(size_t)(start / history_span[tier]) % history_size[tier]];
+}
+
+// Adds an accepted fix to the blocks for its second, minute and hour, by the time gps_fix_time() gives it. One
+// older than a slot already holds, as after its clock has gone back by more than the ring, is not added there.
+static void history_add(history_t *const history, const time_t time, const double lat, const double lon, const double alt) {
+    if (history == NULL || history->blocks[0] == NULL || time <= 0)
+        return;
+    if (!history->ready) {
+        history->origin_lat = lat;
+        history->origin_lon = lon;
+        history->origin_alt = alt;
+        history->metres_lon = 111320.0 * cos(lat * M_PI / 180.0);
+        __atomic_store_n(&history->ready, 1, __ATOMIC_RELEASE);
+    }
+    const double offset[3] = { (lon - history->origin_lon) * history->metres_lon, (lat - history->origin_lat) * 111320.0, alt - history->origin_alt };
+    for (unsigned int tier = 0; tier < HISTORY_TIERS; tier++) {
+        const int64_t start          = (int64_t)time - (int64_t)time % history_span[tier];
+        history_block_t *const block = history_block(history, tier, start);
+        if (block->time > start)
+            continue;
+        const uint32_t sequence = block->sequence;
+        __atomic_store_n(&block->sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        if (block->time != start) {
+            block->time  = start;
+            block->count = 0;
+            for (unsigned int axis = 0; axis < 3; axis++)
+                history_axis_clear(&block->axes[axis]);
+        }
+        block->count++;
+        for (unsigned int axis = 0; axis < 3; axis++) {
+            history_axis_t *const a = &block->axes[axis];
+            a->sum += offset[axis];
+            a->sum_squares += offset[axis] * offset[axis];
+            a->min = fmin(a->min, offset[axis]);
+            a->max = fmax(a->max, offset[axis]);
+        }
+        __atomic_store_n(&block->sequence, sequence + 2, __ATOMIC_RELEASE);
+        if (start > history->head[tier])
+            __atomic_store_n(&history->head[tier], start, __ATOMIC_RELAXED);
+    }
+}
+
+// Whether a ring still holds the block that starts then, rather than a later one in its slot.
+static bool history_held(const history_t *const history, const unsigned int tier, const int64_t start) {
+    return __atomic_load_n(&history->head[tier], __ATOMIC_RELAXED) - start < (int64_t)history_size[tier] * history_span[tier];
+}
+
+// A consistent copy of the block that starts then, as process_read takes a snapshot; false if it has no fixes.
+static bool history_read(const history_t *const history, const unsigned int tier, const int64_t start, history_block_t *const copy) {
+    const history_block_t *const block = history_block(history, tier, start);
+    for (;;) {
+        const uint32_t sequence = __atomic_load_n(&block->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1)
+            continue;
+        *copy = *block;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&block->sequence, __ATOMIC_RELAXED) == sequence)
+            return copy->time == start && copy->count > 0;
+    }
+}
+
+// Merges a block whose offsets are from an origin shift metres from the summary's.
+static void history_merge(history_summary_t *const summary, const history_block_t *const block, const double shift[3]) {
+    summary->count += block->count;
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        const history_axis_t *const from = &block->axes[axis];
+        history_axis_t *const to         = &summary->axes[axis];
+        to->sum += from->sum + block->count * shift[axis];
+        to->sum_squares += from->sum_squares + 2.0 * shift[axis] * from->sum + block->count * shift[axis] * shift[axis];
+        to->min = fmin(to->min, from->min + shift[axis]);
+        to->max = fmax(to->max, from->max + shift[axis]);
+    }
+}
+
+// Merges the blocks covering [from, to): at each point the coarsest that starts there and ends within the period,
+// of those still held, or where none is, the finest still held that contains it.
+static void history_merge_period(history_summary_t *const summary, const history_t *const history, const int64_t from, const int64_t to, const double shift[3]) {
+    for (int64_t time = from; time < to;) {
+        unsigned int tier = HISTORY_TIERS;
+        while (tier > 0 && (time % history_span[tier - 1] != 0 || history_span[tier - 1] > to - time || !history_held(history, tier - 1, time)))
+            tier--;
+        int64_t start = time;
+        if (tier-- == 0) {
+            while (++tier < HISTORY_TIERS && !history_held(history, tier, time - time % history_span[tier]))
+                ;
+            if (tier == HISTORY_TIERS) { // older than them all
+                time += history_span[HISTORY_TIERS - 1] - time % history_span[HISTORY_TIERS - 1];
+                continue;
+            }
+            start = time - time % history_span[tier];
+        }
+        history_block_t block;
+        if (history_read(history, tier, start, &block))
+            history_merge(summary, &block, shift);
+        time = start + history_span[tier];
+    }
+}
+
+// The fixes of [from, to) over the receivers' histories, pooled: each one's offsets are moved to the origin of the
+// first that has one, which the summary takes.
+static void history_summarise(const history_t *const *const histories, const unsigned int count, const int64_t from, const int64_t to, history_summary_t *const summary) {
+    *summary = (history_summary_t){ 0 };
+    for (unsigned int axis = 0; axis < 3; axis++)
+        history_axis_clear(&summary->axes[axis]);
+    const history_t *origin = NULL;
+    for (unsigned int i = 0; i < count; i++) {
+        const history_t *const history = histories[i];
+        if (!__atomic_load_n(&history->ready, __ATOMIC_ACQUIRE))
+            continue;
+        if (origin == NULL) {
+            origin              = history;
+            summary->origin_lat = history->origin_lat;
+            summary->origin_lon = history->origin_lon;
+            summary->origin_alt = history->origin_alt;
+            summary->metres_lon = history->metres_lon;
+        }
+        const double shift[3] = { (history->origin_lon - origin->origin_lon) * origin->metres_lon, (history->origin_lat - origin->origin_lat) * 111320.0,
+                                  history->origin_alt - origin->origin_alt };
+        history_merge_period(summary, history, from, to, shift);
+    }
+}
+
+// Mean and sample standard deviation of an axis, metres from the summary's origin.
+static void history_axis_stats(const history_summary_t *const summary, const unsigned int axis, double *const mean, double *const stddev) {
+    const history_axis_t *const a = &summary->axes[axis];
+    const double n                = (double)summary->count;
+    *mean                         = a->sum / n;
+    *stddev                       = (summary->count > 1) ? sqrt(fmax(0.0, (a->sum_squares - a->sum * a->sum / n) / (n - 1.0))) : 0.0;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+// Where the time goes between serial bytes arriving and a client receiving the result: each fix is timed from the
+// wakeup that read it to being parsed, averaged, published and delivered to the first watcher, and each of those
+// latencies recorded into a histogram for its stage, reported by ?PERF. The histograms are log-linear, as
+// HdrHistogram's: PERF_SUB linear buckets in each power of two, so a value is placed to within 1/PERF_SUB of
+// itself, from 1ns to beyond a quarter of an hour, in fixed memory. A stage may run on several threads, one per
+// receiver, which update its histogram with relaxed atomic adds, so recording costs a clock read and a few increments.
+
+#define PERF_SUB_BITS 3
+#define PERF_SUB (1u << PERF_SUB_BITS)
+#define PERF_RANGE_BITS 40 // 2^40ns, about 18 minutes; anything longer counts in the last bucket
+#define PERF_BUCKETS (PERF_SUB * (PERF_RANGE_BITS - PERF_SUB_BITS + 1))
+
+typedef enum { PERF_STAGE_PARSE, PERF_STAGE_AVERAGE, PERF_STAGE_PUBLISH, PERF_STAGE_DELIVER, PERF_STAGES } perf_stage_t;
+static const char *perf_stage_str[PERF_STAGES] = { "parse", "average", "publish", "deliver" };
+
+typedef struct {
+    uint32_t counts[PERF_BUCKETS];
+    uint64_t sum_ns, max_ns;
+} perf_histogram_t;
+
+static perf_histogram_t perf_histograms[PERF_STAGES];
+
+static long long perf_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static unsigned int perf_bucket(const uint64_t ns) {
+    if (ns < PERF_SUB)
+        return (unsigned int)ns;
+    const unsigned int exponent = 63 - (unsigned int)__builtin_clzll(ns);
+    if (exponent >= PERF_RANGE_BITS)
+        return PERF_BUCKETS - 1;
+    return (exponent - PERF_SUB_BITS + 1) * PERF_SUB + (unsigned int)((ns >> (exponent - PERF_SUB_BITS)) & (PERF_SUB - 1));
+}
+
+// The middle of a bucket's range, as the value reported for what it holds.
+static double perf_bucket_value(const unsigned int bucket) {
+    if (bucket < PERF_SUB)
+        return (double)bucket;
+    const unsigned int shift = bucket / PERF_SUB - 1;
+    return (double)((uint64_t)(PERF_SUB + bucket % PERF_SUB) << shift) + (double)((uint64_t)1 << shift) / 2.0;
+}
+
+static void perf_record(const perf_stage_t stage, const long long ns) {
+    perf_histogram_t *const h = &perf_histograms[stage];
+    const uint64_t value      = (ns > 0) ? (uint64_t)ns : 0;
+    const unsigned int bucket = perf_bucket(value);
+    __atomic_fetch_add(&h->counts[bucket], 1, __ATOMIC_RELAXED); // one ingest thread per device records at once
+    __atomic_fetch_add(&h->sum_ns, value, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&h->max_ns, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// Readers work from a copy of the buckets, so that figures taken from it agree with each other however the writer
+// moves on meanwhile; returns the number of values the copy holds.
+static uint64_t perf_copy(const perf_stage_t stage, uint32_t counts[PERF_BUCKETS], uint64_t *const sum_ns, uint64_t *const max_ns) {
+    const perf_histogram_t *const h = &perf_histograms[stage];
+    uint64_t total                  = 0;
+    for (unsigned int i = 0; i < PERF_BUCKETS; i++)
+        total += (counts[i] = __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED));
+    *sum_ns = __atomic_load_n(&h->sum_ns, __ATOMIC_RELAXED);
+    *max_ns = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+    return total;
+}
+
+// A summary of one stage as JSON, in microseconds.
+static int perf_format_stage(char *const buf, const size_t buflen, const perf_stage_t stage, const char *const separator) {
+    static const double percentiles[] = { 0.50, 0.90, 0.99, 0.999 };
+    double values[sizeof(percentiles) / sizeof(percentiles[0])] = { 0 };
+    uint32_t counts[PERF_BUCKETS];
+    uint64_t sum_ns, max_ns;
+    const uint64_t total = perf_copy(stage, counts, &sum_ns, &max_ns);
+    uint64_t seen        = 0;
+    for (unsigned int i = 0, p = 0; i < PERF_BUCKETS && p < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        seen += counts[i];
+        for (; p < sizeof(percentiles) / sizeof(percentiles[0]) && seen > 0 && (double)seen >= percentiles[p] * (double)total; p++)
+            values[p] = fmin(perf_bucket_value(i), (double)max_ns);
+    }
+    return snprintf(buf, buflen, "%s\"%s\":{\"count\":%llu,\"mean_us\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}",
+                    separator, perf_stage_str[stage], (unsigned long long)total, (total > 0) ? (double)sum_ns / (double)total / 1000.0 : 0.0, values[0] / 1000.0,
+                    values[1] / 1000.0, values[2] / 1000.0, values[3] / 1000.0, (double)max_ns / 1000.0);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+#define GPS_CONSTELLATIONS 8 // gnssid, as libgps numbers them
+static const char *gps_constellation_str[GPS_CONSTELLATIONS] = { "gps", "sbas", "galileo", "beidou", "imes", "qzss", "glonass", "navic" };
+
+int gps_satellites_min = DEFAULT_SATELLITES_MIN;
+double gps_hdop_max    = DEFAULT_HDOP_MAX;
+double gps_cno_min     = DEFAULT_CNO_MIN;
+
+// Receivers send GST and GSV after the GGA of their epoch, so a fix is matched with the last of each, as long as
+// that is no older than this, in seconds.
+#define GPS_REPORT_AGE_MAX 3
+
+static bool gps_report_current(const struct gps_data_t *const gps_handle, const timespec_t *const time) {
+    return llabs((long long)(gps_handle->fix.time.tv_sec - time->tv_sec)) <= GPS_REPORT_AGE_MAX;
+}
+
+// With --cno, a fix also needs --sats satellites in view tracked at that C/N0 or better: a fix from weak signals,
+// as under foliage or indoors, is prone to multipath however many satellites it used.
+static bool gps_process_fix_is_signal_acceptable(const struct gps_data_t *const gps_handle) {
+    if (!(gps_cno_min > 0))
+        return true;
+    if (!gps_report_current(gps_handle, &gps_handle->skyview_time))
+        return false;
+    int strong = 0;
+    for (int i = 0; i < gps_handle->satellites_visible && i < MAXCHANNELS; i++)
+        strong += (gps_handle->skyview[i].ss >= gps_cno_min) ? 1 : 0;
+    return strong >= gps_satellites_min;
+}
+
+static bool gps_process_fix_is_quality_acceptable(const struct gps_data_t *const gps_handle) {
+    return (gps_handle->satellites_used >= gps_satellites_min && gps_handle->dop.hdop <= gps_hdop_max && gps_process_fix_is_signal_acceptable(gps_handle));
+}
+
+// The receiver's own errors for the fix from its GST, east/north/up metres; false when it has sent none lately.
+static bool gps_fix_error(const struct gps_data_t *const gps_handle, double error_m[3]) {
+    const struct gst_t *const gst = &gps_handle->gst;
+    error_m[0]                    = gst->lon_err_deviation;
+    error_m[1]                    = gst->lat_err_deviation;
+    error_m[2]                    = gst->alt_err_deviation;
+    return gps_report_current(gps_handle, &gst->utctime) && error_m[0] > 0 && error_m[1] > 0 && error_m[2] > 0;
+}
+
+// gpsd 3.20 (API v9) deprecated fix.altitude and split it into altMSL (above mean sea level, geoid) and
+// altHAE (above ellipsoid). Newer gpsd (required for the u-blox Gen9) leaves the legacy fix.altitude as
+// NaN, which then poisons the averaged altitude and is emitted as the invalid JSON token "nan".
+static double gps_fix_altitude(const struct gps_data_t *const gps_handle) {
+#if GPSD_API_MAJOR_VERSION >= 9
+    if (!isnan(gps_handle->fix.altMSL))
+        return gps_handle->fix.altMSL;
+    return gps_handle->fix.altHAE; // fall back to ellipsoid height if no geoid separation
+#else
+    return gps_handle->fix.altitude;
+#endif
+}
+
+// When the fix was made: by the receiver's UTC when it gives a full one, or otherwise by the system clock run on
+// from the offset found at its last dated fix, which is the system clock itself until the receiver gives a date.
+static struct timespec gps_fix_time(const struct gps_data_t *const gps_handle, const time_t clock_offset) {
+    struct timespec now = { 0 };
+    if (gps_handle->set & TIME_SET) {
+        now.tv_sec  = gps_handle->fix.time.tv_sec;
+        now.tv_nsec = gps_handle->fix.time.tv_nsec;
+    } else {
+        clock_gettime(CLOCK_REALTIME, &now);
+        now.tv_sec += clock_offset;
+    }
+    return now;
+}
+
+// The fix to the journal, if there is one, stamped as gps_fix_time(); a rejected fix only with --journal-rejected,
+// and none without a position in all three axes.
+static void gps_journal_fix(journal_t *const journal, const struct gps_data_t *const gps_handle, const time_t clock_offset, const double latitude, const double longitude,
+                            const double altitude, const uint8_t flags) {
+    if (journal == NULL || journal->directory == NULL || (!(flags & GPSD_AVERAGED_JOURNAL_ACCEPTED) && !journal->rejected) || !isfinite(latitude) || !isfinite(longitude) ||
+        !isfinite(altitude))
+        return;
+    const struct timespec now = gps_fix_time(gps_handle, clock_offset);
+    journal_append(journal, (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000, latitude, longitude, altitude, gps_handle->dop.hdop, gps_handle->satellites_used,
+                   (uint8_t)(flags | ((gps_handle->fix.mode >= MODE_3D) ? GPSD_AVERAGED_JOURNAL_3D : 0)));
+}
+
+static bool gps_process_fix(const struct gps_data_t *const gps_handle, average_state_t *const state, journal_t *const journal, history_t *const history) {
+    state->received_fixes++;
+    // Until the receiver gives a date (a GGA before the first RMC or ZDA, or every fix of one that sends neither)
+    // the averaging runs on the system clock; at the first, what it has timed so far is moved onto the receiver's.
+    if (gps_handle->set & TIME_SET) {
+        const time_t clock_offset = gps_handle->fix.time.tv_sec - time(NULL);
+        if (!state->clock_dated && state->count > 0)
+            average_rebase(state, clock_offset - state->clock_offset);
+        state->clock_dated  = true;
+        state->clock_offset = clock_offset;
+    }
+    const double latitude = gps_handle->fix.latitude, longitude = gps_handle->fix.longitude, altitude = gps_fix_altitude(gps_handle);
+    // A single non-finite altitude (e.g. a brief 2D fix right after startup, where altMSL/altHAE are
+    // NaN) would permanently poison the Kalman altitude estimate, so require all three components to be
+    // finite before averaging - otherwise treat the fix as rejected.
+    if (gps_process_fix_is_quality_acceptable(gps_handle) && isfinite(latitude) && isfinite(longitude) && isfinite(altitude)) {
+        double error_m[3];
+        const bool gst      = gps_fix_error(gps_handle, error_m);
+        const bool accepted = average_update(state, latitude, longitude, altitude, gps_handle->dop.hdop, gps_handle->satellites_used, gst ? error_m : NULL);
+        gps_journal_fix(journal, gps_handle, state->clock_offset, latitude, longitude, altitude,
+                        (uint8_t)((accepted ? GPSD_AVERAGED_JOURNAL_ACCEPTED : GPSD_AVERAGED_JOURNAL_OUTLIER) | (gst ? GPSD_AVERAGED_JOURNAL_GST : 0)));
+        if (accepted)
+            history_add(history, gps_fix_time(gps_handle, state->clock_offset).tv_sec, latitude, longitude, altitude);
+        if (verbose && accepted)
+            printf("Fix %lu: %.8f,%.8f,%.1f sats=%d hdop=%.1f\n", state->count, latitude, longitude, altitude, gps_handle->satellites_used, gps_handle->dop.hdop);
+        return accepted;
+    }
+    state->rejected_fixes++;
+    gps_journal_fix(journal, gps_handle, state->clock_offset, latitude, longitude, altitude, GPSD_AVERAGED_JOURNAL_QUALITY);
+    if (verbose)
+        printf("Fix rejected: sats=%d hdop=%.1f alt=%.1f\n", gps_handle->satellites_used, gps_handle->dop.hdop, altitude);
+    return false;
+}
+
+static bool gps_connect(struct gps_data_t *const gps_handle, const char *const gpsd_host, const char *const gpsd_port, const int satellites_min, const double hdop_max,
+                        const double cno_min) {
     gps_satellites_min = satellites_min;
     gps_hdop_max       = hdop_max;
+    gps_cno_min        = cno_min;
     if (gps_open(gpsd_host, gpsd_port, gps_handle) != 0) {
         fprintf(stderr, "Failed to connect to " GPS_SOURCE_NAME " at %s:%s\n", gpsd_host, gpsd_port);
         return false;
@@ -383,220 +2429,1792 @@ static bool gps_connect(struct gps_data_t *const gps_handle, const char *const g
     return true;
 }
 
-static void gps_disconnect(struct gps_data_t *const gps_handle) {
-    gps_stream(gps_handle, WATCH_DISABLE, NULL);
-    gps_close(gps_handle);
+static void gps_disconnect(struct gps_data_t *const gps_handle) {
+    gps_stream(gps_handle, WATCH_DISABLE, NULL);
+    gps_close(gps_handle);
+}
+
+// One wakeup drains every epoch already buffered, not just the first: further epochs in the same read would
+// not make the descriptor readable again, and would otherwise wait for the next bytes to arrive, up to an epoch
+// late. The drain is bounded so that a snapshot is still published during a long backlog; the loop then polls
+// rather than sleeps until it clears. Backlog is the epochs found waiting beyond the one that caused the wakeup.
+typedef struct {
+    unsigned long wakeups, epochs;
+    unsigned int backlog, backlog_max;
+    unsigned long published, stalls; // see process_ingest
+    long long publish_ns_max;
+    unsigned long reads, bytes, checksum_errors, overlong; // from the NMEA reader; libgps does not count them
+    unsigned long journalled, journal_dropped;             // see journal_append
+    double cno_mean[GPS_CONSTELLATIONS];                  // C/N0 of the tracked satellites in the last skyview, dB-Hz
+    unsigned int cno_satellites[GPS_CONSTELLATIONS];      // and how many they were
+} gps_stats_t;
+
+static bool gps_pending(const struct gps_data_t *const gps_handle) { return gps_waiting(gps_handle, 0); }
+
+// Whether the device has nothing more to give: a captured file read to its end, or a pipe whose writer has gone,
+// which poll() would otherwise go on reporting readable. libgps has no equivalent, its socket being gpsd's to keep.
+static bool gps_ended(const struct gps_data_t *const gps_handle) {
+#if defined(GPS_SOURCE_NMEA)
+    return gps_handle->eof && !gps_handle->frame_ready;
+#else
+    (void)gps_handle;
+    return false;
+#endif
+}
+
+static void gps_process_skyview(const struct gps_data_t *const gps_handle, gps_stats_t *const stats) {
+    double sum[GPS_CONSTELLATIONS] = { 0 };
+    memset(stats->cno_satellites, 0, sizeof(stats->cno_satellites));
+    for (int i = 0; i < gps_handle->satellites_visible && i < MAXCHANNELS; i++) {
+        const struct satellite_t *const satellite = &gps_handle->skyview[i];
+        if (satellite->gnssid < GPS_CONSTELLATIONS && satellite->ss > 0) {
+            sum[satellite->gnssid] += satellite->ss;
+            stats->cno_satellites[satellite->gnssid]++;
+        }
+    }
+    for (unsigned int constellation = 0; constellation < GPS_CONSTELLATIONS; constellation++)
+        stats->cno_mean[constellation] = (stats->cno_satellites[constellation] > 0) ? sum[constellation] / stats->cno_satellites[constellation] : 0.0;
+}
+
+// Returns the number of fixes accepted into the average. Each epoch is timed from read_ns, when the wakeup found
+// the device readable, to being parsed and then averaged.
+static unsigned int gps_process(struct gps_data_t *const gps_handle, average_state_t *const state, journal_t *const journal, history_t *const history,
+                                gps_stats_t *const gps_stats, const long long read_ns) {
+    unsigned int epochs = 0, accepted = 0;
+    do {
+#if GPSD_API_MAJOR_VERSION < 7
+        if (gps_read(gps_handle) <= 0)
+#else
+        if (gps_read(gps_handle, NULL, 0) <= 0)
+#endif
+            break;
+        if (gps_handle->set & MODE_SET) {
+            epochs++;
+            perf_record(PERF_STAGE_PARSE, perf_now_ns() - read_ns);
+            if (gps_handle->fix.mode >= MODE_2D) {
+                if (gps_process_fix(gps_handle, state, journal, history))
+                    accepted++;
+                perf_record(PERF_STAGE_AVERAGE, perf_now_ns() - read_ns);
+            }
+        }
+    } while (epochs < GPS_DRAIN_MAX && gps_pending(gps_handle));
+#if defined(GPS_SOURCE_NMEA)
+    gps_stats->reads           = gps_handle->stat_reads;
+    gps_stats->bytes           = gps_handle->stat_bytes;
+    gps_stats->checksum_errors = gps_handle->stat_checksum;
+    gps_stats->overlong        = gps_handle->stat_overlong;
+#endif
+    if (epochs > 0)
+        gps_process_skyview(gps_handle, gps_stats);
+    gps_stats->journalled      = journal->written;
+    gps_stats->journal_dropped = journal->dropped;
+    gps_stats->wakeups++;
+    gps_stats->epochs += epochs;
+    gps_stats->backlog = (epochs > 1) ? epochs - 1 : 0;
+    if (gps_stats->backlog > gps_stats->backlog_max)
+        gps_stats->backlog_max = gps_stats->backlog;
+    return accepted;
+}
+
+// The serial paths of several receivers as one: their counters summed, the worst of their backlogs and
+// publications, and the C/N0 of each constellation over all the satellites any of them is tracking.
+static void gps_stats_fuse(const gps_stats_t *const devices, const unsigned int count, gps_stats_t *const fused) {
+    double sum[GPS_CONSTELLATIONS] = { 0 };
+    *fused                         = (gps_stats_t){ 0 };
+    for (unsigned int i = 0; i < count; i++) {
+        const gps_stats_t *const device = &devices[i];
+        fused->wakeups += device->wakeups;
+        fused->epochs += device->epochs;
+        fused->published += device->published;
+        fused->stalls += device->stalls;
+        fused->reads += device->reads;
+        fused->bytes += device->bytes;
+        fused->checksum_errors += device->checksum_errors;
+        fused->overlong += device->overlong;
+        fused->journalled += device->journalled;
+        fused->journal_dropped += device->journal_dropped;
+        fused->backlog        = (device->backlog > fused->backlog) ? device->backlog : fused->backlog;
+        fused->backlog_max    = (device->backlog_max > fused->backlog_max) ? device->backlog_max : fused->backlog_max;
+        fused->publish_ns_max = (device->publish_ns_max > fused->publish_ns_max) ? device->publish_ns_max : fused->publish_ns_max;
+        for (unsigned int constellation = 0; constellation < GPS_CONSTELLATIONS; constellation++) {
+            sum[constellation] += device->cno_mean[constellation] * device->cno_satellites[constellation];
+            fused->cno_satellites[constellation] += device->cno_satellites[constellation];
+        }
+    }
+    for (unsigned int constellation = 0; constellation < GPS_CONSTELLATIONS; constellation++)
+        fused->cno_mean[constellation] = (fused->cno_satellites[constellation] > 0) ? sum[constellation] / fused->cno_satellites[constellation] : 0.0;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+static void client_format_error_response(char *const buf, const size_t buflen, const char *const message) {
+    snprintf(buf, buflen, "{\"class\":\"ERROR\",\"message\":\"%s\"}\r\n", message);
+}
+
+static void client_format_version_response(char *const buf, const size_t buflen) { snprintf(buf, buflen, "{\"class\":\"VERSION\",\"release\":\"gpsd_averaged 1.0\"}\r\n"); }
+
+static void client_format_stats_response(char *const buf, const size_t buflen, const average_snapshot_t *const snapshot, const average_filter_t filter __attribute__((unused))) {
+    if (snapshot->count > 0)
+        snprintf(buf, buflen,
+                 "{\"class\":\"STATS\","
+                 "\"samples\":%lu,\"rejected\":%lu,"
+                 "\"first_fix\":%ld,\"last_fix\":%ld,"
+                 "\"lat_stddev\":%.6f,\"lon_stddev\":%.6f,\"alt_stddev\":%.2f,\"relocations\":%lu}\r\n",
+                 snapshot->count, snapshot->rejected_fixes, snapshot->first_fix, snapshot->last_fix, sqrt(snapshot->latitude_var), sqrt(snapshot->longitude_var),
+                 sqrt(snapshot->altitude_var), snapshot->relocations);
+    else
+        client_format_error_response(buf, buflen, "No statistics available");
+}
+
+// The TPV of one filter, with the errors of its position.
+static void client_format_json_response(char *const buf, const size_t buflen, const average_snapshot_t *const snapshot, const average_filter_t filter) {
+    if (snapshot->count > 0) {
+        const average_output_t *const output = &snapshot->outputs[filter];
+        snprintf(buf, buflen,
+                 "{\"class\":\"TPV\",\"device\":\"%s\",\"mode\":3,\"filter\":\"%s\","
+                 "\"lat\":%.8f,\"lon\":%.8f,\"alt\":%.2f,"
+                 "\"samples\":%lu,\"window\":%zu,\"outliers\":%lu,"
+                 "\"lat_err\":%.2f,\"lon_err\":%.2f,\"alt_err\":%.2f,\"age\":%ld}\r\n",
+                 (snapshot->device != NULL) ? snapshot->device : "averaged", get_filter_name(filter), output->latitude, output->longitude, output->altitude, snapshot->count,
+                 snapshot->window, snapshot->outliers_rejected, output->lat_error_m, output->lon_error_m, output->alt_error_m,
+                 average_clock(snapshot->clock_offset) - snapshot->last_fix);
+    } else
+        client_format_error_response(buf, buflen, "No positions available");
+}
+
+// The receivers, each with the state of its own average; the fused average is the TPV's "averaged" device.
+static void client_format_devices_response(char *const buf, const size_t buflen, const average_snapshot_t *const devices, const unsigned int count) {
+    size_t n = (size_t)snprintf(buf, buflen, "{\"class\":\"DEVICES\",\"devices\":[");
+    for (unsigned int i = 0; i < count && n < buflen; i++)
+        n += (size_t)snprintf(buf + n, buflen - n, "%s{\"class\":\"DEVICE\",\"path\":\"%s\",\"samples\":%lu,\"outliers\":%lu,\"confidence\":%.2f,\"convergence\":\"%s\"}",
+                              (i > 0) ? "," : "", devices[i].device, devices[i].count, devices[i].outliers_rejected, devices[i].confidence_m,
+                              get_convergence_str(devices[i].convergence));
+    if (n < buflen)
+        snprintf(buf + n, buflen - n, "]}\r\n");
+}
+
+// The stage latencies (see perf_record) and the serial path's counters.
+static void client_format_perf_response(char *const buf, const size_t buflen, const gps_stats_t *const gps) {
+    size_t n = (size_t)snprintf(buf, buflen, "{\"class\":\"PERF\",\"stages\":{");
+    for (unsigned int stage = 0; stage < PERF_STAGES && n < buflen; stage++)
+        n += (size_t)perf_format_stage(buf + n, buflen - n, (perf_stage_t)stage, (stage > 0) ? "," : "");
+    if (n < buflen)
+        snprintf(buf + n, buflen - n,
+                 "},\"wakeups\":%lu,\"epochs\":%lu,\"reads\":%lu,\"bytes\":%lu,\"checksum_errors\":%lu,\"overlong\":%lu,"
+                 "\"backlog\":%u,\"backlog_max\":%u,\"published\":%lu,\"stalls\":%lu,\"journalled\":%lu,\"journal_dropped\":%lu}\r\n",
+                 gps->wakeups, gps->epochs, gps->reads, gps->bytes, gps->checksum_errors, gps->overlong, gps->backlog, gps->backlog_max, gps->published, gps->stalls,
+                 gps->journalled, gps->journal_dropped);
+}
+
+// A receiver's ?ADEV: for each tau with a term, the ADEV and MDEV east/north/up in metres.
+static void client_format_stability_response(char *const buf, const size_t buflen, const average_snapshot_t *const snapshot) {
+    const stability_sums_t *const sums = &snapshot->stability;
+    size_t n = (size_t)snprintf(buf, buflen, "{\"class\":\"ADEV\",\"device\":\"%s\",\"taus\":[", (snapshot->device != NULL) ? snapshot->device : "averaged");
+    for (unsigned int tau = 0; tau < STABILITY_TAUS && sums->adev_terms[tau] > 0 && n < buflen; tau++) {
+        n += (size_t)snprintf(buf + n, buflen - n, "%s{\"tau\":%.0f,\"terms\":%lu,\"adev\":[%.4f,%.4f,%.4f]", (tau > 0) ? "," : "", stability_tau(tau), sums->adev_terms[tau],
+                              stability_deviation(sums, tau, 0, false), stability_deviation(sums, tau, 1, false), stability_deviation(sums, tau, 2, false));
+        if (n < buflen && sums->mdev_terms[tau] > 0)
+            n += (size_t)snprintf(buf + n, buflen - n, ",\"mdev\":[%.4f,%.4f,%.4f]", stability_deviation(sums, tau, 0, true), stability_deviation(sums, tau, 1, true),
+                                  stability_deviation(sums, tau, 2, true));
+        if (n < buflen)
+            n += (size_t)snprintf(buf + n, buflen - n, "}");
+    }
+    if (n < buflen)
+        snprintf(buf + n, buflen - n, "]}\r\n");
+}
+
+// One bucket of a ?HISTORY reply: the mean position of its fixes, their standard deviation per axis in metres,
+// and their extent.
+static size_t client_format_history_bucket(char *const buf, const size_t buflen, const history_summary_t *const summary, const int64_t time, const char *const separator) {
+    int n;
+    if (summary->count == 0)
+        n = snprintf(buf, buflen, "%s{\"time\":%lld,\"samples\":0}", separator, (long long)time);
+    else {
+        double mean[3], stddev[3];
+        for (unsigned int axis = 0; axis < 3; axis++)
+            history_axis_stats(summary, axis, &mean[axis], &stddev[axis]);
+        const history_axis_t *const east = &summary->axes[0], *const north = &summary->axes[1], *const up = &summary->axes[2];
+        n = snprintf(buf, buflen,
+                     "%s{\"time\":%lld,\"samples\":%lu,\"lat\":%.8f,\"lon\":%.8f,\"alt\":%.2f,"
+                     "\"lat_stddev_m\":%.3f,\"lon_stddev_m\":%.3f,\"alt_stddev_m\":%.3f,"
+                     "\"lat_min\":%.8f,\"lat_max\":%.8f,\"lon_min\":%.8f,\"lon_max\":%.8f,\"alt_min\":%.2f,\"alt_max\":%.2f}",
+                     separator, (long long)time, summary->count, summary->origin_lat + mean[1] / 111320.0, summary->origin_lon + mean[0] / summary->metres_lon,
+                     summary->origin_alt + mean[2], stddev[1], stddev[0], stddev[2], summary->origin_lat + north->min / 111320.0, summary->origin_lat + north->max / 111320.0,
+                     summary->origin_lon + east->min / summary->metres_lon, summary->origin_lon + east->max / summary->metres_lon, summary->origin_alt + up->min,
+                     summary->origin_alt + up->max);
+    }
+    return (n < 0) ? 0 : ((size_t)n < buflen) ? (size_t)n : buflen - 1;
+}
+
+// Connections are persistent: each is a client_t, served from an epoll loop on snapshots of the average, and
+// answers every request line it sends until it closes. ?WATCH subscribes it to a TPV on every accepted fix.
+// A TPV is of the default filter unless the request names another that is running, as ?POLL={"filter":"kalman"};
+// a filter named in ?WATCH stays the one watched. Likewise it is of the fused average of every receiver unless
+// the request names one of them, as ?POLL={"device":"/dev/ttyUSB1"}, and ?DEVICES lists them.
+// ?HISTORY={"from":...,"to":...,"bucket":...} reports the fixes of a past period from the receivers' histories,
+// in buckets of the given seconds: a reply of any length is rendered a few buckets at a time as the socket takes
+// them, and until it ends the client's further requests wait and, if it watches, its TPVs are skipped.
+// Writes never block: a client's output goes straight to the socket while that keeps up, and whatever the
+// socket will not take waits in the client's own queue to be flushed on EPOLLOUT. A watcher whose queue cannot
+// take an update loses that update, and one that loses CLIENT_DROPS_MAX in a row is disconnected, so a stalled
+// reader costs only its own queue and never the serial path or the other clients.
+//
+// A client that connects and says nothing within CLIENT_GREETING_MS is answered with a TPV and closed, as every
+// connection used to be, so that existing connect-and-read consumers keep working.
+
+typedef struct {
+    bool active;
+    unsigned int device; // as client_t's
+    int64_t from, next, to, bucket;
+} client_history_t;
+
+typedef struct {
+    int fd;
+    bool watch, requested;
+    average_filter_t filter; // watched
+    unsigned int device;     // watched: 0 the fused average, 1 + i receiver i
+    unsigned int drops;
+    long long accepted_ms, active_ms;
+    char request[CLIENT_REQUEST_MAX];
+    size_t request_length;
+    char queue[CLIENT_QUEUE_MAX];
+    size_t queue_head, queue_length;
+    client_history_t history; // a ?HISTORY reply being sent
+} client_t;
+
+// Responses that depend on the averaged state are rendered at most once per snapshot version and
+// per second (the TPV carries the fix's age), and then sent as-is to every client that asks, so that a burst
+// of pollers at the top of the second costs one render and as many sends. A filter's TPV is rendered as soon as
+// a fix is accepted if it has watchers, as they need it then; otherwise, and STATS, when first asked for.
+typedef struct {
+    char data[BUFFER_MAX];
+    size_t length;
+    unsigned long version;
+    time_t second;
+} client_payload_t;
+
+typedef void (*client_formatter_t)(char *const buf, const size_t buflen, const average_snapshot_t *const snapshot, const average_filter_t filter);
+
+static const client_payload_t *client_payload(client_payload_t *const payload, const client_formatter_t format, const average_snapshot_t *const snapshot,
+                                              const average_filter_t filter) {
+    const time_t now = time(NULL);
+    if (payload->length == 0 || payload->version != snapshot->version || payload->second != now) {
+        format(payload->data, sizeof(payload->data), snapshot, filter);
+        payload->length  = strlen(payload->data);
+        payload->version = snapshot->version;
+        payload->second  = now;
+    }
+    return payload;
+}
+
+typedef struct {
+    int epoll_fd;
+    int listen_fds[CLIENT_LISTEN_MAX];
+    size_t listen_count;
+    const char *socket_path; // bound here, so unlinked at exit; not set for sockets from systemd
+    client_payload_t tpv[1 + DEVICES_MAX][AVERAGE_FILTERS], stats[1 + DEVICES_MAX]; // of the fused average, then of each receiver
+    average_filter_t filter;                                                       // the default, that new clients watch
+    const gps_stats_t *gps;                  // the serial path's statistics as of the snapshot being served, for ?PERF
+    const average_snapshot_t *devices;       // each receiver's average as of the snapshot being served
+    const history_t *histories[DEVICES_MAX]; // and its history, for ?HISTORY
+    unsigned int device_count;
+    client_t *clients; // CLIENT_MAX, allocated once; fd < 0 marks a free slot
+    size_t count, watchers;
+    unsigned long accepted, refused, dropped, disconnected_slow;
+} client_server_t;
+
+// epoll_event data: the client's slot index, or one of these for the other descriptors in the set
+#define CLIENT_TAG_NOTIFY UINT32_MAX
+#define CLIENT_TAG_LISTEN(index) (UINT32_MAX - 1 - (uint32_t)(index))
+#define CLIENT_TAG_IS_LISTEN(tag) ((tag) < CLIENT_TAG_NOTIFY && (tag) >= CLIENT_TAG_LISTEN(CLIENT_LISTEN_MAX - 1))
+#define SD_LISTEN_FDS_START 3
+
+static long long client_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Listeners are the TCP port, optionally a Unix domain socket for consumers on the same host (no handshake or
+// loopback TCP stack per poll), or, when started by systemd socket activation, whatever sockets the unit
+// passed in, in place of both. Every listener speaks the same protocol.
+static bool client_listen_add(client_server_t *const server, const int fd) {
+    if (server->listen_count == CLIENT_LISTEN_MAX) {
+        fprintf(stderr, "Too many listening sockets, at most %d\n", CLIENT_LISTEN_MAX);
+        close(fd);
+        return false;
+    }
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = CLIENT_TAG_LISTEN(server->listen_count) };
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        perror("epoll_ctl");
+        close(fd);
+        return false;
+    }
+    server->listen_fds[server->listen_count++] = fd;
+    return true;
+}
+
+static int client_listen_inet(const unsigned short port, const bool listenany) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    const int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(listenany ? INADDR_ANY : INADDR_LOOPBACK);
+    addr.sin_port        = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+    } else if (listen(fd, CLIENT_BACKLOG) < 0) {
+        perror("listen");
+    } else
+        return fd;
+    close(fd);
+    return -1;
+}
+
+// A socket left behind by an unclean exit would fail the bind, so one found at the path is replaced; anything
+// else there is left alone. The mode opens it to local users, as the TCP port is to the local host.
+static int client_listen_unix(const char *const path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+    } else if (chmod(path, 0666) < 0) {
+        perror("chmod");
+    } else if (listen(fd, CLIENT_BACKLOG) < 0) {
+        perror("listen");
+    } else
+        return fd;
+    close(fd);
+    return -1;
+}
+
+// The sd_listen_fds() protocol, without needing libsystemd: LISTEN_PID names this process, LISTEN_FDS counts
+// the sockets passed from descriptor 3 on. The variables are cleared so that nothing started later inherits them.
+static size_t client_listen_systemd(client_server_t *const server) {
+    const char *const pid = getenv("LISTEN_PID"), *const fds = getenv("LISTEN_FDS");
+    if (pid == NULL || fds == NULL || strtol(pid, NULL, 10) != (long)getpid())
+        return 0;
+    const unsigned long count = strtoul(fds, NULL, 10);
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    size_t adopted = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        const int fd = SD_LISTEN_FDS_START + (int)i;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        if (client_listen_add(server, fd))
+            adopted++;
+    }
+    return adopted;
+}
+
+static bool client_start(client_server_t *const server, const unsigned short port, const bool listenany, const char *const socket_path) {
+    *server = (client_server_t){ .epoll_fd = -1 };
+    if ((server->clients = calloc(CLIENT_MAX, sizeof(client_t))) == NULL) {
+        perror("calloc");
+        return false;
+    }
+    for (size_t i = 0; i < CLIENT_MAX; i++)
+        server->clients[i].fd = -1;
+
+    if ((server->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("epoll_create1");
+        free(server->clients);
+        return false;
+    }
+
+    const size_t activated = client_listen_systemd(server);
+    if (activated > 0) {
+        fprintf(stderr, "listen: %zu socket(s) from systemd\n", activated);
+        return true;
+    }
+    int fd;
+    if ((fd = client_listen_inet(port, listenany)) >= 0 && client_listen_add(server, fd)) {
+        if (socket_path == NULL)
+            return true;
+        if ((fd = client_listen_unix(socket_path)) >= 0 && client_listen_add(server, fd)) {
+            server->socket_path = socket_path;
+            return true;
+        }
+    }
+    for (size_t i = 0; i < server->listen_count; i++)
+        close(server->listen_fds[i]);
+    close(server->epoll_fd);
+    free(server->clients);
+    return false;
+}
+
+static void client_close(client_server_t *const server, client_t *const client) {
+    if (client->fd < 0)
+        return;
+    close(client->fd); // also removes it from the epoll set
+    client->fd = -1;
+    if (client->watch)
+        server->watchers--;
+    server->count--;
+}
+
+static void client_stop(client_server_t *const server) {
+    if (server->clients != NULL) {
+        for (size_t i = 0; i < CLIENT_MAX; i++)
+            client_close(server, &server->clients[i]);
+        free(server->clients);
+        server->clients = NULL;
+    }
+    for (size_t i = 0; i < server->listen_count; i++)
+        close(server->listen_fds[i]);
+    server->listen_count = 0;
+    if (server->socket_path != NULL)
+        unlink(server->socket_path);
+    if (server->epoll_fd >= 0)
+        close(server->epoll_fd);
+    server->epoll_fd = -1;
+}
+
+// Writability is waited for while output is queued or a reply has more to send, and requests are not read while
+// one streams, so that those after it are answered after it.
+static void client_events(const client_server_t *const server, client_t *const client) {
+    struct epoll_event event = { .events   = (client->history.active ? 0 : EPOLLIN) | ((client->queue_length > 0 || client->history.active) ? EPOLLOUT : 0),
+                                 .data.u32 = (uint32_t)(client - server->clients) };
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+// Sends what the socket will take; false if the connection has failed.
+static bool client_flush(const client_server_t *const server, client_t *const client) {
+    while (client->queue_length > 0) {
+        const ssize_t n = send(client->fd, client->queue + client->queue_head, client->queue_length, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0)
+            return errno == EAGAIN || errno == EINTR;
+        client->queue_head += (size_t)n;
+        client->queue_length -= (size_t)n;
+    }
+    client->queue_head = 0;
+    client_events(server, client);
+    return true;
+}
+
+// Queues a whole message, or none of it if it does not fit; false if it was not queued.
+static bool client_queue(const client_server_t *const server, client_t *const client, const char *const data, const size_t length) {
+    size_t offset = 0;
+    if (client->queue_length == 0) {
+        const ssize_t n = send(client->fd, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno != EAGAIN && errno != EINTR)
+            return false;
+        if ((offset = (n > 0) ? (size_t)n : 0) == length)
+            return true;
+    }
+    // Whole messages or none: one already partly sent always fits, as it went out on an empty queue.
+    if (client->queue_length + (length - offset) > CLIENT_QUEUE_MAX)
+        return false;
+    if (client->queue_head + client->queue_length + (length - offset) > CLIENT_QUEUE_MAX) {
+        memmove(client->queue, client->queue + client->queue_head, client->queue_length);
+        client->queue_head = 0;
+    }
+    const bool was_empty = (client->queue_length == 0);
+    memcpy(client->queue + client->queue_head + client->queue_length, data + offset, length - offset);
+    client->queue_length += length - offset;
+    if (was_empty)
+        client_events(server, client);
+    return true;
+}
+
+static void client_respond(client_server_t *const server, client_t *const client, const char *const response, const size_t length) {
+    if (!client_queue(server, client, response, length)) {
+        server->disconnected_slow++;
+        client_close(server, client);
+    }
+}
+
+static void client_watch(client_server_t *const server, client_t *const client, const bool enable) {
+    if (client->watch != enable)
+        server->watchers += enable ? 1 : (size_t)-1;
+    client->watch = enable;
+}
+
+// The filter a request names, or the given one if it names none; false if it names one that is not running.
+static bool client_request_filter(const char *const request, const average_snapshot_t *const snapshot, average_filter_t *const filter) {
+    const char *name = strstr(request, "\"filter\":\"");
+    if (name == NULL)
+        return true;
+    name += strlen("\"filter\":\"");
+    const char *const end = strchr(name, '"');
+    average_filter_t named;
+    if (end == NULL || !get_filter_by_name(name, (size_t)(end - name), &named) || !(snapshot->filters & AVERAGE_FILTER_BIT(named)))
+        return false;
+    *filter = named;
+    return true;
+}
+
+// The receiver a request names, by its path, or the given one if it names none; false if it names none of them.
+static bool client_request_device(const client_server_t *const server, const char *const request, unsigned int *const device) {
+    const char *name = strstr(request, "\"device\":\"");
+    if (name == NULL)
+        return true;
+    name += strlen("\"device\":\"");
+    const char *const end = strchr(name, '"');
+    if (end == NULL)
+        return false;
+    const size_t length = (size_t)(end - name);
+    if (length == strlen("averaged") && strncmp(name, "averaged", length) == 0) {
+        *device = 0;
+        return true;
+    }
+    for (unsigned int i = 0; i < server->device_count; i++)
+        if (strlen(server->devices[i].device) == length && strncmp(server->devices[i].device, name, length) == 0) {
+            *device = 1 + i;
+            return true;
+        }
+    return false;
+}
+
+// The average a client is served from: the fused one, or a receiver's.
+static const average_snapshot_t *client_snapshot(const client_server_t *const server, const unsigned int device, const average_snapshot_t *const snapshot) {
+    return (device > 0) ? &server->devices[device - 1] : snapshot;
+}
+
+// The number a request gives for the key, or the given one if it gives none.
+static void client_request_number(const char *const request, const char *const key, long long *const value) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *const found = strstr(request, pattern);
+    if (found != NULL)
+        *value = strtoll(found + strlen(pattern), NULL, 10);
+}
+
+// A ?HISTORY time, seconds since the epoch or if not positive relative to now, held to what the history can hold:
+// no earlier than its coarsest tier reaches back, and no later than now. Whatever a client asks for, the period is
+// then short enough to walk and to take differences of.
+static long long client_history_time(const long long value, const long long now) {
+    const long long earliest = now - (long long)HISTORY_HOURS * 3600, latest = now + 1;
+    const long long time     = (value > 0) ? value : now + ((value < earliest - now) ? earliest - now : value);
+    return (time < earliest) ? earliest : (time > latest) ? latest : time;
+}
+
+// Starts a ?HISTORY reply, or returns the error to answer with instead. Times are seconds since the epoch, or if
+// not positive, relative to now; the period defaults to the last CLIENT_HISTORY_PERIOD, and to one bucket.
+static const char *client_history_begin(client_t *const client, const char *const request, const unsigned int device, const average_snapshot_t *const snapshot) {
+    const long long now = (long long)average_clock(snapshot->clock_offset);
+    long long from = -CLIENT_HISTORY_PERIOD, to = 0, bucket = 0;
+    client_request_number(request, "from", &from);
+    client_request_number(request, "to", &to);
+    client_request_number(request, "bucket", &bucket);
+    from = client_history_time(from, now);
+    to   = client_history_time(to, now);
+    if (from >= to) // or nothing of it left once held to the history
+        return "Invalid period";
+    if (bucket <= 0 || bucket > to - from)
+        bucket = to - from;
+    if ((to - from + bucket - 1) / bucket > CLIENT_HISTORY_BUCKETS_MAX)
+        return "Too many buckets";
+    client->history = (client_history_t){ .active = true, .device = device, .from = from, .next = from, .to = to, .bucket = bucket };
+    return NULL;
+}
+
+// Queues the next buckets of a ?HISTORY reply, up to CLIENT_HISTORY_TURN or as many as the client's queue has room
+// for, in one write, and the end of it after the last; true once it has ended. The rest are sent on EPOLLOUT, when
+// the queue has drained, or at once on the next turn of the loop if it has, so a long reply takes turns with the others.
+static bool client_history_stream(client_server_t *const server, client_t *const client) {
+    client_history_t *const history         = &client->history;
+    const history_t *const *const histories = (history->device > 0) ? &server->histories[history->device - 1] : server->histories;
+    const unsigned int count                = (history->device > 0) ? 1 : server->device_count;
+    const size_t room                       = CLIENT_QUEUE_MAX - client->queue_length;
+    char batch[CLIENT_QUEUE_MAX];
+    size_t length = 0;
+    for (unsigned int turn = 0; turn < CLIENT_HISTORY_TURN && history->next < history->to; turn++) {
+        const int64_t end = (history->to - history->next > history->bucket) ? history->next + history->bucket : history->to;
+        history_summary_t summary;
+        history_summarise(histories, count, history->next, end, &summary);
+        const size_t n = client_format_history_bucket(batch + length, sizeof(batch) - length, &summary, history->next, (history->next > history->from) ? "," : "");
+        if (length + n + 1 >= room) // or cut short, and taken again next time
+            break;
+        length += n;
+        history->next = end;
+    }
+    const bool ended = (history->next == history->to && length + strlen("]}\r\n") < room);
+    if (ended) {
+        memcpy(batch + length, "]}\r\n", strlen("]}\r\n"));
+        length += strlen("]}\r\n");
+    }
+    if (length > 0 && !client_queue(server, client, batch, length))
+        return false;
+    history->active = !ended;
+    return ended;
+}
+
+static void client_handle_request(client_server_t *const server, client_t *const client, const char *const request, const average_snapshot_t *const snapshot) {
+    const client_payload_t *payload = NULL;
+    char response[BUFFER_MAX * 3]; // room for ?PERF and ?ADEV
+    average_filter_t filter = server->filter;
+    unsigned int device     = 0;
+    if (strstr(request, "?WATCH")) {
+        const bool enable = (strstr(request, "\"enable\":false") == NULL);
+        filter            = client->filter;
+        device            = client->device;
+        if (!client_request_filter(request, snapshot, &filter))
+            client_format_error_response(response, sizeof(response), "Unknown filter");
+        else if (!client_request_device(server, request, &device))
+            client_format_error_response(response, sizeof(response), "Unknown device");
+        else {
+            client_watch(server, client, enable);
+            client->filter = filter;
+            client->device = device;
+            if (enable)
+                payload = client_payload(&server->tpv[device][filter], client_format_json_response, client_snapshot(server, device, snapshot), filter);
+            else
+                snprintf(response, sizeof(response), "{\"class\":\"WATCH\",\"enable\":false}\r\n");
+        }
+    } else if (strstr(request, "?POLL")) {
+        if (!client_request_filter(request, snapshot, &filter))
+            client_format_error_response(response, sizeof(response), "Unknown filter");
+        else if (!client_request_device(server, request, &device))
+            client_format_error_response(response, sizeof(response), "Unknown device");
+        else
+            payload = client_payload(&server->tpv[device][filter], client_format_json_response, client_snapshot(server, device, snapshot), filter);
+    } else if (strstr(request, "?VERSION"))
+        client_format_version_response(response, sizeof(response));
+    else if (strstr(request, "?STATS")) {
+        if (client_request_device(server, request, &device))
+            payload = client_payload(&server->stats[device], client_format_stats_response, client_snapshot(server, device, snapshot), filter);
+        else
+            client_format_error_response(response, sizeof(response), "Unknown device");
+    } else if (strstr(request, "?DEVICES"))
+        client_format_devices_response(response, sizeof(response), server->devices, server->device_count);
+    else if (strstr(request, "?PERF"))
+        client_format_perf_response(response, sizeof(response), server->gps);
+    else if (strstr(request, "?ADEV")) {
+        if (!client_request_device(server, request, &device))
+            client_format_error_response(response, sizeof(response), "Unknown device");
+        else if (device > 0 || server->device_count == 1)
+            client_format_stability_response(response, sizeof(response), client_snapshot(server, device, snapshot));
+        else { // the fused average has none of its own: a line for each receiver
+            for (unsigned int i = 0; i + 1 < server->device_count; i++) {
+                client_format_stability_response(response, sizeof(response), &server->devices[i]);
+                client_respond(server, client, response, strlen(response));
+                if (client->fd < 0)
+                    return;
+            }
+            client_format_stability_response(response, sizeof(response), &server->devices[server->device_count - 1]);
+        }
+    } else if (strstr(request, "?HISTORY")) {
+        const char *error = "Unknown device";
+        if (client_request_device(server, request, &device) && (error = client_history_begin(client, request, device, client_snapshot(server, device, snapshot))) == NULL)
+            snprintf(response, sizeof(response), "{\"class\":\"HISTORY\",\"device\":\"%s\",\"from\":%lld,\"to\":%lld,\"bucket\":%lld,\"buckets\":[",
+                     (device > 0) ? server->devices[device - 1].device : "averaged", (long long)client->history.from, (long long)client->history.to,
+                     (long long)client->history.bucket);
+        else
+            client_format_error_response(response, sizeof(response), error);
+    } else
+        client_format_error_response(response, sizeof(response), "Unknown request");
+    if (payload != NULL)
+        client_respond(server, client, payload->data, payload->length);
+    else
+        client_respond(server, client, response, strlen(response));
+    if (client->fd >= 0 && client->history.active && !client_history_stream(server, client))
+        client_events(server, client);
+}
+
+// Requests are lines, as in gpsd's protocol; a ';' also ends one, so several may share a line. Those after one
+// whose reply is streaming are left until it has ended.
+static void client_requests(client_server_t *const server, client_t *const client, const average_snapshot_t *const snapshot) {
+    char *begin = client->request, *end;
+    while (client->fd >= 0 && !client->history.active && (end = strpbrk(begin, ";\r\n")) != NULL) {
+        *end = '\0';
+        if (*begin != '\0')
+            client_handle_request(server, client, begin, snapshot);
+        begin = end + 1;
+    }
+    if (client->fd < 0)
+        return;
+    client->request_length = (size_t)(client->request + client->request_length - begin);
+    if (client->request_length >= sizeof(client->request) - 1 && !client->history.active) // a request this long is not one of ours
+        client->request_length = 0;
+    memmove(client->request, begin, client->request_length);
+    client->request[client->request_length] = '\0';
+}
+
+static void client_read(client_server_t *const server, client_t *const client, const average_snapshot_t *const snapshot) {
+    const ssize_t n = recv(client->fd, client->request + client->request_length, sizeof(client->request) - client->request_length - 1, MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        client_close(server, client);
+        return;
+    }
+    if (n < 0)
+        return;
+    client->request_length += (size_t)n;
+    client->request[client->request_length] = '\0';
+    client->requested                       = true;
+    client->active_ms                       = client_now_ms();
+    client_requests(server, client, snapshot);
+}
+
+static void client_accept(client_server_t *const server, const int listen_fd) {
+    int client_fd;
+    while ((client_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        size_t slot = 0;
+        while (slot < CLIENT_MAX && server->clients[slot].fd >= 0)
+            slot++;
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = (uint32_t)slot };
+        if (slot == CLIENT_MAX || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, client_fd, &event) < 0) {
+            server->refused++;
+            close(client_fd);
+            continue;
+        }
+        client_t *const client = &server->clients[slot];
+        client->fd             = client_fd;
+        client->watch = client->requested = false;
+        client->filter                    = server->filter;
+        client->device = client->drops = 0;
+        client->request_length = client->queue_head = client->queue_length = 0;
+        client->history.active = false;
+        client->accepted_ms = client->active_ms = client_now_ms();
+        server->count++;
+        server->accepted++;
+    }
+}
+
+// Pushes the TPV of the snapshot to every watcher of an average that changed (a bit of changed, by device as
+// client_t numbers them), of the filter each watches, applying the slow consumer policy; one in the middle of a
+// ?HISTORY reply is passed over. The first to take one marks the delivery of the fix.
+static void client_broadcast(client_server_t *const server, const average_snapshot_t *const snapshot, const unsigned int changed) {
+    bool delivered = false;
+    for (size_t i = 0, seen = 0; i < CLIENT_MAX && seen < server->watchers; i++) {
+        client_t *const client = &server->clients[i];
+        if (client->fd < 0 || !client->watch)
+            continue;
+        seen++;
+        if (!(changed & (1u << client->device)) || client->history.active)
+            continue;
+        const average_snapshot_t *const watched = client_snapshot(server, client->device, snapshot);
+        const client_payload_t *const payload   = client_payload(&server->tpv[client->device][client->filter], client_format_json_response, watched, client->filter);
+        if (client_queue(server, client, payload->data, payload->length)) {
+            client->drops = 0;
+            if (!delivered && watched->read_ns > 0)
+                perf_record(PERF_STAGE_DELIVER, perf_now_ns() - watched->read_ns);
+            delivered = true;
+        } else {
+            server->dropped++;
+            if (++client->drops >= CLIENT_DROPS_MAX) {
+                server->disconnected_slow++;
+                client_close(server, client);
+            }
+        }
+    }
+}
+
+// Tells every watcher of an average that has relocated (a bit of relocated, as changed numbers them) where it has
+// restarted from and how far it moved, ahead of the TPV of its first fix there; one in the middle of a ?HISTORY
+// reply is passed over.
+static void client_broadcast_relocated(client_server_t *const server, const average_snapshot_t *const snapshot, const unsigned int relocated) {
+    char event[BUFFER_MAX];
+    for (size_t i = 0, seen = 0; i < CLIENT_MAX && seen < server->watchers; i++) {
+        client_t *const client = &server->clients[i];
+        if (client->fd < 0 || !client->watch)
+            continue;
+        seen++;
+        if (!(relocated & (1u << client->device)) || client->history.active)
+            continue;
+        const average_snapshot_t *const watched = client_snapshot(server, client->device, snapshot);
+        const int length                        = snprintf(event, sizeof(event),
+                                                           "{\"class\":\"RELOCATED\",\"device\":\"%s\",\"time\":%ld,\"moved_m\":%.2f,\"relocations\":%lu,"
+                                                           "\"lat\":%.8f,\"lon\":%.8f,\"alt\":%.2f}\r\n",
+                                                           (watched->device != NULL) ? watched->device : "averaged", (long)watched->relocated, watched->relocated_m,
+                                                           watched->relocations, watched->latitude, watched->longitude, watched->altitude);
+        if (!client_queue(server, client, event, (size_t)length))
+            server->dropped++;
+    }
+}
+
+// Answers and closes connections that never made a request, and closes idle ones that are not watching.
+static void client_expire(client_server_t *const server, const average_snapshot_t *const snapshot) {
+    const long long now = client_now_ms();
+    for (size_t i = 0, seen = 0; i < CLIENT_MAX && seen < server->count; i++) {
+        client_t *const client = &server->clients[i];
+        if (client->fd < 0)
+            continue;
+        seen++;
+        if (!client->requested && now - client->accepted_ms >= CLIENT_GREETING_MS) {
+            const client_payload_t *const payload = client_payload(&server->tpv[0][server->filter], client_format_json_response, snapshot, server->filter);
+            send(client->fd, payload->data, payload->length, MSG_NOSIGNAL | MSG_DONTWAIT);
+            client_close(server, client);
+        } else if (!client->watch && client->queue_length == 0 && !client->history.active && now - client->active_ms >= CLIENT_IDLE_TIMEOUT * 1000LL)
+            client_close(server, client);
+    }
+}
+
+static void client_process(client_server_t *const server, const struct epoll_event *const event, const average_snapshot_t *const snapshot) {
+    if (CLIENT_TAG_IS_LISTEN(event->data.u32)) {
+        client_accept(server, server->listen_fds[CLIENT_TAG_LISTEN(0) - event->data.u32]);
+        return;
+    }
+    client_t *const client = &server->clients[event->data.u32];
+    if (client->fd < 0)
+        return; // closed earlier in this batch of events
+    if (event->events & (EPOLLERR | EPOLLHUP)) {
+        client_close(server, client);
+        return;
+    }
+    if ((event->events & EPOLLOUT) && !client_flush(server, client)) {
+        client_close(server, client);
+        return;
+    }
+    if ((event->events & EPOLLOUT) && client->history.active && client_history_stream(server, client)) {
+        client_events(server, client);
+        client_requests(server, client, snapshot);
+        return;
+    }
+    if (event->events & EPOLLIN)
+        client_read(server, client, snapshot);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+// With --metrics-port, an HTTP endpoint serves the state of the average and the serial path in the OpenMetrics
+// text format, for scraping by Prometheus and the like: the counters, window fill, errors, Kalman covariances,
+// convergence as a stateset, fix age, and the stage latencies (see perf_record) as histograms. It is served from
+// the same epoll loop as the clients and, like them, never blocks it: each of a few connections has a response
+// buffer allocated once at startup, the exposition is rendered into it directly, and whatever the socket will not
+// take at once is sent on EPOLLOUT. A connection is closed once answered, or if it has not been within the timeout.
+
+#define METRICS_CONNECTIONS_MAX 4
+#define METRICS_REQUEST_MAX 1024
+#define METRICS_HEADER_MAX 256   // room reserved ahead of the body for the HTTP header, written once its length is known
+#define METRICS_RESPONSE_MAX 32768
+#define METRICS_TIMEOUT_MS 5000
+#define METRICS_BOUND_FIRST 10   // latency histogram bounds are the powers of two from 2^10ns (~1us)
+#define METRICS_BOUND_LAST 34    // to 2^34ns (~17s), which are also bucket edges of the underlying histogram
+
+// epoll_event data: the listener is index 0, connections 1 to METRICS_CONNECTIONS_MAX
+#define CLIENT_TAG_METRICS(index) (CLIENT_TAG_LISTEN(CLIENT_LISTEN_MAX) - (uint32_t)(index))
+#define CLIENT_TAG_IS_METRICS(tag) ((tag) <= CLIENT_TAG_METRICS(0) && (tag) >= CLIENT_TAG_METRICS(METRICS_CONNECTIONS_MAX))
+
+typedef struct {
+    int fd;
+    long long accepted_ms;
+    char request[METRICS_REQUEST_MAX];
+    size_t request_length;
+    char *response;              // METRICS_RESPONSE_MAX
+    size_t response_head, response_length; // unsent part
+} metrics_connection_t;
+
+typedef struct {
+    int listen_fd, epoll_fd;
+    metrics_connection_t connections[METRICS_CONNECTIONS_MAX];
+    unsigned long scrapes;
+    const average_snapshot_t *devices; // each receiver's average as of the snapshot being served
+    unsigned int device_count;
+} metrics_server_t;
+
+// The exposition is appended to a fixed buffer; anything that does not fit marks it truncated rather than failing
+// part way, and the scrape is answered with an error.
+typedef struct {
+    char *data;
+    size_t capacity, length;
+    bool truncated;
+} metrics_buffer_t;
+
+static void metrics_printf(metrics_buffer_t *const b, const char *const format, ...) __attribute__((format(printf, 2, 3)));
+static void metrics_printf(metrics_buffer_t *const b, const char *const format, ...) {
+    if (b->truncated)
+        return;
+    va_list args;
+    va_start(args, format);
+    const int n = vsnprintf(b->data + b->length, b->capacity - b->length, format, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= b->capacity - b->length)
+        b->truncated = true;
+    else
+        b->length += (size_t)n;
+}
+
+static void metrics_family(metrics_buffer_t *const b, const char *const name, const char *const type, const char *const unit, const char *const help) {
+    metrics_printf(b, "# TYPE gpsd_averaged_%s %s\n", name, type);
+    if (unit != NULL)
+        metrics_printf(b, "# UNIT gpsd_averaged_%s %s\n", name, unit);
+    metrics_printf(b, "# HELP gpsd_averaged_%s %s\n", name, help);
 }
 
-static void gps_process(struct gps_data_t *const gps_handle, average_state_t *const state) {
-#if GPSD_API_MAJOR_VERSION < 7
-    if (gps_read(gps_handle) > 0)
-#else
-    if (gps_read(gps_handle, NULL, 0) > 0)
-#endif
-        if (gps_handle->set & MODE_SET && gps_handle->fix.mode >= MODE_2D)
-            gps_process_fix(gps_handle, state);
+static void metrics_axes(metrics_buffer_t *const b, const char *const name, const double lat, const double lon, const double alt) {
+    metrics_printf(b, "gpsd_averaged_%s{axis=\"lat\"} %.9g\ngpsd_averaged_%s{axis=\"lon\"} %.9g\ngpsd_averaged_%s{axis=\"alt\"} %.9g\n", name, lat, name, lon, name, alt);
 }
 
-// ------------------------------------------------------------------------------------------------------------------------
-// ------------------------------------------------------------------------------------------------------------------------
+// Each receiver's own average, labelled by its path, alongside the fused average above.
+static void metrics_render_devices(metrics_buffer_t *const b, const average_snapshot_t *const devices, const unsigned int count) {
+    metrics_family(b, "device_samples", "gauge", NULL, "Fixes accepted into each receiver's own average.");
+    for (unsigned int i = 0; i < count; i++)
+        metrics_printf(b, "gpsd_averaged_device_samples{device=\"%s\"} %lu\n", devices[i].device, devices[i].count);
+    metrics_family(b, "device_outliers_rejected", "counter", NULL, "Fixes rejected as outliers from each receiver's own average.");
+    for (unsigned int i = 0; i < count; i++)
+        metrics_printf(b, "gpsd_averaged_device_outliers_rejected_total{device=\"%s\"} %lu\n", devices[i].device, devices[i].outliers_rejected);
+    metrics_family(b, "device_relocations", "counter", NULL, "Moves of each receiver's antenna detected, each restarting its own average.");
+    for (unsigned int i = 0; i < count; i++)
+        metrics_printf(b, "gpsd_averaged_device_relocations_total{device=\"%s\"} %lu\n", devices[i].device, devices[i].relocations);
+    metrics_family(b, "device_confidence_meters", "gauge", "meters", "Horizontal radius at two standard deviations of each receiver's own average.");
+    for (unsigned int i = 0; i < count; i++)
+        metrics_printf(b, "gpsd_averaged_device_confidence_meters{device=\"%s\"} %.9g\n", devices[i].device, devices[i].confidence_m);
+}
 
-static void client_format_error_response(char *const buf, const size_t buflen, const char *const message) {
-    snprintf(buf, buflen, "{\"class\":\"ERROR\",\"message\":\"%s\"}\r\n", message);
+static void metrics_render(metrics_buffer_t *const b, const average_snapshot_t *const snapshot, const gps_stats_t *const gps, const average_snapshot_t *const devices,
+                           const unsigned int device_count) {
+    metrics_family(b, "fixes_received", "counter", NULL, "Fixes received from the device.");
+    metrics_printf(b, "gpsd_averaged_fixes_received_total %lu\n", snapshot->received_fixes);
+    metrics_family(b, "fixes_rejected", "counter", NULL, "Fixes rejected for too few satellites, too high HDOP or no position.");
+    metrics_printf(b, "gpsd_averaged_fixes_rejected_total %lu\n", snapshot->rejected_fixes);
+    metrics_family(b, "outliers_rejected", "counter", NULL, "Fixes rejected as outliers from the average.");
+    metrics_printf(b, "gpsd_averaged_outliers_rejected_total %lu\n", snapshot->outliers_rejected);
+    metrics_family(b, "relocations", "counter", NULL, "Moves of the antenna detected, each restarting the average from the new site.");
+    metrics_printf(b, "gpsd_averaged_relocations_total %lu\n", snapshot->relocations);
+    metrics_family(b, "samples", "gauge", NULL, "Fixes accepted into the average.");
+    metrics_printf(b, "gpsd_averaged_samples %lu\n", snapshot->count);
+    metrics_family(b, "window_samples", "gauge", NULL, "Samples held in the averaging window.");
+    metrics_printf(b, "gpsd_averaged_window_samples %zu\n", snapshot->window);
+
+    metrics_family(b, "stddev_meters", "gauge", "meters", "Standard deviation of the samples in the window, per axis.");
+    metrics_axes(b, "stddev_meters", snapshot->lat_error_m, snapshot->lon_error_m, sqrt(snapshot->altitude_var));
+    metrics_family(b, "confidence_meters", "gauge", "meters", "Horizontal radius at two standard deviations.");
+    metrics_printf(b, "gpsd_averaged_confidence_meters %.9g\n", snapshot->confidence_m);
+    if (snapshot->filters & AVERAGE_FILTER_BIT(AVERAGE_FILTER_SIMPLE)) {
+        const average_output_t *const output = &snapshot->outputs[AVERAGE_FILTER_SIMPLE];
+        metrics_family(b, "standard_error_meters", "gauge", "meters", "Standard error of the cumulative mean (the simple filter), per axis.");
+        metrics_axes(b, "standard_error_meters", output->lat_error_m, output->lon_error_m, output->alt_error_m);
+    }
+    if (snapshot->filters & AVERAGE_FILTER_BIT(AVERAGE_FILTER_MEDIAN)) {
+        const average_output_t *const output = &snapshot->outputs[AVERAGE_FILTER_MEDIAN];
+        metrics_family(b, "median_mad_meters", "gauge", "meters", "Median absolute deviation of the samples about the median (the median filter), per axis.");
+        metrics_axes(b, "median_mad_meters", output->lat_error_m / MEDIAN_MAD_SIGMA, output->lon_error_m / MEDIAN_MAD_SIGMA, output->alt_error_m / MEDIAN_MAD_SIGMA);
+    }
+    if (snapshot->filters & AVERAGE_FILTER_BIT(AVERAGE_FILTER_KALMAN)) {
+        metrics_family(b, "kalman_stddev_meters", "gauge", "meters", "Standard deviation of the Kalman estimate, per axis.");
+        metrics_axes(b, "kalman_stddev_meters", sqrt(snapshot->kalman_north_var), sqrt(snapshot->kalman_east_var), sqrt(snapshot->kalman_up_var));
+    }
+
+    metrics_family(b, "convergence", "stateset", NULL, "Convergence state of the average.");
+    for (unsigned int i = 0; i < sizeof(convergence_str) / sizeof(convergence_str[0]); i++)
+        metrics_printf(b, "gpsd_averaged_convergence{gpsd_averaged_convergence=\"%s\"} %d\n", convergence_str[i], snapshot->convergence == (gpsd_averaged_convergence_t)i);
+    metrics_family(b, "fix_age_seconds", "gauge", "seconds", "Time since the last fix accepted into the average.");
+    if (snapshot->count > 0)
+        metrics_printf(b, "gpsd_averaged_fix_age_seconds %ld\n", (long)(average_clock(snapshot->clock_offset) - snapshot->last_fix));
+    metrics_render_devices(b, devices, device_count);
+
+    metrics_family(b, "device_reads", "counter", NULL, "Read syscalls on the device.");
+    metrics_printf(b, "gpsd_averaged_device_reads_total %lu\n", gps->reads);
+    metrics_family(b, "device_read_bytes", "counter", "bytes", "Bytes read from the device.");
+    metrics_printf(b, "gpsd_averaged_device_read_bytes_total %lu\n", gps->bytes);
+    metrics_family(b, "lines_dropped", "counter", NULL, "Lines from the device dropped, by reason.");
+    metrics_printf(b, "gpsd_averaged_lines_dropped_total{reason=\"checksum\"} %lu\ngpsd_averaged_lines_dropped_total{reason=\"overlong\"} %lu\n", gps->checksum_errors,
+                   gps->overlong);
+    metrics_family(b, "cno_dbhz", "gauge", "dbhz", "Mean C/N0 of the satellites tracked in the last skyview, per constellation.");
+    for (unsigned int constellation = 0; constellation < GPS_CONSTELLATIONS; constellation++)
+        if (gps->cno_satellites[constellation] > 0)
+            metrics_printf(b, "gpsd_averaged_cno_dbhz{constellation=\"%s\"} %.9g\n", gps_constellation_str[constellation], gps->cno_mean[constellation]);
+    metrics_family(b, "backlog_epochs", "gauge", NULL, "Epochs found waiting at the last wakeup beyond the one that caused it.");
+    metrics_printf(b, "gpsd_averaged_backlog_epochs %u\n", gps->backlog);
+    metrics_family(b, "stalls", "counter", NULL, "Publications that took longer than the stall threshold.");
+    metrics_printf(b, "gpsd_averaged_stalls_total %lu\n", gps->stalls);
+    metrics_family(b, "journal_records", "counter", NULL, "Fixes written to the journal, and dropped for want of a segment ready to take them.");
+    metrics_printf(b, "gpsd_averaged_journal_records_total{result=\"written\"} %lu\ngpsd_averaged_journal_records_total{result=\"dropped\"} %lu\n", gps->journalled,
+                   gps->journal_dropped);
+
+    metrics_family(b, "latency_seconds", "histogram", "seconds", "Time from the device being found readable to each stage for a fix.");
+    for (unsigned int stage = 0; stage < PERF_STAGES; stage++) {
+        uint32_t counts[PERF_BUCKETS];
+        uint64_t sum_ns, max_ns, cumulative = 0;
+        const uint64_t total = perf_copy((perf_stage_t)stage, counts, &sum_ns, &max_ns);
+        unsigned int bucket  = 0;
+        for (unsigned int bound = METRICS_BOUND_FIRST; bound <= METRICS_BOUND_LAST; bound++) {
+            for (const unsigned int end = perf_bucket((uint64_t)1 << bound); bucket < end; bucket++)
+                cumulative += counts[bucket];
+            metrics_printf(b, "gpsd_averaged_latency_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n", perf_stage_str[stage], (double)((uint64_t)1 << bound) / 1e9,
+                           (unsigned long long)cumulative);
+        }
+        metrics_printf(b, "gpsd_averaged_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", perf_stage_str[stage], (unsigned long long)total);
+        metrics_printf(b, "gpsd_averaged_latency_seconds_count{stage=\"%s\"} %llu\n", perf_stage_str[stage], (unsigned long long)total);
+        metrics_printf(b, "gpsd_averaged_latency_seconds_sum{stage=\"%s\"} %.9g\n", perf_stage_str[stage], (double)sum_ns / 1e9);
+    }
+    metrics_printf(b, "# EOF\n");
 }
 
-static void client_format_version_response(char *const buf, const size_t buflen) { snprintf(buf, buflen, "{\"class\":\"VERSION\",\"release\":\"gpsd_averaged 1.0\"}\r\n"); }
+static bool metrics_start(metrics_server_t *const metrics, const unsigned short port, const bool listenany) {
+    *metrics = (metrics_server_t){ .listen_fd = -1, .epoll_fd = -1 };
+    for (size_t i = 0; i < METRICS_CONNECTIONS_MAX; i++)
+        metrics->connections[i].fd = -1;
+    if (port == 0)
+        return true;
+    for (size_t i = 0; i < METRICS_CONNECTIONS_MAX; i++)
+        if ((metrics->connections[i].response = malloc(METRICS_RESPONSE_MAX)) == NULL) {
+            perror("malloc");
+            return false;
+        }
+    return (metrics->listen_fd = client_listen_inet(port, listenany)) >= 0;
+}
 
-static void client_format_stats_response(char *const buf, const size_t buflen, const average_state_t *const state) {
-    if (state->count > 0)
-        snprintf(buf, buflen,
-                 "{\"class\":\"STATS\","
-                 "\"samples\":%lu,\"rejected\":%lu,"
-                 "\"first_fix\":%ld,\"last_fix\":%ld,"
-                 "\"lat_stddev\":%.6f,\"lon_stddev\":%.6f,\"alt_stddev\":%.2f}\r\n",
-                 state->count, state->rejected_fixes, state->first_fix, state->last_fix, sqrt(state->latitude_var), sqrt(state->longitude_var), sqrt(state->altitude_var));
-    else
-        client_format_error_response(buf, buflen, "No statistics available");
+static void metrics_close(metrics_connection_t *const connection) {
+    close(connection->fd); // also removes it from the epoll set
+    connection->fd = -1;
 }
 
-static void client_format_json_response(char *const buf, const size_t buflen, const average_state_t *const state) {
-    if (state->count > 0) {
-        const double lat = (state->filter == AVERAGE_FILTER_KALMAN) ? state->kalman_lat.estimate : state->latitude,
-                     lon = (state->filter == AVERAGE_FILTER_KALMAN) ? state->kalman_lon.estimate : state->longitude,
-                     alt = (state->filter == AVERAGE_FILTER_KALMAN) ? state->kalman_alt.estimate : state->altitude;
-        snprintf(buf, buflen,
-                 "{\"class\":\"TPV\",\"device\":\"averaged\",\"mode\":3,"
-                 "\"lat\":%.8f,\"lon\":%.8f,\"alt\":%.2f,"
-                 "\"samples\":%lu,\"window\":%d,\"outliers\":%lu,"
-                 "\"lat_err\":%.2f,\"lon_err\":%.2f,\"alt_err\":%.2f,\"age\":%ld}\r\n",
-                 lat, lon, alt, state->count, state->window.size, state->outliers_rejected, sqrt(state->latitude_var) * 111320.0,
-                 sqrt(state->longitude_var) * 111320.0 * cos(lat * M_PI / 180.0), sqrt(state->altitude_var), time(NULL) - state->last_fix);
-    } else
-        client_format_error_response(buf, buflen, "No positions available");
+static void metrics_stop(metrics_server_t *const metrics) {
+    for (size_t i = 0; i < METRICS_CONNECTIONS_MAX; i++) {
+        if (metrics->connections[i].fd >= 0)
+            metrics_close(&metrics->connections[i]);
+        free(metrics->connections[i].response);
+    }
+    if (metrics->listen_fd >= 0)
+        close(metrics->listen_fd);
 }
 
-static bool client_start(int *const client_listen_fd, const unsigned short port, const bool listenany) {
-    if ((*client_listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("socket");
+// Joins the serve loop's epoll set, if there is a port to serve.
+static bool metrics_attach(metrics_server_t *const metrics, const int epoll_fd) {
+    metrics->epoll_fd = epoll_fd;
+    if (metrics->listen_fd < 0)
+        return true;
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = CLIENT_TAG_METRICS(0) };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, metrics->listen_fd, &event) < 0) {
+        perror("epoll_ctl");
         return false;
     }
+    return true;
+}
 
-    const int yes = 1;
-    setsockopt(*client_listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+static void metrics_accept(metrics_server_t *const metrics) {
+    int fd;
+    while ((fd = accept4(metrics->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        size_t slot = 0;
+        while (slot < METRICS_CONNECTIONS_MAX && metrics->connections[slot].fd >= 0)
+            slot++;
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = CLIENT_TAG_METRICS(slot + 1) };
+        if (slot == METRICS_CONNECTIONS_MAX || epoll_ctl(metrics->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            continue;
+        }
+        metrics_connection_t *const connection = &metrics->connections[slot];
+        connection->fd                         = fd;
+        connection->accepted_ms                = client_now_ms();
+        connection->request_length = connection->response_head = connection->response_length = 0;
+    }
+}
 
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family      = AF_INET;
-    addr.sin_addr.s_addr = htonl(listenany ? INADDR_ANY : INADDR_LOOPBACK);
-    addr.sin_port        = htons(port);
+// Sends what the socket will take; true once all is sent.
+static bool metrics_flush(metrics_server_t *const metrics, metrics_connection_t *const connection) {
+    while (connection->response_length > 0) {
+        const ssize_t n = send(connection->fd, connection->response + connection->response_head, connection->response_length, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR)
+                return true; // gone: nothing more to send
+            struct epoll_event event = { .events = EPOLLOUT, .data.u32 = CLIENT_TAG_METRICS((size_t)(connection - metrics->connections) + 1) };
+            epoll_ctl(metrics->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+            return false;
+        }
+        connection->response_head += (size_t)n;
+        connection->response_length -= (size_t)n;
+    }
+    return true;
+}
 
-    if (bind(*client_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        close(*client_listen_fd);
-        return false;
+static void metrics_respond(const metrics_server_t *const metrics, metrics_connection_t *const connection, const average_snapshot_t *const snapshot, const gps_stats_t *const gps) {
+    const bool get = (strncmp(connection->request, "GET ", 4) == 0);
+    metrics_buffer_t body = { .data = connection->response + METRICS_HEADER_MAX, .capacity = METRICS_RESPONSE_MAX - METRICS_HEADER_MAX };
+    if (get)
+        metrics_render(&body, snapshot, gps, metrics->devices, metrics->device_count);
+    const char *const status = !get ? "405 Method Not Allowed" : body.truncated ? "500 Internal Server Error" : "200 OK";
+    if (!get || body.truncated)
+        body.length = 0;
+    char header[METRICS_HEADER_MAX];
+    const int n = snprintf(header, sizeof(header),
+                           "HTTP/1.1 %s\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                           status, body.length);
+    const size_t header_length = (n > 0 && (size_t)n < sizeof(header)) ? (size_t)n : 0;
+    connection->response_head   = METRICS_HEADER_MAX - header_length;
+    connection->response_length = header_length + body.length;
+    memcpy(connection->response + connection->response_head, header, header_length);
+}
+
+static void metrics_read(metrics_server_t *const metrics, metrics_connection_t *const connection, const average_snapshot_t *const snapshot, const gps_stats_t *const gps) {
+    const ssize_t n = recv(connection->fd, connection->request + connection->request_length, sizeof(connection->request) - connection->request_length - 1, MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        metrics_close(connection);
+        return;
+    }
+    if (n < 0)
+        return;
+    connection->request_length += (size_t)n;
+    connection->request[connection->request_length] = '\0';
+    if (strstr(connection->request, "\r\n\r\n") == NULL && strstr(connection->request, "\n\n") == NULL) {
+        if (connection->request_length >= sizeof(connection->request) - 1) // no end to the headers that will fit: not a scrape
+            metrics_close(connection);
+        return;
     }
+    metrics->scrapes++;
+    metrics_respond(metrics, connection, snapshot, gps);
+    if (metrics_flush(metrics, connection))
+        metrics_close(connection);
+}
 
-    if (listen(*client_listen_fd, 5) < 0) {
-        perror("listen");
-        close(*client_listen_fd);
-        return false;
+static void metrics_process(metrics_server_t *const metrics, const struct epoll_event *const event, const average_snapshot_t *const snapshot, const gps_stats_t *const gps) {
+    const uint32_t index = CLIENT_TAG_METRICS(0) - event->data.u32;
+    if (index == 0) {
+        metrics_accept(metrics);
+        return;
     }
+    metrics_connection_t *const connection = &metrics->connections[index - 1];
+    if (connection->fd < 0)
+        return;
+    if (event->events & (EPOLLERR | EPOLLHUP))
+        metrics_close(connection);
+    else if (event->events & EPOLLOUT) {
+        if (metrics_flush(metrics, connection))
+            metrics_close(connection);
+    } else if (event->events & EPOLLIN)
+        metrics_read(metrics, connection, snapshot, gps);
+}
+
+static void metrics_expire(metrics_server_t *const metrics) {
+    const long long now = client_now_ms();
+    for (size_t i = 0; i < METRICS_CONNECTIONS_MAX; i++)
+        if (metrics->connections[i].fd >= 0 && now - metrics->connections[i].accepted_ms >= METRICS_TIMEOUT_MS)
+            metrics_close(&metrics->connections[i]);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
 
-    fcntl(*client_listen_fd, F_SETFL, fcntl(*client_listen_fd, F_GETFL, 0) | O_NONBLOCK);
+// --shm publishes the position to a shared-memory record (gpsd_averaged_shm.h) after each wakeup that accepted a
+// fix, for local readers that want it without a socket. Writing is a handful of stores between two sequence
+// increments; readers retry rather than lock, so nothing they do can delay the daemon.
 
+typedef struct {
+    gpsd_averaged_shm_t *record;
+    const char *name;
+} shm_publisher_t;
+
+static bool shm_begin(shm_publisher_t *const shm, const char *const name) {
+    *shm = (shm_publisher_t){ 0 };
+    if (name == NULL)
+        return true;
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("shm_open");
+        return false;
+    }
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, sizeof(gpsd_averaged_shm_t)) < 0)
+        perror("ftruncate");
+    else if ((map = mmap(NULL, sizeof(gpsd_averaged_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        perror("mmap");
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(name);
+        return false;
+    }
+    shm->record = (gpsd_averaged_shm_t *)map;
+    shm->name   = name;
+    memset(&shm->record->position, 0, sizeof(shm->record->position));
+    shm->record->size     = sizeof(gpsd_averaged_shm_t);
+    shm->record->version  = GPSD_AVERAGED_SHM_VERSION;
+    shm->record->sequence = 0;
+    __atomic_store_n(&shm->record->magic, GPSD_AVERAGED_SHM_MAGIC, __ATOMIC_RELEASE);
     return true;
 }
 
-static void client_stop(int *const client_listen_fd) {
-    if (*client_listen_fd >= 0) {
-        close(*client_listen_fd);
-        *client_listen_fd = -1;
-    }
+static void shm_write(gpsd_averaged_shm_t *const record, const gpsd_averaged_position_t *const position) {
+    const uint32_t sequence = record->sequence;
+    __atomic_store_n(&record->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->position = *position;
+    __atomic_store_n(&record->sequence, sequence + 2, __ATOMIC_RELEASE);
 }
 
-static void client_handle(const int client_fd, const average_state_t *const state) {
-    char request[BUFFER_MAX], response[BUFFER_MAX];
-    const ssize_t n = recv(client_fd, request, sizeof(request) - 1, MSG_DONTWAIT);
-    if (n > 0) {
-        request[n] = '\0';
-        if (strstr(request, "?WATCH") || strstr(request, "?POLL"))
-            client_format_json_response(response, sizeof(response), state);
-        else if (strstr(request, "?VERSION"))
-            client_format_version_response(response, sizeof(response));
-        else if (strstr(request, "?STATS"))
-            client_format_stats_response(response, sizeof(response), state);
-        else
-            client_format_error_response(response, sizeof(response), "Unknown request");
-    } else
-        client_format_json_response(response, sizeof(response), state);
-    send(client_fd, response, strlen(response), MSG_NOSIGNAL);
-    close(client_fd);
+static void shm_publish(const shm_publisher_t *const shm, const average_snapshot_t *const snapshot) {
+    if (shm->record == NULL || snapshot->count == 0)
+        return;
+    const average_output_t *const output    = &snapshot->outputs[snapshot->filter];
+    const gpsd_averaged_position_t position = {
+        .lat         = snapshot->latitude,
+        .lon         = snapshot->longitude,
+        .alt         = snapshot->altitude,
+        .lat_err     = output->lat_error_m,
+        .lon_err     = output->lon_error_m,
+        .alt_err     = output->alt_error_m,
+        .confidence  = snapshot->confidence_m,
+        .fix_time    = (int64_t)snapshot->last_fix,
+        .first_fix   = (int64_t)snapshot->first_fix,
+        .samples     = snapshot->count,
+        .outliers    = snapshot->outliers_rejected,
+        .window      = (uint32_t)snapshot->window,
+        .convergence = (uint32_t)snapshot->convergence,
+        .filter      = (uint32_t)snapshot->filter,
+        .anchored    = snapshot->anchored ? 1 : 0,
+    };
+    shm_write(shm->record, &position);
 }
 
-static void client_process(const int *const client_listen_fd, const average_state_t *const state) {
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    const int client_fd  = accept(*client_listen_fd, (struct sockaddr *)&client_addr, &client_len);
-    if (client_fd >= 0)
-        client_handle(client_fd, state);
+// Readers that stay mapped see a record with no samples; new readers find no object.
+static void shm_end(shm_publisher_t *const shm) {
+    if (shm->record == NULL)
+        return;
+    const gpsd_averaged_position_t position = { 0 };
+    shm_write(shm->record, &position);
+    munmap(shm->record, sizeof(gpsd_averaged_shm_t));
+    shm_unlink(shm->name);
+    shm->record = NULL;
 }
 
 // ------------------------------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------------------------------
 
+// The serial path has a thread of its own (process_ingest) for each receiver, which alone owns that device and
+// its average. After each wakeup that changed the average it publishes a snapshot through a seqlock and signals an
+// eventfd; it takes no lock, waits on no reader, and writes to no client and not to stdout. Serving (process_serve,
+// the main thread) and status reporting (process_report) work only from snapshots, so a slow send, a burst of
+// connections or a blocked journal delays only themselves. Each publication is timed, and one that took longer than
+// PROCESS_STALL_NS counts as a stall: that count staying at zero under client load is the evidence that the serial
+// path never waits.
+//
+// With several receivers (--device given more than once) each thread publishes its own snapshot and signals the
+// combiner (process_combine) instead, which fuses the latest of them all (average_fuse) into the snapshot that is
+// served and published, as the only receiver's would be. A receiver that stops sending delays only its own
+// average: the fused one goes on with its last snapshot and the others' new ones.
+
+typedef struct {
+    uint32_t sequence; // seqlock, odd while a snapshot is being written
+    average_snapshot_t average;
+    gps_stats_t gps;
+} process_snapshot_t;
+
+typedef struct {
+    const char *path;
+    const char *name; // in its snapshots: the path, or NULL when it is the only receiver, and so the average
+    struct gps_data_t gps_handle;
+    average_state_t average_state;
+    gps_stats_t gps_stats;
+    checkpoint_t checkpoint;
+    char checkpoint_path[PATH_MAX];
+    journal_t journal;
+    history_t history;
+    process_snapshot_t published;  // its own, when there are several to combine
+    process_snapshot_t *publish;   // where it publishes: its own, or the process's when it is the only receiver
+    const shm_publisher_t *shm;    // the only receiver publishes there; otherwise the combiner does
+    int notify_fd, stop_fd;        // the combiner's eventfd, or the server's when it is the only receiver
+    pthread_t thread;
+} process_device_t;
+
+typedef struct {
+    process_device_t *devices;
+    unsigned int device_count;
+    const shm_publisher_t *shm;
+    client_server_t *server;
+    metrics_server_t *metrics;
+    time_t interval_status;
+    int notify_fd, combine_fd, stop_fd;
+    process_snapshot_t published;
+    unsigned long retries; // snapshot copies torn by a concurrent publication, and taken again
+} process_t;
+
 static volatile bool process_running = true;
 
 static void process_signal(const int sig __attribute__((unused))) { process_running = false; }
 
-static void process_status(const average_state_t *const average_state) {
-    if (average_state->count == 0) {
-        printf("status: no fixes\n");
-        fflush(stdout);
+static void process_publish(process_snapshot_t *const published, const average_snapshot_t *const average, const gps_stats_t *const gps) {
+    const uint32_t sequence = published->sequence;
+    __atomic_store_n(&published->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    published->average = *average;
+    published->gps     = *gps;
+    __atomic_store_n(&published->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+static void process_read(const process_snapshot_t *const published, average_snapshot_t *const average, gps_stats_t *const gps, unsigned long *const retries_total) {
+    for (unsigned long retries = 0;; retries++) {
+        const uint32_t sequence = __atomic_load_n(&published->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1)
+            continue;
+        *average = published->average;
+        *gps     = published->gps;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&published->sequence, __ATOMIC_RELAXED) == sequence) {
+            if (retries > 0)
+                __atomic_fetch_add(retries_total, retries, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+static void process_snapshot(process_t *const process, average_snapshot_t *const average, gps_stats_t *const gps) {
+    process_read(&process->published, average, gps, &process->retries);
+}
+
+// Each receiver's snapshot, as published by its own thread; the only receiver's is the average itself.
+static void process_snapshot_devices(process_t *const process, const average_snapshot_t *const average, average_snapshot_t *const devices, gps_stats_t *const gps) {
+    if (process->device_count == 1) {
+        devices[0]        = *average;
+        devices[0].device = process->devices[0].path;
         return;
     }
+    for (unsigned int i = 0; i < process->device_count; i++)
+        process_read(&process->devices[i].published, &devices[i], &gps[i], &process->retries);
+}
+
+// Fuses the receivers' latest snapshots into the process's, and publishes it.
+static void process_fuse(process_t *const process, average_snapshot_t *const snapshot) {
+    average_snapshot_t devices[DEVICES_MAX];
+    gps_stats_t gps[DEVICES_MAX], fused;
+    process_snapshot_devices(process, snapshot, devices, gps);
+    average_fuse(devices, process->device_count, snapshot);
+    snapshot->version++;
+    gps_stats_fuse(gps, process->device_count, &fused);
+    process_publish(&process->published, snapshot, &fused);
+}
+
+static void *process_ingest(void *const arg) {
+    process_device_t *const device = (process_device_t *)arg;
+    average_state_t *const state   = &device->average_state;
+    gps_stats_t *const gps_stats   = &device->gps_stats;
+    average_snapshot_t snapshot    = { 0 };
+    const uint64_t notify          = 1;
+    struct pollfd fds[2]           = { { .fd = (int)device->gps_handle.gps_fd, .events = POLLIN }, { .fd = device->stop_fd, .events = POLLIN } };
+
+    for (;;) {
+        const int n = poll(fds, 2, (fds[0].fd >= 0 && gps_pending(&device->gps_handle)) ? 0 : -1); // a backlog left by the drain bound is not signalled by the fd
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if (fds[1].revents != 0)
+            break;
+
+        const long long read_ns      = perf_now_ns();
+        const unsigned long received = state->received_fixes;
+        const unsigned int accepted  = gps_process(&device->gps_handle, state, &device->journal, &device->history, gps_stats, read_ns);
+        if (fds[0].fd >= 0 && gps_ended(&device->gps_handle)) {
+            fprintf(stderr, "%s: end of input, serving the average as it stands\n", device->path);
+            fds[0].fd = -1; // poll() ignores it from here, and waits only for the stop
+        }
+        if (accepted == 0 && state->received_fixes == received)
+            continue;
+
+        const long long begin = perf_now_ns();
+        average_snapshot(state, &snapshot);
+        snapshot.version++;
+        snapshot.read_ns = read_ns;
+        snapshot.device  = device->name;
+        process_publish(device->publish, &snapshot, gps_stats);
+        if (accepted > 0 && device->shm != NULL)
+            shm_publish(device->shm, &snapshot);
+        checkpoint_t *const cp = &device->checkpoint;
+        if (cp->path != NULL && !__atomic_load_n(&cp->pending, __ATOMIC_ACQUIRE) && interval_passed(&cp->last, CHECKPOINT_INTERVAL) && checkpoint_save(cp, state))
+            __atomic_store_n(&cp->pending, 1, __ATOMIC_RELEASE);
+        if (write(device->notify_fd, &notify, sizeof(notify)) < 0 && errno != EAGAIN) // non-blocking, and a full counter is already signalled
+            perror("write");
+        const long long end = perf_now_ns(), elapsed = end - begin;
+        perf_record(PERF_STAGE_PUBLISH, end - read_ns);
+        gps_stats->published++;
+        if (elapsed > gps_stats->publish_ns_max)
+            gps_stats->publish_ns_max = elapsed;
+        if (elapsed > PROCESS_STALL_NS)
+            gps_stats->stalls++;
+    }
+    return NULL;
+}
 
-    double lat, lon, alt;
-    double uncertainty_m;
-    double lat_unc_m, lon_unc_m, alt_unc_m;
+// With several receivers, fuses and publishes their snapshots whenever any of them has published, as many
+// publications as arrived meanwhile being taken in one.
+static void *process_combine(void *const arg) {
+    process_t *const process    = (process_t *)arg;
+    average_snapshot_t snapshot = { 0 };
+    gps_stats_t gps;
+    const uint64_t notify = 1;
+    struct pollfd fds[2]  = { { .fd = process->combine_fd, .events = POLLIN }, { .fd = process->stop_fd, .events = POLLIN } };
 
-    switch (average_state->filter) {
-    case AVERAGE_FILTER_KALMAN:
-        lat           = average_state->kalman_lat.estimate;
-        lon           = average_state->kalman_lon.estimate;
-        alt           = average_state->kalman_alt.estimate;
-        lat_unc_m     = sqrt(average_state->kalman_lat.error_covariance) * 111320.0;
-        lon_unc_m     = sqrt(average_state->kalman_lon.error_covariance) * 111320.0 * cos(lat * M_PI / 180.0);
-        alt_unc_m     = sqrt(average_state->kalman_alt.error_covariance);
-        uncertainty_m = sqrt(lat_unc_m * lat_unc_m + lon_unc_m * lon_unc_m + alt_unc_m * alt_unc_m);
-        break;
-    case AVERAGE_FILTER_WINDOW:
-    case AVERAGE_FILTER_SIMPLE:
-    default:
-        lat           = average_state->latitude;
-        lon           = average_state->longitude;
-        alt           = average_state->altitude;
-        uncertainty_m = 0;
-        break;
+    process_snapshot(process, &snapshot, &gps); // as published at startup, to continue its version
+    for (;;) {
+        const int n = poll(fds, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if (fds[1].revents != 0)
+            break;
+        uint64_t combined;
+        if (read(process->combine_fd, &combined, sizeof(combined)) != sizeof(combined))
+            continue;
+
+        const unsigned long count = snapshot.count;
+        process_fuse(process, &snapshot);
+        if (snapshot.count != count)
+            shm_publish(process->shm, &snapshot);
+        if (write(process->notify_fd, &notify, sizeof(notify)) < 0 && errno != EAGAIN)
+            perror("write");
+    }
+    return NULL;
+}
+
+static void process_status(const average_snapshot_t *const snapshot, const gps_stats_t *const gps, const unsigned long retries) {
+    if (snapshot->device != NULL)
+        printf("status[%s]: ", snapshot->device);
+    else
+        printf("status: ");
+    if (snapshot->count == 0) {
+        printf("no fixes\n");
+        fflush(stdout);
+        return;
     }
 
-    const double lat_stddev = sqrt(average_state->latitude_var), lon_stddev = sqrt(average_state->longitude_var), alt_stddev = sqrt(average_state->altitude_var);
-    const double lat_error_m = lat_stddev * 111320.0, lon_error_m = lon_stddev * 111320.0 * cos(lat * M_PI / 180.0);
-    const double confidence_radius_m = 2.0 * sqrt(lat_error_m * lat_error_m + lon_error_m * lon_error_m);
-    const double movement_3d         = sqrt(average_state->pos_change_m * average_state->pos_change_m + average_state->alt_change_m * average_state->alt_change_m);
+    const double lat = snapshot->latitude, lon = snapshot->longitude, alt = snapshot->altitude;
+    const double uncertainty_m = sqrt(snapshot->kalman_east_var + snapshot->kalman_north_var + snapshot->kalman_up_var);
+
+    const double alt_stddev  = sqrt(snapshot->altitude_var);
+    const double movement_3d = sqrt(snapshot->pos_change_m * snapshot->pos_change_m + snapshot->alt_change_m * snapshot->alt_change_m);
 
-    printf("status: fixes=%lu/%lu, lat=%.8f, lon=%.8f, alt=%.1f, stddev_m=%.2f/%.2f/%.2f, window=%d, outliers=%lu, moved=%.2fm/h:%.2f/v:%.2f, conf=%.1fm [%s]",
-           average_state->count, average_state->received_fixes, lat, lon, alt, lat_error_m, lon_error_m, alt_stddev, average_state->window.size, average_state->outliers_rejected,
-           movement_3d, average_state->pos_change_m, average_state->alt_change_m, confidence_radius_m, get_convergence_str(average_state, confidence_radius_m));
-    if (average_state->filter == AVERAGE_FILTER_KALMAN)
-        printf(", kalman=lat:%.2e/lon:%.2e/alt:%.2e/unc:%.2fm", average_state->kalman_lat.error_covariance, average_state->kalman_lon.error_covariance,
-               average_state->kalman_alt.error_covariance, uncertainty_m);
+    printf("fixes=%lu/%lu, lat=%.8f, lon=%.8f, alt=%.1f, stddev_m=%.2f/%.2f/%.2f, window=%zu, outliers=%lu, moved=%.2fm/h:%.2f/v:%.2f, conf=%.1fm [%s], backlog=%u/%u, "
+           "stalls=%lu/%lu, publish_max=%.0fus, retries=%lu",
+           snapshot->count, snapshot->received_fixes, lat, lon, alt, snapshot->lat_error_m, snapshot->lon_error_m, alt_stddev, snapshot->window, snapshot->outliers_rejected,
+           movement_3d, snapshot->pos_change_m, snapshot->alt_change_m, snapshot->confidence_m, get_convergence_str(snapshot->convergence), gps->backlog, gps->backlog_max,
+           gps->stalls, gps->published, (double)gps->publish_ns_max / 1000.0, retries);
+    if (snapshot->filter == AVERAGE_FILTER_KALMAN)
+        printf(", kalman=lat:%.2f/lon:%.2f/alt:%.2f/unc:%.2fm", sqrt(snapshot->kalman_north_var), sqrt(snapshot->kalman_east_var), sqrt(snapshot->kalman_up_var),
+               uncertainty_m);
+    unsigned int horizontal_tau, vertical_tau;
+    double horizontal_adev, vertical_adev;
+    if (stability_minimum(&snapshot->stability, 3, &horizontal_tau, &horizontal_adev) && stability_minimum(&snapshot->stability, 2, &vertical_tau, &vertical_adev))
+        printf(", adev=h:%.2fm@%.0fs/v:%.2fm@%.0fs", horizontal_adev, stability_tau(horizontal_tau), vertical_adev, stability_tau(vertical_tau));
+    if (snapshot->relocations > 0)
+        printf(", relocated=%lu/%.1fm", snapshot->relocations, snapshot->relocated_m);
+    for (unsigned int filter = 0; filter < AVERAGE_FILTERS; filter++)
+        if (filter != snapshot->filter && (snapshot->filters & AVERAGE_FILTER_BIT(filter))) {
+            const average_output_t *const output = &snapshot->outputs[filter];
+            printf(", %s=%.8f/%.8f/%.1f [%s]", average_filter_str[filter], output->latitude, output->longitude, output->altitude, get_convergence_str(output->convergence));
+        }
     printf("\n");
     fflush(stdout);
 }
 
-static void process_loop(struct gps_data_t *const gps_handle, const int *const client_listen_fd, average_state_t *const average_state, const time_t interval_status) {
-    time_t last_status = time(NULL);
+static void *process_report(void *const arg) {
+    process_t *const process = (process_t *)arg;
+    struct pollfd stop       = { .fd = process->stop_fd, .events = POLLIN };
+    time_t last_status       = time(NULL);
 
-    signal(SIGINT, process_signal);
-    signal(SIGTERM, process_signal);
-    signal(SIGPIPE, SIG_IGN);
+    while (poll(&stop, 1, 1000) <= 0 || stop.revents == 0) {
+        if (interval_passed(&last_status, process->interval_status)) {
+            average_snapshot_t snapshot, devices[DEVICES_MAX];
+            gps_stats_t gps, devices_gps[DEVICES_MAX];
+            process_snapshot(process, &snapshot, &gps);
+            process_status(&snapshot, &gps, __atomic_load_n(&process->retries, __ATOMIC_RELAXED));
+            if (process->device_count > 1) {
+                process_snapshot_devices(process, &snapshot, devices, devices_gps);
+                for (unsigned int i = 0; i < process->device_count; i++)
+                    process_status(&devices[i], &devices_gps[i], __atomic_load_n(&process->retries, __ATOMIC_RELAXED));
+            }
+        }
+        for (unsigned int i = 0; i < process->device_count; i++) {
+            checkpoint_t *const cp = &process->devices[i].checkpoint;
+            if (__atomic_load_n(&cp->pending, __ATOMIC_ACQUIRE)) {
+                checkpoint_write(cp);
+                __atomic_store_n(&cp->pending, 0, __ATOMIC_RELEASE);
+            }
+            journal_service(&process->devices[i].journal);
+        }
+    }
+    return NULL;
+}
+
+static bool process_serve(process_t *const process) {
+    client_server_t *const server = process->server;
+    average_snapshot_t snapshot, devices[DEVICES_MAX];
+    gps_stats_t gps, devices_gps[DEVICES_MAX];
+    long long last_expire = client_now_ms();
+
+    process_snapshot(process, &snapshot, &gps);
+    process_snapshot_devices(process, &snapshot, devices, devices_gps);
+    server->gps          = &gps;
+    server->filter       = snapshot.filter;
+    server->devices      = process->metrics->devices      = devices;
+    server->device_count = process->metrics->device_count = process->device_count;
+    for (unsigned int i = 0; i < process->device_count; i++)
+        server->histories[i] = &process->devices[i].history;
+    if (!metrics_attach(process->metrics, server->epoll_fd))
+        return false;
+
+    struct epoll_event notify_event = { .events = EPOLLIN, .data.u32 = CLIENT_TAG_NOTIFY };
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, process->notify_fd, &notify_event) < 0) {
+        perror("epoll_ctl");
+        return false;
+    }
 
     while (process_running) {
-        fd_set rfds;
-        FD_ZERO(&rfds);
-        FD_SET(gps_handle->gps_fd, &rfds);
-        FD_SET(*client_listen_fd, &rfds);
-        const int maxfd   = (gps_handle->gps_fd > *client_listen_fd) ? (int)gps_handle->gps_fd : *client_listen_fd;
-        struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
-        if (select(maxfd + 1, &rfds, NULL, NULL, &tv) < 0) {
+        struct epoll_event events[CLIENT_EVENTS_MAX];
+        const int n = epoll_wait(server->epoll_fd, events, CLIENT_EVENTS_MAX, CLIENT_EXPIRE_MS);
+        if (n < 0) {
             if (errno != EINTR) {
-                perror("select");
-                break;
+                perror("epoll_wait");
+                return false;
             }
             continue;
         }
 
-        if (FD_ISSET(gps_handle->gps_fd, &rfds))
-            gps_process(gps_handle, average_state);
+        // A new snapshot first, whatever order the events came in, so that requests in this batch are answered from it.
+        // Watchers are sent a TPV only when the average they watch has taken a fix.
+        uint64_t notified = 0;
+        for (int i = 0; i < n; i++)
+            if (events[i].data.u32 == CLIENT_TAG_NOTIFY && read(process->notify_fd, &notified, sizeof(notified)) == sizeof(notified)) {
+                unsigned long counts[1 + DEVICES_MAX] = { snapshot.count }, relocations[1 + DEVICES_MAX] = { snapshot.relocations };
+                for (unsigned int device = 0; device < process->device_count; device++) {
+                    counts[1 + device]      = devices[device].count;
+                    relocations[1 + device] = devices[device].relocations;
+                }
+                process_snapshot(process, &snapshot, &gps);
+                process_snapshot_devices(process, &snapshot, devices, devices_gps);
+                unsigned int changed = (snapshot.count != counts[0]) ? 1u : 0u, relocated = (snapshot.relocations != relocations[0]) ? 1u : 0u;
+                for (unsigned int device = 0; device < process->device_count; device++) {
+                    changed |= (devices[device].count != counts[1 + device]) ? 1u << (1 + device) : 0u;
+                    relocated |= (devices[device].relocations != relocations[1 + device]) ? 1u << (1 + device) : 0u;
+                }
+                if (relocated != 0 && server->watchers > 0)
+                    client_broadcast_relocated(server, &snapshot, relocated);
+                if (changed != 0 && server->watchers > 0)
+                    client_broadcast(server, &snapshot, changed);
+            }
+
+        for (int i = 0; i < n; i++)
+            if (CLIENT_TAG_IS_METRICS(events[i].data.u32))
+                metrics_process(process->metrics, &events[i], &snapshot, &gps);
+            else if (events[i].data.u32 != CLIENT_TAG_NOTIFY)
+                client_process(server, &events[i], &snapshot);
+
+        const long long now_ms = client_now_ms();
+        if (now_ms - last_expire >= CLIENT_EXPIRE_MS) {
+            client_expire(server, &snapshot);
+            metrics_expire(process->metrics);
+            last_expire = now_ms;
+        }
+    }
+    return true;
+}
+
+// Returns whether it ran until stopped by a signal, rather than failing to start or to wait.
+static bool process_loop(process_device_t *const devices, const unsigned int device_count, client_server_t *const server, metrics_server_t *const metrics,
+                         const shm_publisher_t *const shm, const time_t interval_status) {
+    process_t process = { .devices         = devices,
+                          .device_count    = device_count,
+                          .shm             = shm,
+                          .server          = server,
+                          .metrics         = metrics,
+                          .interval_status = interval_status,
+                          .notify_fd       = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+                          .combine_fd      = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+                          .stop_fd         = eventfd(0, EFD_CLOEXEC) };
+    if (process.notify_fd < 0 || process.combine_fd < 0 || process.stop_fd < 0) {
+        perror("eventfd");
+        if (process.notify_fd >= 0)
+            close(process.notify_fd);
+        if (process.combine_fd >= 0)
+            close(process.combine_fd);
+        if (process.stop_fd >= 0)
+            close(process.stop_fd);
+        return false;
+    }
+
+    signal(SIGINT, process_signal);
+    signal(SIGTERM, process_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // A restored state is served from the outset, not from the first fix.
+    average_snapshot_t snapshot = { 0 };
+    for (unsigned int i = 0; i < device_count; i++) {
+        process_device_t *const device = &devices[i];
+        device->name                   = (device_count > 1) ? device->path : NULL;
+        device->publish                = (device_count > 1) ? &device->published : &process.published;
+        device->shm                    = (device_count > 1) ? NULL : shm;
+        device->notify_fd              = (device_count > 1) ? process.combine_fd : process.notify_fd;
+        device->stop_fd                = process.stop_fd;
+        average_snapshot(&device->average_state, &snapshot);
+        snapshot.device = device->name;
+        process_publish(device->publish, &snapshot, &device->gps_stats);
+    }
+    if (device_count > 1)
+        process_fuse(&process, &snapshot);
+    shm_publish(shm, &snapshot);
+
+    // The threads start with the signals blocked, so that they are delivered here and interrupt the epoll_wait.
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    pthread_t combine_thread, report_thread;
+    unsigned int ingesting = 0;
+    int error              = 0;
+    while (ingesting < device_count && (error = pthread_create(&devices[ingesting].thread, NULL, process_ingest, &devices[ingesting])) == 0)
+        ingesting++;
+    const bool combining = (ingesting == device_count) && (device_count == 1 || (error = pthread_create(&combine_thread, NULL, process_combine, &process)) == 0);
+    const bool reporting = combining && (error = pthread_create(&report_thread, NULL, process_report, &process)) == 0;
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    bool served = false;
+    if (reporting)
+        served = process_serve(&process);
+    else
+        fprintf(stderr, "pthread_create: %s\n", strerror(error));
+
+    const uint64_t stop = 1;
+    if (write(process.stop_fd, &stop, sizeof(stop)) < 0)
+        perror("write");
+    for (unsigned int i = 0; i < ingesting; i++)
+        pthread_join(devices[i].thread, NULL);
+    if (combining && device_count > 1)
+        pthread_join(combine_thread, NULL);
+    if (reporting)
+        pthread_join(report_thread, NULL);
+    close(process.notify_fd);
+    close(process.combine_fd);
+    close(process.stop_fd);
 
-        if (FD_ISSET(*client_listen_fd, &rfds))
-            client_process(client_listen_fd, average_state);
+    for (unsigned int i = 0; i < device_count; i++) {
+        checkpoint_t *const checkpoint = &devices[i].checkpoint;
+        if (checkpoint->path != NULL && checkpoint_save(checkpoint, &devices[i].average_state) && checkpoint_write(checkpoint))
+            fprintf(stderr, "checkpoint: saved %lu samples to %s\n", devices[i].average_state.count, checkpoint->path);
+    }
+    return served;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+// Replay runs a captured NMEA log through the averaging as fast as it can be read, with the averaging's clock
+// taken from the log's own fix times, so that hours of data give in seconds the window, convergence and estimate
+// they would have live. It reports the final estimate, when each convergence state was first reached in log time,
+// and the rate. Nothing is served, published or checkpointed. Log time is kept continuous across a jump in the fix
+// times, such as the date arriving only after the first fix, or logs joined end to end.
+
+#if defined(GPS_SOURCE_NMEA)
+#define REPLAY_JUMP_MAX 3600 // seconds between consecutive fixes beyond which the log's time is taken to have jumped
+
+static time_t replay_now;
 
-        if (interval_passed(&last_status, interval_status))
-            process_status(average_state);
+static time_t replay_clock(const time_t offset) {
+    (void)offset;
+    return replay_now;
+}
+
+static bool replay(const char *const path, const char *const baud, average_state_t *const state, const int satellites_min, const double hdop_max, const double cno_min) {
+    struct gps_data_t gps_handle;
+    if (!gps_connect(&gps_handle, path, baud, satellites_min, hdop_max, cno_min))
+        return false;
+    average_clock      = replay_clock;
+    state->clock_dated = true; // log time is kept continuous below, and is not to be moved at the first date
+
+    time_t reached[GPSD_AVERAGED_CONVERGED + 1], last = 0, offset = 0;
+    for (size_t i = 0; i < sizeof(reached) / sizeof(reached[0]); i++)
+        reached[i] = -1;
+    average_snapshot_t snapshot = { 0 };
+    gps_stats_t gps_stats       = { 0 };
+    unsigned long epochs        = 0;
+    const long long begin       = perf_now_ns();
+    int n;
+    while ((n = gps_read(&gps_handle, NULL, 0)) > 0) {
+        if (!(gps_handle.set & MODE_SET))
+            continue;
+        const time_t fix_time = gps_handle.fix.time.tv_sec;
+        if (epochs++ == 0)
+            offset = fix_time - 1; // log time starts at 1, as 0 is the averaging's "no fix yet"
+        else if (fix_time < last || fix_time - last > REPLAY_JUMP_MAX)
+            offset += fix_time - last;
+        last       = fix_time;
+        replay_now = fix_time - offset;
+        if (gps_handle.fix.mode >= MODE_2D && gps_process_fix(&gps_handle, state, NULL, NULL)) {
+            average_snapshot(state, &snapshot);
+            if (reached[snapshot.convergence] < 0)
+                reached[snapshot.convergence] = replay_now - 1;
+        }
     }
+    const double elapsed = (double)(perf_now_ns() - begin) / 1e9;
+    if (n < 0)
+        perror("read");
+    gps_disconnect(&gps_handle);
+
+    average_snapshot(state, &snapshot);
+    gps_stats.epochs = epochs;
+    process_status(&snapshot, &gps_stats, 0);
+    printf("replay: %lu epochs, %lu fixes averaged, %lds of log in %.3fs, %.0f epochs/s\n", epochs, snapshot.count, (long)((epochs > 0) ? replay_now - 1 : 0), elapsed,
+           (elapsed > 0) ? (double)epochs / elapsed : 0.0);
+    printf("replay: convergence");
+    for (size_t i = 0; i < sizeof(reached) / sizeof(reached[0]); i++)
+        if (reached[i] >= 0)
+            printf(" %s=+%lds", get_convergence_str((gpsd_averaged_convergence_t)i), (long)reached[i]);
+    printf("\n");
+    printf("replay: adev h/v");
+    for (unsigned int tau = 0; tau < STABILITY_TAUS && snapshot.stability.adev_terms[tau] > 0; tau++)
+        printf(" %.0fs=%.3f/%.3f", stability_tau(tau), stability_deviation(&snapshot.stability, tau, 3, false), stability_deviation(&snapshot.stability, tau, 2, false));
+    printf("\n");
+    fflush(stdout);
+    return n == 0;
 }
+#else
+static bool replay(const char *const path, const char *const baud, average_state_t *const state, const int satellites_min, const double hdop_max, const double cno_min) {
+    (void)path;
+    (void)baud;
+    (void)state;
+    (void)satellites_min;
+    (void)hdop_max;
+    (void)cno_min;
+    fprintf(stderr, "replay: reads NMEA logs, which needs the NMEA build (make GPS_SOURCE=NMEA)\n");
+    return false;
+}
+#endif
 
 // ------------------------------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------------------------------
 
 typedef struct {
-    const char *gpsd_host, *gpsd_port;
+    const char *devices[DEVICES_MAX]; // gpsd hosts in GPSD mode
+    unsigned int device_count;
+    const char *gpsd_port;
     unsigned short port;
     bool listenany;
+    const char *socket_path;
+    unsigned short metrics_port;
+    const char *shm_name;
+    const char *checkpoint_path;
+    const char *journal_path;
+    bool journal_rejected;
+    const char *replay_path;
     average_filter_t filter;
+    unsigned int filters;
+    size_t window_samples;
+    time_t window_duration;
     int satellites_min;
     double hdop_max;
+    double cno_min;
     bool anchored;
     int interval_status;
     bool verbose;
@@ -610,11 +4228,20 @@ static const struct option options[] = { // defaults
     { "baud", required_argument, 0, 'P' }, // alias, reads better in NMEA mode
     { "port", required_argument, 0, 'p' },
     { "listenany", no_argument, 0, 'G' },
+    { "socket", required_argument, 0, 'S' },
+    { "metrics-port", required_argument, 0, 'M' },
+    { "shm", required_argument, 0, 'm' },
     { "filter", required_argument, 0, 'f' },
+    { "window", required_argument, 0, 'w' },
     { "sats", required_argument, 0, 's' },
     { "hdop", required_argument, 0, 'h' },
+    { "cno", required_argument, 0, 'n' },
     { "anchored", no_argument, 0, 'a' },
+    { "checkpoint", required_argument, 0, 'c' },
+    { "journal", required_argument, 0, 'j' },
+    { "journal-rejected", no_argument, 0, 'J' },
     { "interval", required_argument, 0, 'i' },
+    { "replay", required_argument, 0, 'r' },
     { "background", no_argument, 0, 'b' },
     { "verbose", no_argument, 0, 'v' },
     { "help", no_argument, 0, '?' },
@@ -625,30 +4252,112 @@ static void usage(const char *const prog) {
     printf("Usage: %s [options]\n", prog);
     printf("Options:\n");
 #if defined(GPS_SOURCE_GPSD)
-    printf("  -H, --gpsd-host HOST     GPSD host (default %s)\n", DEFAULT_GPSD_HOST);
+    printf("  -H, --gpsd-host HOST     GPSD host, repeated to average up to %d at once (default %s)\n", DEVICES_MAX, DEFAULT_GPSD_HOST);
     printf("  -P, --gpsd-port PORT     GPSD port (default %s)\n", DEFAULT_GPSD_PORT);
 #else
-    printf("  -H, --device PATH        GPS serial device, read-only (default %s)\n", DEFAULT_GPSD_HOST);
+    printf("  -H, --device PATH        GPS serial device, read-only, repeated to average up to %d at once (default %s)\n", DEVICES_MAX, DEFAULT_GPSD_HOST);
     printf("  -P, --baud RATE          GPS serial baud rate (default %s)\n", DEFAULT_GPSD_PORT);
 #endif
     printf("  -p, --port PORT          Client listen port (default %d)\n", DEFAULT_PORT);
     printf("  -G, --listenany          Client listen on INADDR_ANY (default INADDR_LOOPBACK)\n");
-    printf("  -f, --filter MODE        Averaging filter: simple, window, kalman (default simple)\n");
+    printf("  -S, --socket PATH        Client listen also on a Unix domain socket (default none)\n");
+    printf("  -M, --metrics-port PORT  Serve OpenMetrics over HTTP, bound as --port is (default none)\n");
+    printf("  -m, --shm NAME           Publish to a shared-memory record, e.g. %s (default none)\n", GPSD_AVERAGED_SHM_NAME);
+    printf("  -f, --filter MODE[,...]  Averaging filter: simple, window, kalman, median, or all; the first reported by default (default simple)\n");
+    printf("  -w, --window N|DURATION  Averaging window, samples or with s/m/h/d a duration (default %d)\n", DEFAULT_WINDOW_SAMPLES);
     printf("  -s, --sats N             Averaging minimum satellites (default %d)\n", DEFAULT_SATELLITES_MIN);
     printf("  -h, --hdop HDOP          Averaging maximum HDOP (default %.1f)\n", DEFAULT_HDOP_MAX);
+    printf("  -n, --cno DBHZ           Averaging minimum C/N0 of --sats satellites in view (default none)\n");
     printf("  -a, --anchored           Anchored mode, fixed installation\n");
+    printf("  -c, --checkpoint PATH    Anchored mode state saved to, and restored at startup from; PATH.N for the Nth further device (default none)\n");
+    printf("  -j, --journal DIR        Journal every accepted fix to binary segment files in DIR (default none)\n");
+    printf("  -J, --journal-rejected   Journal also the rejected fixes\n");
     printf("  -i, --interval SECONDS   Interval status (default %d)\n", DEFAULT_INTERVAL_STATUS);
+    printf("  -r, --replay FILE        Replay an NMEA log at full speed, timed by its fixes, and report the result\n");
     printf("  -b, --background         Background operation\n");
     printf("  -v, --verbose            Verbose output\n");
     printf("  --help                   This help\n");
 }
 
+// A bare number is a sample count, a number with a unit suffix a duration; either way a zero is rejected.
+static bool parse_window(const char *const spec, size_t *const samples, time_t *const duration) {
+    char *end;
+    const unsigned long value = strtoul(spec, &end, 10);
+    if (end == spec || value == 0 || (*end != '\0' && end[1] != '\0'))
+        return false;
+    unsigned long unit;
+    switch (*end) {
+    case '\0':
+        if (value > WINDOW_RAW_MAX)
+            return false;
+        *samples  = value;
+        *duration = 0;
+        return true;
+    case 's':
+        unit = 1;
+        break;
+    case 'm':
+        unit = 60;
+        break;
+    case 'h':
+        unit = 60 * 60;
+        break;
+    case 'd':
+        unit = 24 * 60 * 60;
+        break;
+    default:
+        return false;
+    }
+    if (value > WINDOW_DURATION_MAX / unit)
+        return false;
+    *samples  = 0;
+    *duration = (time_t)(value * unit);
+    return true;
+}
+
+// A list of filters to run, the first named the default; "all" runs every one, and names none.
+static bool parse_filters(const char *const spec, average_filter_t *const filter, unsigned int *const filters) {
+    bool named_any = false;
+    *filters       = 0;
+    for (const char *name = spec, *end; *name != '\0'; name = (*end != '\0') ? end + 1 : end) {
+        end                  = name + strcspn(name, ",");
+        const size_t length  = (size_t)(end - name);
+        average_filter_t named;
+        if (length == strlen("all") && strncmp(name, "all", length) == 0)
+            *filters |= AVERAGE_FILTER_ALL;
+        else if (get_filter_by_name(name, length, &named)) {
+            if (!named_any)
+                *filter = named;
+            named_any = true;
+            *filters |= AVERAGE_FILTER_BIT(named);
+        } else
+            return false;
+    }
+    return *filters != 0;
+}
+
+// A device named again would be ambiguous to clients, which name them by path.
+static bool parse_device(const char *const device, config_t *const config, const unsigned int named) {
+    if (named == DEVICES_MAX)
+        return false;
+    for (unsigned int i = 0; i < named; i++)
+        if (strcmp(config->devices[i], device) == 0)
+            return false;
+    config->devices[named] = device;
+    config->device_count   = named + 1;
+    return true;
+}
+
 static int parse_arguments(const int argc, char *const argv[], config_t *const config) {
     int opt;
-    while ((opt = getopt_long(argc, argv, "H:P:p:Gf:s:h:ai:bv?", options, NULL)) != -1)
+    unsigned int devices = 0; // the first named replaces the default
+    while ((opt = getopt_long(argc, argv, "H:P:p:GS:M:m:f:w:s:h:n:ac:j:Ji:r:bv?", options, NULL)) != -1)
         switch (opt) {
         case 'H':
-            config->gpsd_host = optarg;
+            if (!parse_device(optarg, config, devices++)) {
+                fprintf(stderr, "Invalid device '%s' (at most %d, each named once)\n", optarg, DEVICES_MAX);
+                return -1;
+            }
             break;
         case 'P':
             config->gpsd_port = optarg;
@@ -659,13 +4368,26 @@ static int parse_arguments(const int argc, char *const argv[], config_t *const c
         case 'G':
             config->listenany = true;
             break;
+        case 'S':
+            config->socket_path = optarg;
+            break;
+        case 'M':
+            config->metrics_port = (unsigned short)atoi(optarg);
+            break;
+        case 'm':
+            config->shm_name = optarg;
+            break;
         case 'f':
-            if (strcmp(optarg, "kalman") == 0)
-                config->filter = AVERAGE_FILTER_KALMAN;
-            else if (strcmp(optarg, "window") == 0)
-                config->filter = AVERAGE_FILTER_WINDOW;
-            else
-                config->filter = AVERAGE_FILTER_SIMPLE;
+            if (!parse_filters(optarg, &config->filter, &config->filters)) {
+                fprintf(stderr, "Invalid filter '%s' (simple, window, kalman or all, separated by commas)\n", optarg);
+                return -1;
+            }
+            break;
+        case 'w':
+            if (!parse_window(optarg, &config->window_samples, &config->window_duration)) {
+                fprintf(stderr, "Invalid window '%s' (at most %d samples or %d seconds)\n", optarg, WINDOW_RAW_MAX, WINDOW_DURATION_MAX);
+                return -1;
+            }
             break;
         case 's':
             config->satellites_min = atoi(optarg);
@@ -673,12 +4395,27 @@ static int parse_arguments(const int argc, char *const argv[], config_t *const c
         case 'h':
             config->hdop_max = atof(optarg);
             break;
+        case 'n':
+            config->cno_min = atof(optarg);
+            break;
         case 'a':
             config->anchored = true;
             break;
+        case 'c':
+            config->checkpoint_path = optarg;
+            break;
+        case 'j':
+            config->journal_path = optarg;
+            break;
+        case 'J':
+            config->journal_rejected = true;
+            break;
         case 'i':
             config->interval_status = atoi(optarg);
             break;
+        case 'r':
+            config->replay_path = optarg;
+            break;
         case 'b':
             config->daemon = true;
             break;
@@ -693,17 +4430,73 @@ static int parse_arguments(const int argc, char *const argv[], config_t *const c
     return 0;
 }
 
+// A receiver's average, checkpoint and connection. Each has a checkpoint of its own: the first at the --checkpoint
+// path, as with only one, and each further one at that path suffixed with its index.
+static bool process_device_begin(process_device_t *const device, const config_t *const config, const unsigned int index) {
+    device->path                = config->devices[index];
+    const char *checkpoint_path = config->checkpoint_path;
+    if (checkpoint_path != NULL && index > 0) {
+        snprintf(device->checkpoint_path, sizeof(device->checkpoint_path), "%s.%u", config->checkpoint_path, index);
+        checkpoint_path = device->checkpoint_path;
+    }
+    if (!average_begin(&device->average_state, config->filter, config->filters, config->anchored, config->window_samples, config->window_duration))
+        return false;
+    if (!checkpoint_begin(&device->checkpoint, checkpoint_path, &device->average_state.window)) {
+        average_end(&device->average_state);
+        return false;
+    }
+    checkpoint_load(&device->checkpoint, &device->average_state);
+    if (!journal_begin(&device->journal, config->journal_path, config->journal_rejected, index, device->path)) {
+        checkpoint_end(&device->checkpoint);
+        average_end(&device->average_state);
+        return false;
+    }
+    if (!history_begin(&device->history)) {
+        journal_end(&device->journal);
+        checkpoint_end(&device->checkpoint);
+        average_end(&device->average_state);
+        return false;
+    }
+    if (!gps_connect(&device->gps_handle, device->path, config->gpsd_port, config->satellites_min, config->hdop_max, config->cno_min)) {
+        history_end(&device->history);
+        journal_end(&device->journal);
+        checkpoint_end(&device->checkpoint);
+        average_end(&device->average_state);
+        return false;
+    }
+    return true;
+}
+
+static void process_device_end(process_device_t *const device) {
+    gps_disconnect(&device->gps_handle);
+    history_end(&device->history);
+    journal_end(&device->journal);
+    checkpoint_end(&device->checkpoint);
+    average_end(&device->average_state);
+}
+
 // ------------------------------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------------------------------
 
 static config_t config = {
-    .gpsd_host       = DEFAULT_GPSD_HOST,
+    .devices         = { DEFAULT_GPSD_HOST },
+    .device_count    = 1,
     .gpsd_port       = DEFAULT_GPSD_PORT,
     .port            = DEFAULT_PORT,
     .listenany       = DEFAULT_LISTENANY,
+    .socket_path     = DEFAULT_SOCKET_PATH,
+    .metrics_port    = DEFAULT_METRICS_PORT,
+    .shm_name        = DEFAULT_SHM_NAME,
+    .checkpoint_path = DEFAULT_CHECKPOINT_PATH,
+    .journal_path    = DEFAULT_JOURNAL_PATH,
+    .replay_path     = DEFAULT_REPLAY_PATH,
     .filter          = DEFAULT_FILTER,
+    .filters         = AVERAGE_FILTER_BIT(DEFAULT_FILTER),
+    .window_samples  = DEFAULT_WINDOW_SAMPLES,
+    .window_duration = DEFAULT_WINDOW_DURATION,
     .satellites_min  = DEFAULT_SATELLITES_MIN,
     .hdop_max        = DEFAULT_HDOP_MAX,
+    .cno_min         = DEFAULT_CNO_MIN,
     .anchored        = DEFAULT_ANCHORED,
     .interval_status = DEFAULT_INTERVAL_STATUS,
     .verbose         = DEFAULT_VERBOSE,
@@ -712,36 +4505,75 @@ static config_t config = {
 
 int main(const int argc, char *const argv[]) {
 
-    struct gps_data_t gps_handle;
     average_state_t average_state;
-    int client_listen_fd;
+    client_server_t client_server;
+    metrics_server_t metrics_server;
+    shm_publisher_t shm_publisher;
 
     if (parse_arguments(argc, argv, &config) < 0)
         return EXIT_SUCCESS;
 
     verbose = config.verbose;
 
-    if (config.daemon && daemon(0, 0) < 0) {
+    if (config.daemon && config.replay_path == NULL && daemon(0, 0) < 0) {
         perror("daemon");
         return EXIT_FAILURE;
     }
 
-    fprintf(stderr, "config: " GPS_SOURCE_NAME "=%s:%s, port=%d, filter=%s, anchored=%s, sats/hdop=%d/%.1f, listen-any=%s, status=%ds\n", config.gpsd_host, config.gpsd_port,
-            config.port, get_filter_name(config.filter), config.anchored ? "yes" : "no", config.satellites_min, config.hdop_max, config.listenany ? "yes" : "no",
-            config.interval_status);
+    char filters[64];
+    size_t filters_length = (size_t)snprintf(filters, sizeof(filters), "%s", get_filter_name(config.filter));
+    for (unsigned int filter = 0; filter < AVERAGE_FILTERS; filter++)
+        if (filter != config.filter && (config.filters & AVERAGE_FILTER_BIT(filter)))
+            filters_length += (size_t)snprintf(filters + filters_length, sizeof(filters) - filters_length, "+%s", average_filter_str[filter]);
+    char devices[DEVICES_MAX * PATH_MAX];
+    size_t devices_length = 0;
+    for (unsigned int device = 0; device < config.device_count; device++)
+        devices_length += (size_t)snprintf(devices + devices_length, sizeof(devices) - devices_length, "%s%s", (device > 0) ? "," : "", config.devices[device]);
+    char window[32];
+    if (config.window_duration > 0)
+        snprintf(window, sizeof(window), "%lds", (long)config.window_duration);
+    else
+        snprintf(window, sizeof(window), "%zu", config.window_samples);
+    fprintf(stderr, "config: " GPS_SOURCE_NAME "=%s:%s, port=%d, filter=%s, window=%s, anchored=%s, sats/hdop/cno=%d/%.1f/%.0f, listen-any=%s, socket=%s, metrics=%d, shm=%s, "
+            "checkpoint=%s, journal=%s%s, status=%ds\n",
+            devices, config.gpsd_port, config.port, filters, window, config.anchored ? "yes" : "no", config.satellites_min, config.hdop_max, config.cno_min,
+            config.listenany ? "yes" : "no", config.socket_path != NULL ? config.socket_path : "none", config.metrics_port, config.shm_name != NULL ? config.shm_name : "none",
+            config.checkpoint_path != NULL ? config.checkpoint_path : "none", config.journal_path != NULL ? config.journal_path : "none",
+            config.journal_rejected ? "+rejected" : "", config.interval_status);
+    if (config.replay_path != NULL) {
+        if (!average_begin(&average_state, config.filter, config.filters, config.anchored, config.window_samples, config.window_duration))
+            return EXIT_FAILURE;
+        const bool replayed = replay(config.replay_path, config.gpsd_port, &average_state, config.satellites_min, config.hdop_max, config.cno_min);
+        average_end(&average_state);
+        return replayed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (config.checkpoint_path != NULL && !config.anchored) {
+        fprintf(stderr, "checkpoint: only kept in anchored mode, ignored\n");
+        config.checkpoint_path = NULL;
+    }
 
-    if (!gps_connect(&gps_handle, config.gpsd_host, config.gpsd_port, config.satellites_min, config.hdop_max))
-        return EXIT_FAILURE;
-    if (!client_start(&client_listen_fd, config.port, config.listenany)) {
-        gps_disconnect(&gps_handle);
+    process_device_t *const process_devices = calloc(config.device_count, sizeof(process_device_t));
+    if (process_devices == NULL) {
+        perror("calloc");
         return EXIT_FAILURE;
     }
-    average_begin(&average_state, config.filter, config.anchored);
-    process_loop(&gps_handle, &client_listen_fd, &average_state, config.interval_status);
-    client_stop(&client_listen_fd);
-    gps_disconnect(&gps_handle);
+    unsigned int begun = 0;
+    while (begun < config.device_count && process_device_begin(&process_devices[begun], &config, begun))
+        begun++;
+    bool started = (begun == config.device_count);
+    if (started && (started = client_start(&client_server, config.port, config.listenany, config.socket_path))) {
+        if ((started = metrics_start(&metrics_server, config.metrics_port, config.listenany)) && (started = shm_begin(&shm_publisher, config.shm_name))) {
+            started = process_loop(process_devices, config.device_count, &client_server, &metrics_server, &shm_publisher, config.interval_status);
+            shm_end(&shm_publisher);
+        }
+        metrics_stop(&metrics_server);
+        client_stop(&client_server);
+    }
+    while (begun > 0)
+        process_device_end(&process_devices[--begun]);
+    free(process_devices);
 
-    return EXIT_SUCCESS;
+    return started ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 // ------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,515 @@
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+// Benchmarks for the parse -> average -> publish pipeline, with results as one JSON object on stdout so that runs
+// (x86 against armhf, before against after) can be compared by script. The parts:
+//
+//   micro     the hot functions in isolation, in ns/op: sentence parsing, average_update() for each filter and for
+//             all of them at once, and rendering the TPV. The daemon's source is included whole, so these are the very same functions.
+//   undated   a daemon of its own fed GGA without RMC, as from a receiver that never gives a date, every fix of
+//             which must still be averaged.
+//   pipeline  the real daemon fed a large synthetic NMEA stream through a pipe as fast as it will take it, timed
+//             from the first byte written until its shared-memory record shows the last fix: fixes/s.
+//   pollers   N concurrent clients each sending ?POLL as soon as the previous answer arrives: requests/s and
+//             the p50/p99 response latency, while the daemon is fed at --rate.
+//   watchers  N concurrent ?WATCH clients: the p50/p99 latency from an epoch being written to the pipe until its
+//             TPV reaches the client, which is the whole path of a fix through the daemon.
+//
+// Needs the NMEA build of the daemon, as only that reads a pipe. Progress goes to stderr.
+
+#define main gpsd_averaged_main
+#include "gpsd_averaged.c"
+#undef main
+
+#include <netinet/tcp.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+#define BENCH_MICRO_NS 200000000LL // time spent on each microbenchmark
+#define BENCH_EPOCH_MAX 512        // bytes, more than one epoch of the synthetic stream
+#define BENCH_SAMPLES_MAX 4000000  // latency samples kept per part
+#define BENCH_READY_MS 5000        // wait for the daemon to come up
+#define BENCH_DRAIN_MS 60000       // wait for the daemon to finish the pipeline stream
+#define BENCH_UNDATED_EPOCHS 400   // in the undated stream
+
+typedef struct {
+    const char *daemon;
+    unsigned short port;
+    unsigned long epochs;
+    unsigned int clients;
+    unsigned int seconds;
+    unsigned int rate;
+} bench_config_t;
+
+typedef struct {
+    long long *values;
+    size_t count;
+} bench_samples_t;
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+// The synthetic receiver: a fixed position with noise bounded (uniform, +/-1m) to within what the outlier gate
+// passes at any window, so that every epoch written is a fix accepted; GSA, GGA and RMC each epoch, as at 1Hz.
+static unsigned long bench_random_state = 1;
+
+static double bench_random(void) { // uniform in [-1, 1)
+    bench_random_state = bench_random_state * 6364136223846793005UL + 1442695040888963407UL;
+    return (double)(bench_random_state >> 11) / (double)(1UL << 52) - 1.0;
+}
+
+static size_t bench_sentence(char *const buf, const size_t buflen, const char *const body) {
+    unsigned char checksum = 0;
+    for (const char *p = body; *p != '\0'; p++)
+        checksum ^= (unsigned char)*p;
+    const int n = snprintf(buf, buflen, "$%s*%02X\r\n", body, checksum);
+    return (n > 0 && (size_t)n < buflen) ? (size_t)n : 0;
+}
+
+static void bench_fix(double *const lat, double *const lon, double *const alt) {
+    *lat = 51.500930 + bench_random() / 111320.0;
+    *lon = -0.206725 + bench_random() / 69320.0;
+    *alt = 15.0 + bench_random() * 0.5;
+}
+
+// An epoch as a u-blox receiver sends it, GSA then GGA then RMC, or without the RMC unless dated.
+static size_t bench_epoch(char *const buf, const size_t buflen, const unsigned long index, const bool dated) {
+    double lat, lon, alt;
+    bench_fix(&lat, &lon, &alt);
+    const unsigned long t = 12 * 3600 + index, day = 17 + (t / 86400) % 10;
+    char time_str[16], lat_str[24], lon_str[24], body[160];
+    snprintf(time_str, sizeof(time_str), "%02lu%02lu%02lu.00", (t / 3600) % 24, (t / 60) % 60, t % 60);
+    snprintf(lat_str, sizeof(lat_str), "%02d%09.6f,N", (int)lat, (lat - (int)lat) * 60.0);
+    snprintf(lon_str, sizeof(lon_str), "%03d%09.6f,W", (int)-lon, (-lon - (int)-lon) * 60.0);
+    size_t length = bench_sentence(buf, buflen, "GNGSA,A,3,01,02,03,04,05,06,07,08,,,,,1.8,0.9,1.5");
+    snprintf(body, sizeof(body), "GNGGA,%s,%s,%s,1,08,0.9,%.1f,M,47.0,M,,", time_str, lat_str, lon_str, alt);
+    length += bench_sentence(buf + length, buflen - length, body);
+    if (dated) {
+        snprintf(body, sizeof(body), "GNRMC,%s,A,%s,%s,0.01,,%02lu1026,,,A", time_str, lat_str, lon_str, day);
+        length += bench_sentence(buf + length, buflen - length, body);
+    }
+    return length;
+}
+
+static int bench_compare(const void *const a, const void *const b) {
+    const long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_sample(bench_samples_t *const samples, const long long value) {
+    if (samples->count < BENCH_SAMPLES_MAX)
+        samples->values[samples->count++] = value;
+}
+
+static long long bench_percentile(const bench_samples_t *const samples, const double percentile) {
+    return (samples->count > 0) ? samples->values[(size_t)((double)(samples->count - 1) * percentile)] : 0;
+}
+
+static void bench_print_latency(const bench_samples_t *const samples) {
+    qsort(samples->values, samples->count, sizeof(samples->values[0]), bench_compare);
+    printf("\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f", (double)bench_percentile(samples, 0.50) / 1000.0, (double)bench_percentile(samples, 0.99) / 1000.0,
+           (double)bench_percentile(samples, 1.0) / 1000.0);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+// Runs op until BENCH_MICRO_NS has passed, checking the clock only every batch, and prints ns/op as "name".
+#define BENCH_MICRO(name, op)                                                                                                                                                      \
+    do {                                                                                                                                                                           \
+        unsigned long ops_     = 0;                                                                                                                                                \
+        const long long begin_ = perf_now_ns();                                                                                                                                    \
+        long long elapsed_;                                                                                                                                                        \
+        do {                                                                                                                                                                       \
+            for (unsigned int i_ = 0; i_ < 1024; i_++, ops_++)                                                                                                                     \
+                op;                                                                                                                                                                \
+        } while ((elapsed_ = perf_now_ns() - begin_) < BENCH_MICRO_NS);                                                                                                            \
+        printf(",\"%s_ns\":%.1f", name, (double)elapsed_ / (double)ops_);                                                                                                          \
+    } while (0)
+
+static void bench_micro(void) {
+    static struct gps_data_t gps_handle;
+    memset(&gps_handle, 0, sizeof(gps_handle));
+    char epoch[BENCH_EPOCH_MAX];
+    bench_epoch(epoch, sizeof(epoch), 0, true);
+    const char *const gsa = epoch, *const gga = strchr(gsa + 1, '$'), *const rmc = strchr(gga + 1, '$');
+    const size_t gsa_length = (size_t)(strchr(gsa, '*') - gsa), gga_length = (size_t)(strchr(gga, '*') - gga), rmc_length = (size_t)(strchr(rmc, '*') - rmc);
+
+    printf(",\"micro\":{\"unit\":\"ns/op\"");
+    BENCH_MICRO("nmea_sentence_gga", __gps_nmea_sentence(&gps_handle, gga, gga_length));
+    BENCH_MICRO("nmea_sentence_gsa", __gps_nmea_sentence(&gps_handle, gsa, gsa_length));
+    BENCH_MICRO("nmea_sentence_rmc", __gps_nmea_sentence(&gps_handle, rmc, rmc_length));
+    static const char gst[] = "$GPGST,172814.00,0.006,0.023,0.020,273.6,0.023,0.020,0.031", gsv[] = "$GPGSV,3,1,11,03,03,111,42,04,15,270,38,06,01,010,,13,06,292,45";
+    BENCH_MICRO("nmea_sentence_gst", __gps_nmea_sentence(&gps_handle, gst, sizeof(gst) - 1));
+    BENCH_MICRO("nmea_sentence_gsv", __gps_nmea_sentence(&gps_handle, gsv, sizeof(gsv) - 1));
+
+    // Fixes are generated ahead, so that the generator's cost is not in the figure.
+    enum { FIXES = 4096 };
+    static double fixes[FIXES][3];
+    for (size_t i = 0; i < FIXES; i++)
+        bench_fix(&fixes[i][0], &fixes[i][1], &fixes[i][2]);
+    average_state_t state;
+    size_t next = 0;
+    for (unsigned int filter = 0; filter <= AVERAGE_FILTERS; filter++) {
+        const bool all = (filter == AVERAGE_FILTERS);
+        if (!average_begin(&state, all ? DEFAULT_FILTER : (average_filter_t)filter, all ? AVERAGE_FILTER_ALL : 0, false, DEFAULT_WINDOW_SAMPLES, 0))
+            exit(EXIT_FAILURE);
+        char name[64];
+        snprintf(name, sizeof(name), "average_update_%s", all ? "all" : average_filter_str[filter]);
+        BENCH_MICRO(name, (average_update(&state, fixes[next][0], fixes[next][1], fixes[next][2], 1.0, 10, NULL), next = (next + 1) & (FIXES - 1)));
+        average_end(&state);
+    }
+
+    if (!average_begin(&state, AVERAGE_FILTER_SIMPLE, 0, false, DEFAULT_WINDOW_SAMPLES, 0))
+        exit(EXIT_FAILURE);
+    for (size_t i = 0; i < FIXES; i++)
+        average_update(&state, fixes[i][0], fixes[i][1], fixes[i][2], 1.0, 10, NULL);
+    average_snapshot_t snapshot = { 0 };
+    average_snapshot(&state, &snapshot);
+    average_end(&state);
+    char buf[BUFFER_MAX];
+    BENCH_MICRO("format_tpv", client_format_json_response(buf, sizeof(buf), &snapshot, AVERAGE_FILTER_SIMPLE));
+    printf("}");
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    pid_t pid;
+    int feed_fd;
+    char shm_name[64];
+    const gpsd_averaged_shm_t *shm;
+    unsigned long epochs; // written so far
+    bool dated;           // whether its epochs carry RMC
+} bench_daemon_t;
+
+static bool bench_daemon_start(bench_daemon_t *const daemon_process, const bench_config_t *const cfg) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return false;
+    }
+    snprintf(daemon_process->shm_name, sizeof(daemon_process->shm_name), "/gpsd_averaged_bench.%d", (int)getpid());
+    char port[16];
+    snprintf(port, sizeof(port), "%u", cfg->port);
+    if ((daemon_process->pid = fork()) < 0) {
+        perror("fork");
+        return false;
+    }
+    if (daemon_process->pid == 0) {
+        const int null_fd = open("/dev/null", O_WRONLY);
+        dup2(fds[0], STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        close(null_fd);
+        execl(cfg->daemon, cfg->daemon, "--device", "/dev/stdin", "--port", port, "--shm", daemon_process->shm_name, "--interval", "86400", (char *)NULL);
+        _exit(127);
+    }
+    close(fds[0]);
+    daemon_process->feed_fd = fds[1];
+    daemon_process->epochs  = 0;
+
+    const long long deadline = client_now_ms() + BENCH_READY_MS;
+    while ((daemon_process->shm = gpsd_averaged_shm_open(daemon_process->shm_name)) == NULL && client_now_ms() < deadline)
+        usleep(10000);
+    if (daemon_process->shm == NULL) {
+        fprintf(stderr, "bench: %s did not come up (is it the NMEA build?)\n", cfg->daemon);
+        return false;
+    }
+    return true;
+}
+
+static void bench_daemon_stop(bench_daemon_t *const daemon_process) {
+    if (daemon_process->shm != NULL)
+        gpsd_averaged_shm_close(daemon_process->shm);
+    if (daemon_process->pid > 0) {
+        kill(daemon_process->pid, SIGTERM);
+        waitpid(daemon_process->pid, NULL, 0);
+    }
+    close(daemon_process->feed_fd);
+}
+
+static bool bench_daemon_write(bench_daemon_t *const daemon_process, const char *data, size_t length) {
+    while (length > 0) {
+        const ssize_t n = write(daemon_process->feed_fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            return false;
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+static bool bench_daemon_feed(bench_daemon_t *const daemon_process) {
+    char epoch[BENCH_EPOCH_MAX];
+    const size_t length = bench_epoch(epoch, sizeof(epoch), daemon_process->epochs++, daemon_process->dated);
+    return bench_daemon_write(daemon_process, epoch, length);
+}
+
+static uint64_t bench_daemon_samples(const bench_daemon_t *const daemon_process) {
+    gpsd_averaged_position_t position;
+    return gpsd_averaged_shm_read(daemon_process->shm, &position) ? position.samples : 0;
+}
+
+// Waits until the daemon has averaged every epoch written, or BENCH_DRAIN_MS, returning how many it has.
+static uint64_t bench_daemon_drain(const bench_daemon_t *const daemon_process) {
+    const long long deadline = client_now_ms() + BENCH_DRAIN_MS;
+    while (bench_daemon_samples(daemon_process) < daemon_process->epochs && client_now_ms() < deadline)
+        usleep(100);
+    return bench_daemon_samples(daemon_process);
+}
+
+static bool bench_undated(const bench_config_t *const cfg) {
+    bench_daemon_t daemon_process = { .pid = -1, .feed_fd = -1, .dated = false };
+    bool written                  = bench_daemon_start(&daemon_process, cfg);
+    fprintf(stderr, "bench: undated, %d epochs\n", BENCH_UNDATED_EPOCHS);
+    for (unsigned int i = 0; written && i < BENCH_UNDATED_EPOCHS; i++)
+        written = bench_daemon_feed(&daemon_process);
+    const uint64_t samples = written ? bench_daemon_drain(&daemon_process) : 0;
+    bench_daemon_stop(&daemon_process);
+    printf(",\"undated\":{\"epochs\":%d,\"accepted\":%llu}", BENCH_UNDATED_EPOCHS, (unsigned long long)samples);
+    return written && samples >= BENCH_UNDATED_EPOCHS;
+}
+
+static bool bench_pipeline(bench_daemon_t *const daemon_process, const bench_config_t *const cfg) {
+    // The stream is generated ahead, so that the figure is the daemon's rate and not the generator's.
+    const size_t capacity = (size_t)cfg->epochs * BENCH_EPOCH_MAX;
+    char *const stream    = malloc(capacity);
+    if (stream == NULL) {
+        perror("malloc");
+        return false;
+    }
+    size_t length = 0;
+    for (unsigned long i = 0; i < cfg->epochs; i++)
+        length += bench_epoch(stream + length, capacity - length, daemon_process->epochs++, daemon_process->dated);
+
+    fprintf(stderr, "bench: pipeline, %lu epochs (%zu bytes)\n", cfg->epochs, length);
+    const long long begin = perf_now_ns();
+    const bool written    = bench_daemon_write(daemon_process, stream, length);
+    free(stream);
+    const uint64_t samples = written ? bench_daemon_drain(daemon_process) : bench_daemon_samples(daemon_process);
+    const double elapsed   = (double)(perf_now_ns() - begin) / 1e9;
+    printf(",\"pipeline\":{\"epochs\":%lu,\"bytes\":%zu,\"accepted\":%llu,\"seconds\":%.3f,\"fixes_per_s\":%.0f,\"bytes_per_s\":%.0f}", cfg->epochs, length,
+           (unsigned long long)samples, elapsed, (double)cfg->epochs / elapsed, (double)length / elapsed);
+    return written && samples >= daemon_process->epochs;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    int fd;
+    long long sent_ns; // pollers: when the outstanding request went
+    size_t pending;    // bytes of a partial line
+} bench_client_t;
+
+static int bench_connect(const unsigned short port) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    const int one           = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool bench_send(const int fd, const char *const request) { return send(fd, request, strlen(request), MSG_NOSIGNAL) == (ssize_t)strlen(request); }
+
+// Reads what has arrived and returns the number of complete lines in it.
+static unsigned int bench_lines(bench_client_t *const client) {
+    char buf[BUFFER_MAX * 4];
+    const ssize_t n = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n <= 0)
+        return 0;
+    unsigned int lines = 0;
+    for (ssize_t i = 0; i < n; i++)
+        if (buf[i] == '\n') {
+            lines++;
+            client->pending = 0;
+        } else
+            client->pending++;
+    return lines;
+}
+
+// Opens the clients and registers them with a new epoll set; false unless all of them connected.
+static bool bench_clients_open(bench_client_t *const clients, const unsigned int count, const unsigned short port, int *const epoll_fd) {
+    if ((*epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("epoll_create1");
+        return false;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        clients[i] = (bench_client_t){ .fd = bench_connect(port) };
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = i };
+        if (clients[i].fd < 0 || epoll_ctl(*epoll_fd, EPOLL_CTL_ADD, clients[i].fd, &event) < 0) {
+            fprintf(stderr, "bench: client %u of %u failed to connect: %s\n", i + 1, count, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+static void bench_clients_close(bench_client_t *const clients, const unsigned int count, const int epoll_fd) {
+    for (unsigned int i = 0; i < count; i++)
+        if (clients[i].fd >= 0)
+            close(clients[i].fd);
+    close(epoll_fd);
+}
+
+// Drives the clients for cfg->seconds, feeding the daemon at cfg->rate throughout; on_line is called per line read.
+typedef void (*bench_on_line_t)(bench_client_t *const client, const long long now_ns, const long long fed_ns, bench_samples_t *const samples);
+
+static bool bench_clients_run(bench_daemon_t *const daemon_process, const bench_config_t *const cfg, bench_client_t *const clients, const int epoll_fd,
+                              const bench_on_line_t on_line, bench_samples_t *const samples) {
+    const long long interval_ns = 1000000000LL / cfg->rate, end_ns = perf_now_ns() + (long long)cfg->seconds * 1000000000LL;
+    long long next_feed_ns = perf_now_ns(), fed_ns = 0;
+    struct epoll_event events[CLIENT_EVENTS_MAX];
+    for (long long now_ns = perf_now_ns(); now_ns < end_ns; now_ns = perf_now_ns()) {
+        if (now_ns >= next_feed_ns) {
+            fed_ns = perf_now_ns();
+            if (!bench_daemon_feed(daemon_process))
+                return false;
+            next_feed_ns += interval_ns;
+        }
+        const long long wait_ns = next_feed_ns - perf_now_ns();
+        const int n             = epoll_wait(epoll_fd, events, CLIENT_EVENTS_MAX, (wait_ns > 0) ? (int)(wait_ns / 1000000) : 0);
+        const long long read_ns = perf_now_ns();
+        for (int i = 0; i < n; i++) {
+            bench_client_t *const client = &clients[events[i].data.u32];
+            for (unsigned int lines = bench_lines(client); lines > 0; lines--)
+                on_line(client, read_ns, fed_ns, samples);
+        }
+    }
+    return true;
+}
+
+static void bench_poller_line(bench_client_t *const client, const long long now_ns, const long long fed_ns, bench_samples_t *const samples) {
+    (void)fed_ns;
+    bench_sample(samples, now_ns - client->sent_ns);
+    client->sent_ns = perf_now_ns();
+    bench_send(client->fd, "?POLL;\n");
+}
+
+static void bench_watcher_line(bench_client_t *const client, const long long now_ns, const long long fed_ns, bench_samples_t *const samples) {
+    (void)client;
+    if (fed_ns > 0)
+        bench_sample(samples, now_ns - fed_ns);
+}
+
+static bool bench_load(bench_daemon_t *const daemon_process, const bench_config_t *const cfg, const bool watch, bench_samples_t *const samples) {
+    bench_client_t *const clients = calloc(cfg->clients, sizeof(bench_client_t));
+    int epoll_fd                  = -1;
+    if (clients == NULL) {
+        perror("calloc");
+        return false;
+    }
+    fprintf(stderr, "bench: %u %s for %us, fed at %uHz\n", cfg->clients, watch ? "watchers" : "pollers", cfg->seconds, cfg->rate);
+    bool ok = bench_clients_open(clients, cfg->clients, cfg->port, &epoll_fd);
+    if (ok && watch) {
+        // The answer to the ?WATCH itself is not a delivery, so it is read off before the clock starts.
+        for (unsigned int i = 0; ok && i < cfg->clients; i++)
+            ok = bench_send(clients[i].fd, "?WATCH={\"enable\":true}\n");
+        for (unsigned int i = 0; ok && i < cfg->clients; i++) {
+            struct pollfd pfd = { .fd = clients[i].fd, .events = POLLIN };
+            ok                = poll(&pfd, 1, BENCH_READY_MS) == 1 && bench_lines(&clients[i]) > 0;
+        }
+    } else
+        for (unsigned int i = 0; ok && i < cfg->clients; i++) {
+            clients[i].sent_ns = perf_now_ns();
+            ok                 = bench_send(clients[i].fd, "?POLL;\n");
+        }
+    const long long begin = perf_now_ns();
+    ok                    = ok && bench_clients_run(daemon_process, cfg, clients, epoll_fd, watch ? bench_watcher_line : bench_poller_line, samples);
+    const double elapsed  = (double)(perf_now_ns() - begin) / 1e9;
+    bench_clients_close(clients, cfg->clients, epoll_fd);
+    free(clients);
+
+    printf(",\"%s\":{\"clients\":%u,\"seconds\":%.3f,\"%s\":%zu,\"per_s\":%.0f,", watch ? "watchers" : "pollers", cfg->clients, elapsed, watch ? "updates" : "requests",
+           samples->count, (double)samples->count / elapsed);
+    bench_print_latency(samples);
+    printf("}");
+    return ok;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+static const struct option bench_options[] = { // defaults
+    { "daemon", required_argument, 0, 'd' }, { "port", required_argument, 0, 'p' },    { "epochs", required_argument, 0, 'e' },
+    { "clients", required_argument, 0, 'c' }, { "seconds", required_argument, 0, 's' }, { "rate", required_argument, 0, 'r' },
+    { "help", no_argument, 0, '?' },          { 0, 0, 0, 0 }
+};
+
+static void bench_usage(const char *const prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("Options:\n");
+    printf("  -d, --daemon PATH        The daemon to run, an NMEA build (default ./gpsd_averaged)\n");
+    printf("  -p, --port PORT          Port the daemon listens on for the load (default 29480)\n");
+    printf("  -e, --epochs N           Epochs in the pipeline stream (default 200000)\n");
+    printf("  -c, --clients N          Concurrent pollers, then watchers (default 100)\n");
+    printf("  -s, --seconds SECONDS    Duration of each load (default 5)\n");
+    printf("  -r, --rate HZ            Epochs fed per second during the load (default 10)\n");
+    printf("  --help                   This help\n");
+}
+
+int main(const int argc, char *const argv[]) {
+    bench_config_t cfg = { .daemon = "./gpsd_averaged", .port = 29480, .epochs = 200000, .clients = 100, .seconds = 5, .rate = 10 };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "d:p:e:c:s:r:?", bench_options, NULL)) != -1)
+        switch (opt) {
+        case 'd':
+            cfg.daemon = optarg;
+            break;
+        case 'p':
+            cfg.port = (unsigned short)atoi(optarg);
+            break;
+        case 'e':
+            cfg.epochs = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            cfg.clients = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            cfg.seconds = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            cfg.rate = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case '?':
+        default:
+            bench_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    if (cfg.epochs == 0 || cfg.clients == 0 || cfg.clients > CLIENT_MAX || cfg.seconds == 0 || cfg.rate == 0) {
+        fprintf(stderr, "bench: epochs, clients (at most %d), seconds and rate must be positive\n", CLIENT_MAX);
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    struct utsname uts;
+    uname(&uts);
+    printf("{\"machine\":\"%s\",\"source\":\"" GPS_SOURCE_NAME "\"", uts.machine);
+    fprintf(stderr, "bench: micro\n");
+    bench_micro();
+
+    bench_samples_t samples = { .values = malloc(BENCH_SAMPLES_MAX * sizeof(long long)) };
+    bench_daemon_t daemon_process = { .pid = -1, .feed_fd = -1, .dated = true };
+    bool ok = (samples.values != NULL) && bench_undated(&cfg) && bench_daemon_start(&daemon_process, &cfg) && bench_pipeline(&daemon_process, &cfg);
+    ok = ok && bench_load(&daemon_process, &cfg, false, &samples);
+    samples.count = 0;
+    ok = ok && bench_load(&daemon_process, &cfg, true, &samples);
+    bench_daemon_stop(&daemon_process);
+    free(samples.values);
+    printf(",\"ok\":%s}\n", ok ? "true" : "false");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
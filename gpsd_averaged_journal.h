@@ -0,0 +1,161 @@
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+// The fix journal gpsd_averaged keeps with --journal DIR: every fix accepted into the average, and with
+// --journal-rejected every one rejected too, appended as a fixed-size binary record to a segment file of fixed
+// layout, for audits and re-surveys long after the window has let them go. A reader maps a segment and reads any
+// record directly, with no parsing; one still being written can be read as it grows.
+//
+// Each receiver writes segments of its own, named DIR/gpsd_averaged-DEVICE-CREATED.journal, with DEVICE its index
+// in the order given and CREATED the Unix time in milliseconds at which the segment was made, so that a plain
+// sort lists them oldest first. A segment holds GPSD_AVERAGED_JOURNAL_CAPACITY records at most (a day and more at
+// 10Hz, 20MB), in order of time: a new one is begun when it is full, and also when the receiver's time goes
+// backwards or the position moves too far from the segment's origin. A month at 10Hz is about 520MB.
+//
+// Records are in order of time, so a range is found by bisection: the header's sparse index holds the time of
+// every GPSD_AVERAGED_JOURNAL_STRIDE'th record, and narrows the search to that many records before it touches
+// them. The count is advanced only once a record is complete, so a copy of the records below it is consistent.
+//
+//     const gpsd_averaged_journal_t *journal = gpsd_averaged_journal_open(path);
+//     for (uint32_t i = gpsd_averaged_journal_find(journal, from_ms); journal != NULL && i < gpsd_averaged_journal_count(journal); i++) {
+//         double lat, lon, alt;
+//         gpsd_averaged_journal_position(journal, i, &lat, &lon, &alt);
+//         printf("%lld %.8f,%.8f,%.2f\n", (long long)gpsd_averaged_journal_time(journal, i), lat, lon, alt);
+//     }
+//
+// The layout only ever changes with the version, which readers should check (gpsd_averaged_journal_open() does).
+
+#ifndef GPSD_AVERAGED_JOURNAL_H
+#define GPSD_AVERAGED_JOURNAL_H
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GPSD_AVERAGED_JOURNAL_MAGIC 0x4a535047 // "GPSJ", little-endian
+#define GPSD_AVERAGED_JOURNAL_VERSION 1
+#define GPSD_AVERAGED_JOURNAL_CAPACITY (1u << 20) // records per segment
+#define GPSD_AVERAGED_JOURNAL_STRIDE 4096         // records per entry of the index
+#define GPSD_AVERAGED_JOURNAL_INDEX (GPSD_AVERAGED_JOURNAL_CAPACITY / GPSD_AVERAGED_JOURNAL_STRIDE)
+#define GPSD_AVERAGED_JOURNAL_HEADER_SIZE 4096 // records begin a page into the file
+#define GPSD_AVERAGED_JOURNAL_METRES_DEGREE 111320.0 // the ENU offsets' metres per degree of latitude, and of longitude at the equator
+
+// flags
+#define GPSD_AVERAGED_JOURNAL_ACCEPTED 0x01 // into the average; otherwise rejected, as one of the following says
+#define GPSD_AVERAGED_JOURNAL_OUTLIER 0x02  // by the average, as an outlier or disagreeing with a restored checkpoint
+#define GPSD_AVERAGED_JOURNAL_QUALITY 0x04  // for too few satellites, too high HDOP or too weak signals
+#define GPSD_AVERAGED_JOURNAL_3D 0x08       // a 3D fix, otherwise 2D
+#define GPSD_AVERAGED_JOURNAL_GST 0x10      // the receiver gave its errors for the fix (GST)
+
+typedef struct {
+    uint32_t time;         // milliseconds since the segment's start
+    float east, north, up; // metres from the segment's origin, along a plane tangent to it
+    uint16_t hdop;         // hundredths
+    uint8_t satellites;    // used in the fix
+    uint8_t flags;         // GPSD_AVERAGED_JOURNAL_ACCEPTED and so on
+} gpsd_averaged_journal_record_t;
+
+typedef struct {
+    uint32_t magic;       // GPSD_AVERAGED_JOURNAL_MAGIC
+    uint32_t version;     // GPSD_AVERAGED_JOURNAL_VERSION
+    uint32_t header_size; // GPSD_AVERAGED_JOURNAL_HEADER_SIZE
+    uint32_t record_size; // sizeof(gpsd_averaged_journal_record_t)
+    uint32_t capacity;    // GPSD_AVERAGED_JOURNAL_CAPACITY
+    uint32_t count;       // records written, advanced as each is complete
+    int64_t start;        // the first record's time, milliseconds since the epoch, by the receiver's clock
+    double origin_lat, origin_lon, origin_alt; // the first record's position, degrees, degrees, metres
+    uint32_t device;                           // index of the receiver, in the order given
+    uint32_t reserved;
+    char device_path[64];                        // and its path, truncated if need be
+    uint32_t index[GPSD_AVERAGED_JOURNAL_INDEX]; // time of every GPSD_AVERAGED_JOURNAL_STRIDE'th record, as it is written
+} gpsd_averaged_journal_t;
+
+_Static_assert(sizeof(gpsd_averaged_journal_record_t) == 20, "gpsd_averaged_journal_record_t layout");
+_Static_assert(sizeof(gpsd_averaged_journal_t) == 1152, "gpsd_averaged_journal_t layout");
+_Static_assert(sizeof(gpsd_averaged_journal_t) <= GPSD_AVERAGED_JOURNAL_HEADER_SIZE, "gpsd_averaged_journal_t size");
+
+#define GPSD_AVERAGED_JOURNAL_SIZE ((size_t)GPSD_AVERAGED_JOURNAL_HEADER_SIZE + (size_t)GPSD_AVERAGED_JOURNAL_CAPACITY * sizeof(gpsd_averaged_journal_record_t))
+
+static inline const gpsd_averaged_journal_record_t *gpsd_averaged_journal_records(const gpsd_averaged_journal_t *const journal) {
+    return (const gpsd_averaged_journal_record_t *)(const void *)((const char *)journal + journal->header_size);
+}
+
+// The records complete at the time of the call; the acquire load makes them safe to read.
+static inline uint32_t gpsd_averaged_journal_count(const gpsd_averaged_journal_t *const journal) { return __atomic_load_n(&journal->count, __ATOMIC_ACQUIRE); }
+
+// Milliseconds since the epoch.
+static inline int64_t gpsd_averaged_journal_time(const gpsd_averaged_journal_t *const journal, const uint32_t i) {
+    return journal->start + gpsd_averaged_journal_records(journal)[i].time;
+}
+
+static inline void gpsd_averaged_journal_position(const gpsd_averaged_journal_t *const journal, const uint32_t i, double *const lat, double *const lon, double *const alt) {
+    const gpsd_averaged_journal_record_t *const record = &gpsd_averaged_journal_records(journal)[i];
+    *lat = journal->origin_lat + record->north / GPSD_AVERAGED_JOURNAL_METRES_DEGREE;
+    *lon = journal->origin_lon + record->east / (GPSD_AVERAGED_JOURNAL_METRES_DEGREE * cos(journal->origin_lat * M_PI / 180.0));
+    *alt = journal->origin_alt + record->up;
+}
+
+// The first record at or after the time, milliseconds since the epoch, or the count if there is none.
+static inline uint32_t gpsd_averaged_journal_find(const gpsd_averaged_journal_t *const journal, const int64_t time) {
+    if (journal == NULL)
+        return 0;
+    const uint32_t count = gpsd_averaged_journal_count(journal);
+    if (count == 0 || time <= journal->start)
+        return 0;
+    if (time - journal->start > UINT32_MAX)
+        return count;
+    const uint32_t offset = (uint32_t)(time - journal->start);
+    uint32_t low = 0, high = (count - 1) / GPSD_AVERAGED_JOURNAL_STRIDE + 1; // the index entries written
+    while (high - low > 1) {
+        const uint32_t middle = low + (high - low) / 2;
+        if (journal->index[middle] < offset)
+            low = middle;
+        else
+            high = middle;
+    }
+    const gpsd_averaged_journal_record_t *const records = gpsd_averaged_journal_records(journal);
+    uint32_t first = low * GPSD_AVERAGED_JOURNAL_STRIDE, last = (high * GPSD_AVERAGED_JOURNAL_STRIDE < count) ? high * GPSD_AVERAGED_JOURNAL_STRIDE : count;
+    while (first < last) {
+        const uint32_t middle = first + (last - first) / 2;
+        if (records[middle].time < offset)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    return first;
+}
+
+// Maps a segment read-only, or returns NULL if it cannot be read or is not a layout this header understands. The
+// mapping is of the full capacity whatever the file's size, as a finished segment is cut down to its records and
+// one being written grows into it.
+static inline const gpsd_averaged_journal_t *gpsd_averaged_journal_open(const char *const path) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= GPSD_AVERAGED_JOURNAL_HEADER_SIZE)
+        map = mmap(NULL, GPSD_AVERAGED_JOURNAL_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    const gpsd_averaged_journal_t *const journal = (const gpsd_averaged_journal_t *)map;
+    if (journal->magic != GPSD_AVERAGED_JOURNAL_MAGIC || journal->version != GPSD_AVERAGED_JOURNAL_VERSION || journal->header_size != GPSD_AVERAGED_JOURNAL_HEADER_SIZE ||
+        journal->record_size != sizeof(gpsd_averaged_journal_record_t) || journal->capacity != GPSD_AVERAGED_JOURNAL_CAPACITY ||
+        (size_t)st.st_size < journal->header_size + (size_t)gpsd_averaged_journal_count(journal) * journal->record_size) {
+        munmap(map, GPSD_AVERAGED_JOURNAL_SIZE);
+        return NULL;
+    }
+    return journal;
+}
+
+static inline void gpsd_averaged_journal_close(const gpsd_averaged_journal_t *const journal) { munmap((void *)(uintptr_t)journal, GPSD_AVERAGED_JOURNAL_SIZE); }
+
+#endif // GPSD_AVERAGED_JOURNAL_H
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
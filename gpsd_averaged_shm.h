@@ -0,0 +1,112 @@
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
+
+// The shared-memory record gpsd_averaged publishes with --shm NAME: the averaged position as of the last accepted
+// fix, in a POSIX shared-memory object of fixed layout. A local reader maps it once and can then read the current
+// position at any rate with no syscall, no parsing and no effect on the daemon, which never waits for readers.
+//
+// The record is written under a seqlock: the sequence is odd while an update is in progress and advances again
+// when it completes, so a copy taken between two equal, even readings of it is consistent. Readers should use
+// gpsd_averaged_shm_read() rather than the fields directly. A record with no samples holds no position, as before
+// the first fix and after the daemon exits; the object is also removed at exit, so a fresh open then fails.
+//
+//     const gpsd_averaged_shm_t *shm = gpsd_averaged_shm_open(GPSD_AVERAGED_SHM_NAME);
+//     gpsd_averaged_position_t position;
+//     if (shm != NULL && gpsd_averaged_shm_read(shm, &position) && position.samples > 0)
+//         printf("%.8f,%.8f,%.2f\n", position.lat, position.lon, position.alt);
+//
+// The layout only ever changes with the version, which readers should check (gpsd_averaged_shm_open() does).
+
+#ifndef GPSD_AVERAGED_SHM_H
+#define GPSD_AVERAGED_SHM_H
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GPSD_AVERAGED_SHM_NAME "/gpsd_averaged"
+#define GPSD_AVERAGED_SHM_MAGIC 0x41535047 // "GPSA", little-endian
+#define GPSD_AVERAGED_SHM_VERSION 1
+#define GPSD_AVERAGED_SHM_RETRIES 1000 // reads attempted before giving up on a writer that never finishes
+
+typedef enum {
+    GPSD_AVERAGED_GATHERING,
+    GPSD_AVERAGED_STABILISING,
+    GPSD_AVERAGED_MOVING,
+    GPSD_AVERAGED_SAMPLING,
+    GPSD_AVERAGED_REFINING,
+    GPSD_AVERAGED_AGING,
+    GPSD_AVERAGED_CONVERGING,
+    GPSD_AVERAGED_CONVERGED
+} gpsd_averaged_convergence_t;
+#define GPSD_AVERAGED_CONVERGENCE_NAMES { "GATHERING", "STABILISING", "MOVING", "SAMPLING", "REFINING", "AGING", "CONVERGING", "CONVERGED" }
+
+typedef struct {
+    double lat, lon, alt;             // degrees, degrees, metres; as the TPV for the daemon's filter
+    double lat_err, lon_err, alt_err; // one standard deviation, metres; as the TPV, the cumulative mean's standard error for simple
+    double confidence;                // horizontal radius at two standard deviations, metres
+    int64_t fix_time;                 // last accepted fix, seconds since the epoch
+    int64_t first_fix;                // first accepted fix, seconds since the epoch
+    uint64_t samples;                 // fixes accepted into the average, zero when there is no position
+    uint64_t outliers;                // fixes rejected as outliers
+    uint32_t window;                  // samples held in the averaging window
+    uint32_t convergence;             // gpsd_averaged_convergence_t
+    uint32_t filter;                  // 0 simple, 1 window, 2 kalman, 3 median
+    uint32_t anchored;                // 1 when averaging a fixed installation
+} gpsd_averaged_position_t;
+
+typedef struct {
+    uint32_t magic;    // GPSD_AVERAGED_SHM_MAGIC
+    uint32_t version;  // GPSD_AVERAGED_SHM_VERSION
+    uint32_t size;     // sizeof(gpsd_averaged_shm_t)
+    uint32_t sequence; // seqlock, odd while the position is being written
+    gpsd_averaged_position_t position;
+} gpsd_averaged_shm_t;
+
+_Static_assert(sizeof(gpsd_averaged_position_t) == 104, "gpsd_averaged_position_t layout");
+_Static_assert(sizeof(gpsd_averaged_shm_t) == 120, "gpsd_averaged_shm_t layout");
+
+// The acquire load keeps the copy from being read ahead of the first sequence, and the fence keeps it from being
+// read after the second; a copy torn by a concurrent update is discarded by the comparison and taken again.
+static inline bool gpsd_averaged_shm_read(const gpsd_averaged_shm_t *const shm, gpsd_averaged_position_t *const position) {
+    for (int attempt = 0; attempt < GPSD_AVERAGED_SHM_RETRIES; attempt++) {
+        const uint32_t sequence = __atomic_load_n(&shm->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1)
+            continue;
+        *position = shm->position;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shm->sequence, __ATOMIC_RELAXED) == sequence)
+            return true;
+    }
+    return false;
+}
+
+// Maps the record read-only, or returns NULL if it does not exist or is not a layout this header understands.
+static inline const gpsd_averaged_shm_t *gpsd_averaged_shm_open(const char *const name) {
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(gpsd_averaged_shm_t))
+        map = mmap(NULL, sizeof(gpsd_averaged_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    const gpsd_averaged_shm_t *const shm = (const gpsd_averaged_shm_t *)map;
+    if (shm->magic != GPSD_AVERAGED_SHM_MAGIC || shm->version != GPSD_AVERAGED_SHM_VERSION || shm->size != sizeof(gpsd_averaged_shm_t)) {
+        munmap(map, sizeof(gpsd_averaged_shm_t));
+        return NULL;
+    }
+    return shm;
+}
+
+static inline void gpsd_averaged_shm_close(const gpsd_averaged_shm_t *const shm) { munmap((void *)(uintptr_t)shm, sizeof(gpsd_averaged_shm_t)); }
+
+#endif // GPSD_AVERAGED_SHM_H
+
+// ------------------------------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------------------------------
@@ -8,10 +8,13 @@
 // binary protocols, PPS). The device is opened read-only, so nothing is ever written to the receiver and
 // whatever NMEA it emits by default is what gets parsed.
 //
-// Only GGA and GSA are used: GGA carries position, altitude, satellites-used and HDOP, and is emitted once
-// per epoch; GSA carries the 2D/3D fix mode. A fix is reported to the caller (MODE_SET) only on GGA, so the
-// caller sees exactly one fix per epoch, matching the cadence of gpsd's TPV reports. Reporting per sentence
-// would count each epoch five or so times over and falsely shrink the averaged uncertainty.
+// GGA carries position, altitude, satellites-used and HDOP, and is emitted once per epoch; GSA carries the
+// 2D/3D fix mode. A fix is reported to the caller (MODE_SET) only on GGA, so the caller sees exactly one fix
+// per epoch, matching the cadence of gpsd's TPV reports. Reporting per sentence would count each epoch five or
+// so times over and falsely shrink the averaged uncertainty. RMC and ZDA are read for their date, which GGA
+// lacks, so that fix.time is a full UTC time (TIME_SET) as it is from gpsd. GST (the receiver's own error
+// estimates) and GSV (satellites in view, with their C/N0) are kept in gst and skyview as libgps keeps them,
+// the latest seen, for the caller to read alongside the next fix; they are not reports of their own.
 
 #ifndef GPS_NMEA_H
 #define GPS_NMEA_H
@@ -19,11 +22,15 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 // ------------------------------------------------------------------------------------------------------------------------
@@ -39,17 +46,33 @@
 #define MODE_SET (1u << 0)
 #define LATLON_SET (1u << 1)
 #define ALTITUDE_SET (1u << 2)
+#define TIME_SET (1u << 3)
+
+#define MAXCHANNELS 72
+#define GNSSID_GPS 0
+#define GNSSID_SBAS 1
+#define GNSSID_GAL 2
+#define GNSSID_BD 3
+#define GNSSID_IMES 4
+#define GNSSID_QZSS 5
+#define GNSSID_GLO 6
+#define GNSSID_IRNSS 7
 
 #define WATCH_ENABLE (1u << 0)
 #define WATCH_DISABLE (1u << 1)
 #define WATCH_JSON (1u << 4)
 
-#define GPS_NMEA_BUFFER 1024
+#define GPS_NMEA_RING 4096 // power of two: positions are free-running counters masked into the ring
+#define GPS_NMEA_LINE_MAX 256 // longer than any NMEA sentence (82) or u-blox PUBX; anything beyond is noise
 #define GPS_NMEA_FIELDS 24
 #define GPS_NMEA_BAUD_DEF B9600
 #define GPS_NMEA_TALKER_SZ 3 // '$' plus the two character talker id, e.g. "$GP", "$GN"
+#define GPS_NMEA_HEADER_SZ (GPS_NMEA_TALKER_SZ + 3)
+
+typedef struct timespec timespec_t;
 
 struct gps_fix_t {
+    timespec_t time; // UTC of the fix; without any date seen yet, counted in days from 1970-01-01
     int mode;
     double latitude, longitude;
     double altMSL, altHAE;
@@ -59,19 +82,58 @@ struct gps_dop_t {
     double hdop;
 };
 
+struct gst_t {
+    timespec_t utctime;
+    double rms_deviation;
+    double smajor_deviation, sminor_deviation, smajor_orientation;
+    double lat_err_deviation, lon_err_deviation, alt_err_deviation; // one standard deviation, metres
+};
+
+struct satellite_t {
+    double ss; // C/N0, dB-Hz; NAN when not tracked
+    bool used;
+    short PRN;
+    unsigned char gnssid, sigid;
+};
+
 struct gps_data_t {
     int gps_fd;
     unsigned int set;
     struct gps_fix_t fix;
     struct gps_dop_t dop;
     int satellites_used;
+    struct gst_t gst;
+    int satellites_visible;
+    struct satellite_t skyview[MAXCHANNELS];
+    timespec_t skyview_time; // fix time of the epoch the skyview was completed in
     // shim private state
-    char buffer[GPS_NMEA_BUFFER];
-    size_t buffer_length;
-    int gsa_mode;    // fix mode from the most recent GSA
-    double gsa_hdop; // HDOP from the most recent GSA, used when GGA leaves the field empty
+    char ring[GPS_NMEA_RING];
+    size_t ring_head, ring_tail; // bytes ever read and ever consumed
+    size_t frame_scan;           // bytes of the line at ring_tail scanned so far
+    size_t frame_star;           // offset of the '*' in that line, 0 until seen
+    unsigned long frame_xor;     // checksum so far, folded to a byte only once the line is complete
+    bool frame_skip;             // line is not wanted, or overlong: consume it without checksumming
+    bool frame_ready;            // a complete line sits at ring_tail, frame_scan long
+    char line[GPS_NMEA_LINE_MAX]; // a line that wraps the end of the ring, made contiguous
+    int gsa_mode;                // fix mode from the most recent GSA
+    double gsa_hdop;             // HDOP from the most recent GSA, used when GGA leaves the field empty
+    long utc_day;                // days since the epoch, from the most recent RMC or ZDA, else counted across midnights
+    double utc_day_tod;          // time of day of the sentence utc_day was taken from, seconds
+    bool utc_dated;              // utc_day came from a date rather than counting
+    bool endable;                // a regular file or a pipe, for which a read of nothing is the end; a tty's has just nothing yet
+    bool eof;                    // a read returned nothing at all: a file read to its end, or a pipe whose writer closed
+    unsigned long stat_reads;    // read syscalls made
+    unsigned long stat_bytes;    // bytes they returned
+    unsigned long stat_checksum; // lines dropped for a missing or bad checksum
+    unsigned long stat_overlong; // lines dropped for being longer than any sentence
 };
 
+// A view of one field of a sentence held in the ring: not NUL terminated, and only valid until consumed.
+typedef struct {
+    const char *data;
+    size_t length;
+} gps_nmea_field_t;
+
 // ------------------------------------------------------------------------------------------------------------------------
 
 static speed_t __gps_nmea_baud(const char *const baud) {
@@ -93,74 +155,171 @@ static speed_t __gps_nmea_baud(const char *const baud) {
     }
 }
 
-static double __gps_nmea_number(const char *const field) {
-    if (field == NULL || *field == '\0')
+// Field parsers are specialised to what NMEA carries, plain unsigned decimals with an optional fraction, rather
+// than the generality (locale, exponents, hex, inf/nan) of strtod/atoi. Digits are accumulated as an integer
+// and scaled once, which is also exact for the 4-5 fractional digits of minutes of arc.
+static const double __gps_nmea_scale[] = { 1e0, 1e-1, 1e-2, 1e-3, 1e-4, 1e-5, 1e-6, 1e-7, 1e-8, 1e-9, 1e-10, 1e-11, 1e-12 };
+#define GPS_NMEA_DIGITS_MAX ((sizeof(__gps_nmea_scale) / sizeof(__gps_nmea_scale[0])) - 1)
+
+// Parses [-]digits[.digits] into an integer mantissa and a count of fractional digits; false if malformed.
+static bool __gps_nmea_mantissa(const gps_nmea_field_t field, unsigned long long *const mantissa, size_t *const decimals, bool *const negative) {
+    const char *p = field.data, *const end = field.data + field.length;
+    *mantissa = 0;
+    *decimals = 0;
+    *negative = (p < end && *p == '-');
+    if (*negative)
+        p++;
+    bool digits = false, fraction = false;
+    for (; p < end; p++) {
+        if (*p >= '0' && *p <= '9') {
+            if (fraction && *decimals == GPS_NMEA_DIGITS_MAX)
+                continue; // precision beyond any receiver's, ignored rather than overflowing
+            *mantissa = *mantissa * 10 + (unsigned long long)(*p - '0');
+            *decimals += fraction ? 1 : 0;
+            digits = true;
+        } else if (*p == '.' && !fraction)
+            fraction = true;
+        else
+            return false;
+    }
+    return digits;
+}
+
+static double __gps_nmea_number(const gps_nmea_field_t field) {
+    unsigned long long mantissa;
+    size_t decimals;
+    bool negative;
+    if (!__gps_nmea_mantissa(field, &mantissa, &decimals, &negative))
         return NAN;
-    char *end;
-    const double value = strtod(field, &end);
-    return (end == field) ? NAN : value;
+    const double value = (double)mantissa * __gps_nmea_scale[decimals];
+    return negative ? -value : value;
+}
+
+// Unsigned integer fields (fix quality, satellites, fix mode); -1 when empty or malformed.
+static int __gps_nmea_integer(const gps_nmea_field_t field) {
+    if (field.length == 0 || field.length > 9)
+        return -1;
+    unsigned int value = 0; // unsigned, as nine digits cannot overflow it but the optimiser cannot see that
+    for (size_t i = 0; i < field.length; i++) {
+        if (field.data[i] < '0' || field.data[i] > '9')
+            return -1;
+        value = value * 10 + (unsigned int)(field.data[i] - '0');
+    }
+    return (int)value;
 }
 
 // NMEA angles are ddmm.mmmm / dddmm.mmmm with the hemisphere in a separate field.
-static double __gps_nmea_degrees(const char *const field, const char *const hemisphere) {
-    const double value = __gps_nmea_number(field);
-    if (!isfinite(value) || hemisphere == NULL || *hemisphere == '\0')
+static double __gps_nmea_degrees(const gps_nmea_field_t field, const gps_nmea_field_t hemisphere) {
+    unsigned long long mantissa;
+    size_t decimals;
+    bool negative;
+    if (hemisphere.length == 0 || !__gps_nmea_mantissa(field, &mantissa, &decimals, &negative) || negative)
         return NAN;
-    const double degrees = floor(value / 100.0);
-    const double result  = degrees + (value - degrees * 100.0) / 60.0;
-    return (*hemisphere == 'S' || *hemisphere == 'W') ? -result : result;
+    unsigned long long unit = 100;
+    for (size_t i = 0; i < decimals; i++)
+        unit *= 10;
+    const unsigned long long degrees = mantissa / unit, minutes = mantissa % unit;
+    const double result = (double)degrees + (double)minutes * __gps_nmea_scale[decimals] / 60.0;
+    return (*hemisphere.data == 'S' || *hemisphere.data == 'W') ? -result : result;
 }
 
-static bool __gps_nmea_checksum(const char *const sentence) {
-    const char *const star = strrchr(sentence, '*');
-    if (star == NULL || strlen(star) < 3)
-        return false;
-    unsigned char sum = 0;
-    for (const char *p = sentence + 1; p < star; p++)
-        sum ^= (unsigned char)*p;
-    return (unsigned char)strtoul(star + 1, NULL, 16) == sum;
+// Splits a verified sentence, without its "*CS" suffix, into views on the commas. Counts are unsigned so that
+// the bound checks carry no signed-overflow assumptions for the optimiser.
+static size_t __gps_nmea_split(const char *const sentence, const size_t length, gps_nmea_field_t *const fields, const size_t fields_max) {
+    const char *p = sentence, *const end = sentence + length;
+    size_t count = 0;
+    while (count < fields_max) {
+        const char *const comma = memchr(p, ',', (size_t)(end - p));
+        fields[count++]         = (gps_nmea_field_t){ .data = p, .length = (size_t)(((comma != NULL) ? comma : end) - p) };
+        if (comma == NULL)
+            break;
+        p = comma + 1;
+    }
+    return count;
 }
 
-// Splits in place; must be called only after the checksum has been verified, as it drops the "*CS" suffix.
-// Counts are unsigned so that the bound checks carry no signed-overflow assumptions for the optimiser.
-static size_t __gps_nmea_split(char *const sentence, const char **const fields, const size_t fields_max) {
-    char *const star = strrchr(sentence, '*');
-    if (star != NULL)
-        *star = '\0';
-    size_t count    = 0;
-    fields[count++] = sentence;
-    for (char *p = sentence; *p != '\0' && count < fields_max; p++)
-        if (*p == ',') {
-            *p              = '\0';
-            fields[count++] = p + 1;
-        }
-    return count;
+static gps_nmea_field_t __gps_nmea_field(const gps_nmea_field_t *const fields, const size_t count, const size_t index) {
+    return (index < count) ? fields[index] : (gps_nmea_field_t){ .data = "", .length = 0 };
+}
+
+// UTC time of day, hhmmss[.ss], in seconds; NAN if empty or malformed.
+static double __gps_nmea_tod(const gps_nmea_field_t field) {
+    unsigned long long mantissa;
+    size_t decimals;
+    bool negative;
+    if (!__gps_nmea_mantissa(field, &mantissa, &decimals, &negative) || negative)
+        return NAN;
+    unsigned long long unit = 1;
+    for (size_t i = 0; i < decimals; i++)
+        unit *= 10;
+    const unsigned long long hhmmss = mantissa / unit, hours = hhmmss / 10000, minutes = (hhmmss / 100) % 100, seconds = hhmmss % 100;
+    if (hours > 23 || minutes > 59 || seconds > 60) // 60: a leap second
+        return NAN;
+    return (double)(hours * 3600 + minutes * 60 + seconds) + (double)(mantissa % unit) * __gps_nmea_scale[decimals];
 }
 
-static const char *__gps_nmea_field(const char *const *const fields, const size_t count, const size_t index) { return (index < count) ? fields[index] : ""; }
+// Days since 1970-01-01 of a proleptic Gregorian date, as days_from_civil() in Howard Hinnant's date algorithms.
+static long __gps_nmea_days(const int year, const int month, const int day) {
+    const long y = (long)year - (month <= 2), era = (y >= 0 ? y : y - 399) / 400, yoe = y - era * 400;
+    const long doy = (153 * (long)(month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1, doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
 
-static void __gps_nmea_sentence(struct gps_data_t *const gps_handle, char *const sentence) {
-    if (!__gps_nmea_checksum(sentence))
+// A date, as the day of the sentence that carried it at time of day tod; ignored if either is missing or out of range.
+static void __gps_nmea_date(struct gps_data_t *const gps_handle, const double tod, const int year, const int month, const int day) {
+    if (!isfinite(tod) || year < 1980 || month < 1 || month > 12 || day < 1 || day > 31)
         return;
-    const char *fields[GPS_NMEA_FIELDS];
-    const size_t count = __gps_nmea_split(sentence, fields, GPS_NMEA_FIELDS);
-    if (count < 1 || strlen(fields[0]) < (size_t)(GPS_NMEA_TALKER_SZ + 3))
-        return;
-    const char *const type = fields[0] + GPS_NMEA_TALKER_SZ; // accept any talker: $GP, $GN, $GL, $GA, ...
+    gps_handle->utc_day     = __gps_nmea_days(year, month, day);
+    gps_handle->utc_day_tod = tod;
+    gps_handle->utc_dated   = true;
+}
 
-    // GSA: [2] = fix mode (1 none, 2 = 2D, 3 = 3D), [16] = HDOP
-    if (strcmp(type, "GSA") == 0) {
-        gps_handle->gsa_mode = atoi(__gps_nmea_field(fields, count, 2));
-        gps_handle->gsa_hdop = __gps_nmea_number(__gps_nmea_field(fields, count, 16));
+// A time of a sentence from its time of day and the last date seen. A date usually arrives after the GGA of the
+// same epoch, so it is the previous epoch's, and across midnight the two differ by a day: a time of day more than
+// half a day either side of the date's is taken to be on the neighbouring day. Without a date, days are counted.
+static void __gps_nmea_time(struct gps_data_t *const gps_handle, const double tod, timespec_t *const time) {
+    if (!isfinite(tod))
         return;
+    long day = gps_handle->utc_day;
+    if (tod < gps_handle->utc_day_tod - 43200.0)
+        day++;
+    else if (tod > gps_handle->utc_day_tod + 43200.0 && gps_handle->utc_dated)
+        day--;
+    if (!gps_handle->utc_dated) {
+        gps_handle->utc_day     = day;
+        gps_handle->utc_day_tod = tod;
     }
-    // GGA: [2][3] = lat, [4][5] = lon, [6] = quality, [7] = satellites, [8] = HDOP, [9] = altitude MSL,
-    //      [11] = geoid separation
-    if (strcmp(type, "GGA") != 0)
-        return;
+    const double seconds = floor(tod);
+    time->tv_sec         = (time_t)(day * 86400 + (long)seconds);
+    time->tv_nsec        = (long)((tod - seconds) * 1e9 + 0.5);
+}
 
-    gps_handle->set = MODE_SET;
-    if (atoi(__gps_nmea_field(fields, count, 6)) <= 0) { // 0 = fix unavailable
+// RMC: [1] = time, [9] = date ddmmyy (two digit years taken as 20yy)
+static void __gps_nmea_rmc(struct gps_data_t *const gps_handle, const gps_nmea_field_t *const fields, const size_t count) {
+    const gps_nmea_field_t date = __gps_nmea_field(fields, count, 9);
+    const int ddmmyy            = (date.length == 6) ? __gps_nmea_integer(date) : -1;
+    if (ddmmyy >= 0)
+        __gps_nmea_date(gps_handle, __gps_nmea_tod(__gps_nmea_field(fields, count, 1)), 2000 + ddmmyy % 100, (ddmmyy / 100) % 100, ddmmyy / 10000);
+}
+
+// ZDA: [1] = time, [2] = day, [3] = month, [4] = year
+static void __gps_nmea_zda(struct gps_data_t *const gps_handle, const gps_nmea_field_t *const fields, const size_t count) {
+    __gps_nmea_date(gps_handle, __gps_nmea_tod(__gps_nmea_field(fields, count, 1)), __gps_nmea_integer(__gps_nmea_field(fields, count, 4)),
+                    __gps_nmea_integer(__gps_nmea_field(fields, count, 3)), __gps_nmea_integer(__gps_nmea_field(fields, count, 2)));
+}
+
+// GSA: [2] = fix mode (1 none, 2 = 2D, 3 = 3D), [16] = HDOP
+static void __gps_nmea_gsa(struct gps_data_t *const gps_handle, const gps_nmea_field_t *const fields, const size_t count) {
+    gps_handle->gsa_mode = __gps_nmea_integer(__gps_nmea_field(fields, count, 2));
+    gps_handle->gsa_hdop = __gps_nmea_number(__gps_nmea_field(fields, count, 16));
+}
+
+// GGA: [1] = time, [2][3] = lat, [4][5] = lon, [6] = quality, [7] = satellites, [8] = HDOP, [9] = altitude MSL,
+//      [11] = geoid separation
+static void __gps_nmea_gga(struct gps_data_t *const gps_handle, const gps_nmea_field_t *const fields, const size_t count) {
+    gps_handle->set = MODE_SET | (gps_handle->utc_dated ? TIME_SET : 0);
+    __gps_nmea_time(gps_handle, __gps_nmea_tod(__gps_nmea_field(fields, count, 1)), &gps_handle->fix.time);
+    if (__gps_nmea_integer(__gps_nmea_field(fields, count, 6)) <= 0) { // 0 = fix unavailable
         gps_handle->fix.mode = MODE_NO_FIX;
         return;
     }
@@ -173,11 +332,277 @@ static void __gps_nmea_sentence(struct gps_data_t *const gps_handle, char *const
     gps_handle->fix.longitude   = __gps_nmea_degrees(__gps_nmea_field(fields, count, 4), __gps_nmea_field(fields, count, 5));
     gps_handle->fix.altMSL      = altitude;
     gps_handle->fix.altHAE      = (isfinite(altitude) && isfinite(separation)) ? altitude + separation : NAN;
-    gps_handle->satellites_used = atoi(__gps_nmea_field(fields, count, 7));
+    gps_handle->satellites_used = __gps_nmea_integer(__gps_nmea_field(fields, count, 7));
     gps_handle->dop.hdop        = isfinite(hdop) ? hdop : gps_handle->gsa_hdop;
     // GSA is authoritative on 2D vs 3D; without it, infer from whether GGA carried an altitude
     gps_handle->fix.mode = (gps_handle->gsa_mode >= MODE_2D) ? gps_handle->gsa_mode : (isfinite(altitude) ? MODE_3D : MODE_2D);
-    gps_handle->set      = MODE_SET | LATLON_SET | ALTITUDE_SET;
+    gps_handle->set      = MODE_SET | LATLON_SET | ALTITUDE_SET | (gps_handle->utc_dated ? TIME_SET : 0);
+}
+
+// GST: [1] = time, [2] = RMS of the range residuals, [3][4][5] = error ellipse semi-major and semi-minor axes and
+//      orientation, [6][7][8] = latitude, longitude and altitude errors, all as one standard deviation in metres
+static void __gps_nmea_gst(struct gps_data_t *const gps_handle, const gps_nmea_field_t *const fields, const size_t count) {
+    struct gst_t *const gst = &gps_handle->gst;
+    __gps_nmea_time(gps_handle, __gps_nmea_tod(__gps_nmea_field(fields, count, 1)), &gst->utctime);
+    gst->rms_deviation      = __gps_nmea_number(__gps_nmea_field(fields, count, 2));
+    gst->smajor_deviation   = __gps_nmea_number(__gps_nmea_field(fields, count, 3));
+    gst->sminor_deviation   = __gps_nmea_number(__gps_nmea_field(fields, count, 4));
+    gst->smajor_orientation = __gps_nmea_number(__gps_nmea_field(fields, count, 5));
+    gst->lat_err_deviation  = __gps_nmea_number(__gps_nmea_field(fields, count, 6));
+    gst->lon_err_deviation  = __gps_nmea_number(__gps_nmea_field(fields, count, 7));
+    gst->alt_err_deviation  = __gps_nmea_number(__gps_nmea_field(fields, count, 8));
+}
+
+// The constellation of a GSV from its talker; "GP" also carries SBAS, which is not told apart.
+static unsigned char __gps_nmea_gnssid(const char *const talker) {
+    switch ((talker[0] << 8) | talker[1]) {
+    case ('G' << 8) | 'L':
+        return GNSSID_GLO;
+    case ('G' << 8) | 'A':
+        return GNSSID_GAL;
+    case ('G' << 8) | 'B':
+    case ('B' << 8) | 'D':
+        return GNSSID_BD;
+    case ('G' << 8) | 'Q':
+    case ('Q' << 8) | 'Z':
+        return GNSSID_QZSS;
+    case ('G' << 8) | 'I':
+        return GNSSID_IRNSS;
+    default:
+        return GNSSID_GPS;
+    }
+}
+
+// GSV: [1] = messages, [2] = message number, [3] = satellites in view, then from [4] PRN, elevation, azimuth and
+//      C/N0 (empty when not tracked) for up to four satellites, and from NMEA 4.10 a signal id last. Each message
+//      1 starts its constellation and signal afresh, and the last completes the skyview.
+static void __gps_nmea_gsv(struct gps_data_t *const gps_handle, const gps_nmea_field_t *const fields, const size_t count) {
+    const int messages = __gps_nmea_integer(__gps_nmea_field(fields, count, 1)), number = __gps_nmea_integer(__gps_nmea_field(fields, count, 2));
+    if (messages < 1 || number < 1 || number > messages || count < 4)
+        return;
+    const size_t end            = count - (count - 4) % 4;
+    const int sigid             = (end < count) ? __gps_nmea_integer(fields[end]) : 0;
+    const unsigned char gnssid  = __gps_nmea_gnssid(fields[0].data + 1);
+    const unsigned char signal  = (unsigned char)((sigid > 0) ? sigid : 0);
+    struct satellite_t *const s = gps_handle->skyview;
+    if (number == 1) {
+        int kept = 0;
+        for (int i = 0; i < gps_handle->satellites_visible; i++)
+            if (s[i].gnssid != gnssid || s[i].sigid != signal)
+                s[kept++] = s[i];
+        gps_handle->satellites_visible = kept;
+    }
+    for (size_t i = 4; i + 4 <= end && gps_handle->satellites_visible < MAXCHANNELS; i += 4) {
+        const int prn = __gps_nmea_integer(fields[i]);
+        if (prn > 0)
+            s[gps_handle->satellites_visible++] = (struct satellite_t){ .ss = __gps_nmea_number(fields[i + 3]), .PRN = (short)prn, .gnssid = gnssid, .sigid = signal };
+    }
+    if (number == messages)
+        gps_handle->skyview_time = gps_handle->fix.time;
+}
+
+// Sentence types are dispatched through a table indexed by a hash of the three characters after the talker,
+// perfect over the types parsed (a collision is a duplicate initialiser, which -Woverride-init rejects), and
+// confirmed by comparing the type. Anything else is recognised from its header alone and skipped without
+// being checksummed or split.
+typedef void (*gps_nmea_parser_t)(struct gps_data_t *, const gps_nmea_field_t *, size_t);
+
+#define GPS_NMEA_PARSERS 16
+#define GPS_NMEA_SLOT(a, b, c) ((unsigned int)((a) ^ ((b) << 1) ^ (c)) & (GPS_NMEA_PARSERS - 1))
+
+static const struct {
+    char type[3];
+    gps_nmea_parser_t parse;
+} __gps_nmea_parsers[GPS_NMEA_PARSERS] = {
+    [GPS_NMEA_SLOT('G', 'G', 'A')] = { { 'G', 'G', 'A' }, __gps_nmea_gga }, [GPS_NMEA_SLOT('G', 'S', 'A')] = { { 'G', 'S', 'A' }, __gps_nmea_gsa },
+    [GPS_NMEA_SLOT('G', 'S', 'T')] = { { 'G', 'S', 'T' }, __gps_nmea_gst }, [GPS_NMEA_SLOT('G', 'S', 'V')] = { { 'G', 'S', 'V' }, __gps_nmea_gsv },
+    [GPS_NMEA_SLOT('R', 'M', 'C')] = { { 'R', 'M', 'C' }, __gps_nmea_rmc }, [GPS_NMEA_SLOT('Z', 'D', 'A')] = { { 'Z', 'D', 'A' }, __gps_nmea_zda },
+};
+
+// The parser for a sentence type, the three characters after the talker; NULL for a type not parsed.
+static gps_nmea_parser_t __gps_nmea_parser(const char *const type) {
+    const unsigned int slot = GPS_NMEA_SLOT(type[0], type[1], type[2]);
+    return (memcmp(__gps_nmea_parsers[slot].type, type, 3) == 0) ? __gps_nmea_parsers[slot].parse : NULL;
+}
+
+static bool __gps_nmea_wanted(const char *const type) { return __gps_nmea_parser(type) != NULL; }
+
+// Parses one sentence, given from its '$' up to but excluding the '*', with the checksum already verified.
+static void __gps_nmea_sentence(struct gps_data_t *const gps_handle, const char *const sentence, const size_t length) {
+    gps_nmea_field_t fields[GPS_NMEA_FIELDS];
+    const size_t count = __gps_nmea_split(sentence, length, fields, GPS_NMEA_FIELDS);
+    if (count < 1 || fields[0].length < (size_t)GPS_NMEA_HEADER_SZ)
+        return;
+    const gps_nmea_parser_t parse = __gps_nmea_parser(fields[0].data + GPS_NMEA_TALKER_SZ); // accept any talker: $GP, $GN, $GL, $GA, ...
+    if (parse != NULL)
+        parse(gps_handle, fields, count);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+// The framer finds line ends in the ring a word at a time: a word holding none of '\r', '\n' or '*' (the
+// common case, tested with the has-zero-byte trick) is folded into the checksum whole, since XOR is
+// associative, and only words that do hold one are walked bytewise. State carries across reads, so a partial
+// line is never rescanned, and a complete line is handed to the parser where it lies unless it wraps the end
+// of the ring, the only case that copies.
+#define GPS_NMEA_WORD_ONES (~0UL / 0xFF)
+#define GPS_NMEA_WORD_HIGHS (GPS_NMEA_WORD_ONES * 0x80)
+#define GPS_NMEA_WORD_HASZERO(w) (((w) - GPS_NMEA_WORD_ONES) & ~(w) & GPS_NMEA_WORD_HIGHS)
+#define GPS_NMEA_WORD_HAS(w, c) GPS_NMEA_WORD_HASZERO((w) ^ (GPS_NMEA_WORD_ONES * (unsigned char)(c)))
+
+static inline char __gps_nmea_ring_at(const struct gps_data_t *const gps_handle, const size_t position) { return gps_handle->ring[position & (GPS_NMEA_RING - 1)]; }
+
+static unsigned char __gps_nmea_fold(unsigned long x) {
+    for (size_t bits = sizeof(x) * 8 / 2; bits >= 8; bits /= 2)
+        x ^= x >> bits;
+    return (unsigned char)x;
+}
+
+// -1 if not a hex digit. Range tests are on unsigned values, so carry no signed-overflow assumption for the optimiser.
+static int __gps_nmea_hex(const char c) {
+    const unsigned int digit = (unsigned int)(unsigned char)c - '0', letter = ((unsigned int)(unsigned char)c | 0x20) - 'a'; // | 0x20 folds to lower case
+    return (digit < 10) ? (int)digit : (letter < 6) ? (int)letter + 10 : -1;
+}
+
+static void __gps_nmea_frame_reset(struct gps_data_t *const gps_handle) {
+    gps_handle->frame_scan  = 0;
+    gps_handle->frame_star  = 0;
+    gps_handle->frame_xor   = 0;
+    gps_handle->frame_skip  = false;
+    gps_handle->frame_ready = false;
+}
+
+// Advances the scan of the line at ring_tail over whatever has been read; true once it is complete. Skipped
+// lines are consumed as they are scanned, so an overlong one can never fill the ring.
+static bool __gps_nmea_frame(struct gps_data_t *const gps_handle) {
+    while (!gps_handle->frame_ready) {
+        const size_t position = gps_handle->ring_tail + gps_handle->frame_scan;
+        if (position >= gps_handle->ring_head)
+            return false;
+        const size_t offset = position & (GPS_NMEA_RING - 1), span_max = GPS_NMEA_RING - offset, available = gps_handle->ring_head - position;
+        const size_t span = (available < span_max) ? available : span_max;
+        const char *const base = gps_handle->ring + offset;
+        size_t i = 0;
+
+        if (gps_handle->frame_skip) {
+            const char *const eol = memchr(base, '\n', span), *const eor = memchr(base, '\r', (eol != NULL) ? (size_t)(eol - base) : span);
+            const char *const end = (eor != NULL) ? eor : eol;
+            gps_handle->ring_tail += (size_t)(((end != NULL) ? end + 1 : base + span) - base) + gps_handle->frame_scan;
+            if (end != NULL)
+                __gps_nmea_frame_reset(gps_handle);
+            else
+                gps_handle->frame_scan = 0;
+            continue;
+        }
+        if (gps_handle->frame_scan == 0) {
+            if (*base != '$') { // a stray terminator between lines, or noise: not a sentence
+                gps_handle->frame_skip = (*base != '\r' && *base != '\n');
+                gps_handle->ring_tail++;
+                continue;
+            }
+            gps_handle->frame_scan = 1; // the checksum starts after the '$'
+            if (span < GPS_NMEA_HEADER_SZ)
+                continue;
+            // The whole header is to hand, as it almost always is: take it in one step.
+            unsigned long header = 0;
+            for (size_t h = 1; h < GPS_NMEA_HEADER_SZ; h++) {
+                if (base[h] == '\r' || base[h] == '\n' || base[h] == '*')
+                    break;
+                header ^= (unsigned char)base[h];
+                gps_handle->frame_scan = h + 1;
+            }
+            if (gps_handle->frame_scan < GPS_NMEA_HEADER_SZ) {
+                gps_handle->frame_skip = true;
+                continue;
+            }
+            gps_handle->frame_xor = header;
+            if (!__gps_nmea_wanted(base + GPS_NMEA_TALKER_SZ)) {
+                gps_handle->frame_skip = true;
+                gps_handle->ring_tail += gps_handle->frame_scan;
+                gps_handle->frame_scan = 0;
+            }
+            continue;
+        }
+        if (gps_handle->frame_scan < GPS_NMEA_HEADER_SZ) {
+            // Byte by byte until the type is known, so that unwanted sentences are dropped before any more work.
+            const char c = *base;
+            if (c == '\r' || c == '\n' || c == '*') {
+                gps_handle->frame_skip = true;
+                continue;
+            }
+            gps_handle->frame_xor ^= (unsigned char)c;
+            if (++gps_handle->frame_scan == GPS_NMEA_HEADER_SZ) {
+                const char type[3] = { __gps_nmea_ring_at(gps_handle, gps_handle->ring_tail + GPS_NMEA_TALKER_SZ),
+                                       __gps_nmea_ring_at(gps_handle, gps_handle->ring_tail + GPS_NMEA_TALKER_SZ + 1),
+                                       __gps_nmea_ring_at(gps_handle, gps_handle->ring_tail + GPS_NMEA_TALKER_SZ + 2) };
+                if (!__gps_nmea_wanted(type)) {
+                    gps_handle->frame_skip = true;
+                    gps_handle->ring_tail += gps_handle->frame_scan;
+                    gps_handle->frame_scan = 0;
+                }
+            }
+            continue;
+        }
+
+        if (gps_handle->frame_star == 0)
+            for (; i + sizeof(unsigned long) <= span; i += sizeof(unsigned long)) {
+                unsigned long word;
+                memcpy(&word, base + i, sizeof(word));
+                if (GPS_NMEA_WORD_HAS(word, '\n') | GPS_NMEA_WORD_HAS(word, '\r') | GPS_NMEA_WORD_HAS(word, '*'))
+                    break;
+                gps_handle->frame_xor ^= word;
+            }
+        for (; i < span; i++) {
+            const char c = base[i];
+            if (c == '\r' || c == '\n') {
+                gps_handle->frame_scan += i;
+                gps_handle->frame_ready = true;
+                break;
+            }
+            if (gps_handle->frame_star == 0) {
+                if (c == '*')
+                    gps_handle->frame_star = gps_handle->frame_scan + i;
+                else
+                    gps_handle->frame_xor ^= (unsigned char)c;
+            }
+        }
+        if (!gps_handle->frame_ready) {
+            gps_handle->frame_scan += span;
+            if (gps_handle->frame_scan > GPS_NMEA_LINE_MAX) { // corruption: drop it rather than wait on it
+                gps_handle->stat_overlong++;
+                gps_handle->frame_skip = true;
+                gps_handle->ring_tail += gps_handle->frame_scan;
+                gps_handle->frame_scan = 0;
+            }
+        }
+    }
+    return true;
+}
+
+// Verifies and parses the framed line at ring_tail, then consumes it along with its terminator.
+static void __gps_nmea_frame_consume(struct gps_data_t *const gps_handle) {
+    const size_t length = gps_handle->frame_scan, star = gps_handle->frame_star;
+    if (length > GPS_NMEA_LINE_MAX)
+        gps_handle->stat_overlong++;
+    else if (star != 0 && star + 3 == length) {
+        const int hi = __gps_nmea_hex(__gps_nmea_ring_at(gps_handle, gps_handle->ring_tail + star + 1)),
+                  lo = __gps_nmea_hex(__gps_nmea_ring_at(gps_handle, gps_handle->ring_tail + star + 2));
+        if (hi >= 0 && lo >= 0 && (unsigned char)((hi << 4) | lo) == __gps_nmea_fold(gps_handle->frame_xor)) {
+            const size_t offset = gps_handle->ring_tail & (GPS_NMEA_RING - 1);
+            const char *sentence = gps_handle->ring + offset;
+            if (offset + star > GPS_NMEA_RING) {
+                const size_t first = GPS_NMEA_RING - offset;
+                memcpy(gps_handle->line, sentence, first);
+                memcpy(gps_handle->line + first, gps_handle->ring, star - first);
+                sentence = gps_handle->line;
+            }
+            __gps_nmea_sentence(gps_handle, sentence, star);
+        } else
+            gps_handle->stat_checksum++;
+    } else
+        gps_handle->stat_checksum++; // no checksum, or not where it should be: also not a sentence to trust
+    gps_handle->ring_tail += length + 1;
+    __gps_nmea_frame_reset(gps_handle);
 }
 
 // ------------------------------------------------------------------------------------------------------------------------
@@ -191,9 +616,12 @@ static int gps_open(const char *const host, const char *const port, struct gps_d
     gps_handle->fix.altMSL = gps_handle->fix.altHAE = NAN;
     gps_handle->dop.hdop                            = NAN;
     gps_handle->gsa_hdop                            = NAN;
+    gps_handle->gst.lat_err_deviation = gps_handle->gst.lon_err_deviation = gps_handle->gst.alt_err_deviation = NAN;
 
     if ((gps_handle->gps_fd = open(host, O_RDONLY | O_NOCTTY | O_NONBLOCK)) < 0)
         return -1;
+    struct stat st;
+    gps_handle->endable = fstat(gps_handle->gps_fd, &st) == 0 && (S_ISREG(st.st_mode) || S_ISFIFO(st.st_mode));
 
     struct termios tio;
     if (tcgetattr(gps_handle->gps_fd, &tio) == 0) {
@@ -223,47 +651,51 @@ static int gps_close(struct gps_data_t *const gps_handle) {
     return 0;
 }
 
+// As libgps: whether a report can be read without blocking, waiting up to timeout microseconds. A complete
+// sentence already framed counts, as it will not make the descriptor readable again; gps_read() frames the
+// next one ahead of returning whenever a single read delivered more than an epoch.
+static bool gps_waiting(const struct gps_data_t *const gps_handle, const int timeout) {
+    if (gps_handle->frame_ready)
+        return true;
+    struct pollfd pfd = { .fd = gps_handle->gps_fd, .events = POLLIN };
+    return poll(&pfd, 1, timeout / 1000) > 0;
+}
+
 static int gps_read(struct gps_data_t *const gps_handle, char *const message, const int message_len) {
     (void)message;
     (void)message_len;
 
     gps_handle->set = 0; // "set" describes this report only, as in libgps
 
-    // A line longer than the buffer can only be corruption: drop it rather than wedging on a full buffer.
-    // The length is held in a local so that the read offset and the read count visibly derive from the one
-    // value. Taken separately from the struct they are ranged independently, the pair then appears able to
-    // overshoot the array, and _FORTIFY_SOURCE=3 (default on Ubuntu's gcc) rejects the call outright.
-    size_t used = gps_handle->buffer_length;
-    if (used >= sizeof(gps_handle->buffer) - 1)
-        used = 0;
-    gps_handle->buffer_length = used;
-
-    const ssize_t n = read(gps_handle->gps_fd, gps_handle->buffer + used, sizeof(gps_handle->buffer) - used - 1);
-    if (n > 0) {
-        gps_handle->buffer_length = used + (size_t)n;
-        gps_handle->buffer[gps_handle->buffer_length] = '\0';
-    } else if (n < 0 && errno != EAGAIN) // EWOULDBLOCK is EAGAIN on Linux, so testing both would be a tautology
-        return (int)n;
+    // Reads straight into the ring's free space, which is at most two spans either side of the wrap.
+    ssize_t n            = 0;
+    const size_t used    = gps_handle->ring_head - gps_handle->ring_tail;
+    const size_t head    = gps_handle->ring_head & (GPS_NMEA_RING - 1);
+    const size_t space   = GPS_NMEA_RING - used;
+    const size_t to_wrap = GPS_NMEA_RING - head;
+    if (space > 0) {
+        struct iovec iov[2] = { { .iov_base = gps_handle->ring + head, .iov_len = (space < to_wrap) ? space : to_wrap },
+                                { .iov_base = gps_handle->ring, .iov_len = (space > to_wrap) ? space - to_wrap : 0 } };
+        n                   = readv(gps_handle->gps_fd, iov, (iov[1].iov_len > 0) ? 2 : 1);
+        gps_handle->stat_reads++;
+        if (n > 0) {
+            gps_handle->ring_head += (size_t)n;
+            gps_handle->stat_bytes += (size_t)n;
+        } else if (n == 0)
+            gps_handle->eof = gps_handle->endable;
+        else if (errno != EAGAIN) // EWOULDBLOCK is EAGAIN on Linux, so testing both would be a tautology
+            return (int)n;
+    }
 
     // Consume at most one epoch per call, mirroring libgps' one-report-per-read contract, and leave any
     // further sentences buffered for subsequent calls. A single read can span several epochs (a device that
     // delivers a whole burst in one USB transfer, or a backlog after a stall), and parsing them all here
-    // would silently discard every epoch but the last. Parsing continues from the buffer even when this read
-    // returned nothing, so a backlog still drains.
-    char *begin = gps_handle->buffer, *end;
-    while (gps_handle->set == 0 && (end = strpbrk(begin, "\r\n")) != NULL) {
-        *end = '\0';
-        if (*begin == '$')
-            __gps_nmea_sentence(gps_handle, begin);
-        begin = end + 1;
-    }
-
-    // Saturating: strpbrk stops at the NUL terminating the buffer, so consumed cannot exceed buffer_length,
-    // but subtracting without the guard would wrap rather than clamp if that ever ceased to hold.
-    const size_t consumed     = (size_t)(begin - gps_handle->buffer); // retain any partial trailing sentence
-    gps_handle->buffer_length = (consumed < gps_handle->buffer_length) ? gps_handle->buffer_length - consumed : 0;
-    memmove(gps_handle->buffer, begin, gps_handle->buffer_length);
-    gps_handle->buffer[gps_handle->buffer_length] = '\0';
+    // would silently discard every epoch but the last. Parsing continues from the ring even when this read
+    // returned nothing, so a backlog still drains; the line after an epoch is framed ahead for gps_waiting().
+    while (gps_handle->set == 0 && __gps_nmea_frame(gps_handle))
+        __gps_nmea_frame_consume(gps_handle);
+    if (gps_handle->set != 0)
+        (void)__gps_nmea_frame(gps_handle);
 
     return (gps_handle->set != 0) ? 1 : (int)((n > 0) ? n : 0);
 }